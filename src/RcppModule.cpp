@@ -39,6 +39,9 @@ Rcpp::List getBlockSizeR(SpatRaster* r, unsigned n, double frac) {
 */
 
 
+// memory settings for the chunk caches of multidimensional sources
+void md_cache_options(SpatOptions* opt);
+
 Rcpp::List getBlockSizeR(SpatRaster* r, SpatOptions* opt) {
 	BlockSize bs = r->getBlockSize(*opt);
 	Rcpp::List L = Rcpp::List::create(Rcpp::Named("row") = bs.row, Rcpp::Named("nrows") = bs.nrows, Rcpp::Named("n") = bs.n);
@@ -311,6 +314,7 @@ RCPP_MODULE(spat){
 	class_<SpatOptions>("SpatOptions")
 		.constructor()
 		.method("deepcopy", &SpatOptions::deepCopy, "deepCopy")
+		.method("md_cache_options", &md_cache_options)
 		.field("parallel", &SpatOptions::parallel)
 		.field("metadata", &SpatOptions::tags)
 		.property("tempdir", &SpatOptions::get_tempdir, &SpatOptions::set_tempdir )
@@ -325,10 +329,13 @@ RCPP_MODULE(spat){
 		.property("NAflag", &SpatOptions::get_NAflag, &SpatOptions::set_NAflag )
 		//.property("ncdfcopy", &SpatOptions::get_ncdfcopy, &SpatOptions::set_ncdfcopy )
 		.property("statistics", &SpatOptions::get_statistics, &SpatOptions::set_statistics )
+		.field("histogram", &SpatOptions::histogram)
 		.property("overwrite", &SpatOptions::get_overwrite, &SpatOptions::set_overwrite )
 		//.property("append", &SpatOptions::get_append, &SpatOptions::set_append )
 		.field("datatype_set", &SpatOptions::datatype_set)
 		.field("threads", &SpatOptions::threads)
+		.field("async", &SpatOptions::write_async)
+		.field("overviews", &SpatOptions::overviews)
 		.property("progress", &SpatOptions::get_progress, &SpatOptions::set_progress)
 		.field("progressbar", &SpatOptions::progressbar)
 		.property("ncopies", &SpatOptions::get_ncopies, &SpatOptions::set_ncopies)
@@ -369,6 +376,7 @@ RCPP_MODULE(spat){
 		.property("nrow", &SpatDataFrame::nrow, &SpatDataFrame::resize_rows, "nrow")
 		.property("ncol", &SpatDataFrame::ncol, &SpatDataFrame::resize_cols, "ncol")
 
+		.method("arrow_rows", &SpatDataFrame::arrow_rows)
 		.method("has_error", &SpatDataFrame::hasError)
 		.method("has_warning", &SpatDataFrame::hasWarning)
 		.method("getWarnings", &SpatDataFrame::getWarnings)
@@ -677,6 +685,9 @@ RCPP_MODULE(spat){
 		.constructor()
 		.field("v", &SpatVectorProxy::v )
 		.method("deepcopy", &SpatVectorProxy::deepCopy, "deepCopy")
+		.method("read_page", &SpatVectorProxy::read_page)
+		.method("count_features", &SpatVectorProxy::count_features)
+		.method("fid_breaks", &SpatVectorProxy::fid_breaks)
 	;
 
 
@@ -690,6 +701,7 @@ RCPP_MODULE(spat){
 		//.finalizer(&SpatRaster_finalizer)
 
 		.method("test", &SpatRaster::writeRasterM)
+		.method("rechunk", &SpatRaster::rechunk)
 
 		.method("centroid", &SpatRaster::centroid)
 
@@ -920,6 +932,8 @@ RCPP_MODULE(spat){
 
 		.method("patches", &SpatRaster::clumps)
 		.method("patches2", &SpatRaster::patches)
+		.method("patches_uf", &SpatRaster::patches_uf)
+		.method("patch_stats", &SpatRaster::patch_stats)
 		.method("boundaries", &SpatRaster::edges)
 		.method("buffer", &SpatRaster::buffer)
 		.method("gridDistance", &SpatRaster::gridDistance)
@@ -972,6 +986,7 @@ RCPP_MODULE(spat){
 		.method("focalValues", &SpatRaster::focal_values)
 		.method("count", &SpatRaster::count)
 		.method("freq", &SpatRaster::freq)
+		.method("crosstab", &SpatRaster::crosstab)
 		.method("geometry", &SpatRaster::geometry)
 
 		.method("get_aggregates", &SpatRaster::get_aggregates)
@@ -1015,6 +1030,7 @@ RCPP_MODULE(spat){
 		.method("rasterizePointsV", ( SpatRaster (SpatRaster::*)(SpatVector&, std::string, std::vector<double>&, bool, double, SpatOptions&) )( &SpatRaster::rasterizePoints))
 
 		.method("rasterizePointsXY", ( SpatRaster (SpatRaster::*)(std::vector<double>&, std::vector<double>&, std::string, std::vector<double>&, bool, double, SpatOptions&) )( &SpatRaster::rasterizePoints))
+		.method("rasterizePointStats", &SpatRaster::rasterizePointStats)
 
 		.method("rasterizeLyr", &SpatRaster::rasterizeLyr)
 		.method("rasterizeGeom", &SpatRaster::rasterizeGeom)
@@ -1039,6 +1055,8 @@ RCPP_MODULE(spat){
 		.method("sampleRandomValues", &SpatRaster::sampleRandomValues)
 		.method("scale", &SpatRaster::scale)
 		.method("scale_linear", &SpatRaster::scale_linear)
+		.method("lincomb", &SpatRaster::lincomb)
+		.method("predict_model", &SpatRaster::predict_model)
 		.method("shift", &SpatRaster::shift)
 		.method("similarity", &SpatRaster::similarity)
 		.method("terrain", &SpatRaster::terrain)
@@ -1054,6 +1072,7 @@ RCPP_MODULE(spat){
 		.method("where", &SpatRaster::where)
 		.method("sieve", &SpatRaster::sieveFilter)
 		.method("view", &SpatRaster::viewshed)
+		.method("viewshed_multi", &SpatRaster::viewshed_multi)
 		.method("proximity", &SpatRaster::proximity)
 		.method("fillNA", &SpatRaster::fillNA)
 
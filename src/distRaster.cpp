@@ -29,6 +29,11 @@
 #include "sort.h"
 #include "geosphere.h"
 
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
 /*
 inline void shortDistPoints(std::vector<double> &d, const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &px, const std::vector<double> &py, const bool& lonlat, const std::string& method, const double &lindist) {
 	if (lonlat) {
@@ -2655,421 +2660,229 @@ void do_flowdir(std::vector<double> &val, std::vector<double> &d, size_t nrow, s
 }
 
 
-void do_TRI(std::vector<double> &val, std::vector<double> const &d, size_t nrow, size_t ncol, bool before, bool after) {
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			val.push_back(
-				(fabs(d[i-1-ncol]-d[i]) + fabs(d[i-1]-d[i]) + fabs(d[i-1+ncol]-d[i]) +  fabs(d[i-ncol]-d[i]) + fabs(d[i+ncol]-d[i]) +  fabs(d[i+1-ncol]-d[i]) + fabs(d[i+1]-d[i]) +  fabs(d[i+1+ncol]-d[i])) / 8
-			);
-		}
-		val.push_back(NAN);
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-}
-
-inline double pow2(double x) {
-	return pow(x, 2);
-}
-
-void do_TRI_riley(std::vector<double> &val, std::vector<double> const &d, size_t nrow, size_t ncol, bool before, bool after) {
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			val.push_back(
-				sqrt(pow2(d[i-1-ncol]-d[i]) + pow2(d[i-1]-d[i]) + pow2(d[i-1+ncol]-d[i]) + 
-				pow2(d[i-ncol]-d[i]) + pow2(d[i+ncol]-d[i]) + pow2(d[i+1-ncol]-d[i]) + 
-				pow2(d[i+1]-d[i]) + pow2(d[i+1+ncol]-d[i]))
-			);
-		}
-		val.push_back(NAN);
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-}
-
-void do_TRI_rmsd(std::vector<double> &val, std::vector<double> const &d, size_t nrow, size_t ncol, bool before, bool after) {
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			val.push_back(
-				sqrt((pow2(d[i-1-ncol]-d[i]) + pow2(d[i-1]-d[i]) + pow2(d[i-1+ncol]-d[i]) + 
-				pow2(d[i-ncol]-d[i]) + pow2(d[i+ncol]-d[i]) + pow2(d[i+1-ncol]-d[i]) + 
-				pow2(d[i+1]-d[i]) + pow2(d[i+1+ncol]-d[i]))/8)
-			);
-		}
-		val.push_back(NAN);
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-}
-
-
-void do_TPI(std::vector<double> &val, const std::vector<double> &d, const size_t nrow, const size_t ncol, bool before, bool after) {
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			val.push_back( d[i] - (d[i-1-ncol] + d[i-1] + d[i-1+ncol] + d[i-ncol]
-			+ d[i+ncol] + d[i+1-ncol] + d[i+1] + d[i+1+ncol]) / 8 );
-		}
-		val.push_back(NAN);
-	}
-/*
-	if (expand) {
-		for (size_t i=1; i < (ncol-1); i++) {
-			val[i+add] = d[i] - (d[i-1] + d[i-1+ncol] + d[i+ncol] + d[i+1] + d[i+1+ncol]) / 5;
-			size_t j = i+(nrow-1) * ncol;
-			val[j+add] = d[j] - (d[j-1-ncol] + d[j-1] + d[j-ncol] + d[j+1-ncol] + d[j+1]) / 5;
-		}
-		for (size_t row=1; row< (nrow-1); row++) {
-			size_t i = row * ncol;
-			val[i+add] = d[i] - (d[i-ncol] + d[i+ncol] + d[i+1-ncol] + d[i+1] + d[i+1+ncol]) / 5;
-			i += ncol - 1;
-			val[i+add] = d[i] - (d[i-ncol] + d[i] + d[i+ncol] + d[i-ncol]) / 5;
-		}
-		size_t i = 0;
-		val[i+add] = d[i] - (d[i+ncol] + d[i+1] + d[i+1+ncol]) / 3;
-		i = ncol-1;
-		val[i+add] = d[i] - (d[i+ncol] + d[i-1] + d[i-1+ncol]) / 3;
-		i = (nrow-1)*ncol;
-		val[i+add] = d[i] - (d[i-ncol] + d[i+1] + d[i+1-ncol]) / 3;
-		i = (nrow*ncol)-1;
-		val[i+add] = d[i] - (d[i-ncol] + d[i-1] + d[i-1-ncol]) / 3;
-	}
-*/
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-
-}
-
-
-
-void do_roughness(std::vector<double> &val, const std::vector<double> &d, size_t nrow, size_t ncol, bool before, bool after) {
-
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-	int incol = (int)ncol;
-	int a[9] = { -1-incol, -1, -1+incol, -incol, 0, incol, 1-incol, 1, 1+incol };
-	double min, max, v;
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			min = d[i + a[0]];
-			max = d[i + a[0]];
-			for (size_t j = 1; j < 9; j++) {
-				v = d[i + a[j]];
-				if (v > max) {
-					max = v;
-				} else if (v < min) {
-					min = v;
-				}
-			}
-			val.push_back(max - min);
-		}
-		val.push_back(NAN);
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-}
-
-
 #ifndef M_PI
 #define M_PI (3.14159265358979323846)
 #endif
 
 
-
-
-void to_degrees(std::vector<double>& x, size_t start) {
-	double adj = 180 / M_PI;
-	for (size_t i=start; i<x.size(); i++) {
-		x[i] *= adj;
-	}
+double dmod(double x, double n) {
+	return(x - n * std::floor(x/n));
 }
 
 
-void do_slope(std::vector<double> &val, const std::vector<double> &d, size_t ngb, size_t nrow, size_t ncol, double dx, double dy, bool geo, std::vector<double> &gy, bool degrees, bool before, bool after) {
-
-	size_t start = val.size();
-	if (!before) {
-		val.resize(start + ncol, NAN);
-	}
-
-	std::vector<double> ddx;
-	if (geo) {
-		ddx.resize(nrow);
-		for (size_t i=0; i<nrow; i++) {
-			ddx[i] = distance_lonlat(-dx, gy[i], dx, gy[i]) / 2 ;
-		}
-	}
-
-	if (ngb == 4) {
-		if (geo) {
-			double xwi[2] = {-1,1};
-			double xw[2] = {0,0};
-			double yw[2] = {-1,1};
-
-			for (size_t i=0; i<2; i++) {
-				yw[i] = yw[i] / (2 * dy);
-			}
-
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t k=0; k<2; k++) {
-					xw[k] = xwi[k] / (-2 * ddx[row]);
-				}
-				val.push_back(NAN); // first col
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-
-					double zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					double zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					val.push_back( atan(sqrt( pow(zy, 2) + pow(zx, 2) )));
+// Fused terrain kernel. All requested variables are computed in one pass
+// over the 3x3 window of each cell. For each row, the window statistics that
+// the variables need (derivatives, sums, range) are first computed into row
+// buffers with simple branch-free loops that the compiler can vectorize; the
+// variables are then derived from these buffers.
+enum TerrainVar {
+	tv_TPI, tv_TRI, tv_TRIriley, tv_TRIrmsd, tv_aspect, tv_flowdir, tv_slope, tv_roughness,
+	tv_hillshade, tv_mdhillshade, tv_curvature, tv_profcurv, tv_plancurv
+};
+
+class TerrainKernel {
+	public:
+		std::vector<int> vars;
+		size_t ngb = 8;
+		bool degrees = true;
+		double coszen = 0, sinzen = 1, dir = 0;
+		bool slpasp=false, sumabs=false, sumsq=false, sumnb=false, range=false, curv=false;
+
+		void prepare(double angle, double direction) {
+			for (int v : vars) {
+				if ((v == tv_slope) || (v == tv_aspect) || (v == tv_hillshade) || (v == tv_mdhillshade)) slpasp = true;
+				else if (v == tv_TRI) sumabs = true;
+				else if ((v == tv_TRIriley) || (v == tv_TRIrmsd)) sumsq = true;
+				else if (v == tv_TPI) sumnb = true;
+				else if (v == tv_roughness) range = true;
+				else if ((v == tv_curvature) || (v == tv_profcurv) || (v == tv_plancurv)) curv = true;
+			}
+			dir = direction * M_PI / 180.0;
+			double zen = (90.0 - angle) * M_PI / 180.0;
+			coszen = cos(zen);
+			sinzen = sin(zen);
+		}
+
+		// does the kernel need the distance between cells?
+		bool needs_distance() const {
+			return slpasp || curv;
+		}
+
+		// "d" points to the first of three consecutive rows of "nc" values;
+		// the values for the middle row are written to out[k * ncell + off + col]
+		// for the k-th variable. The first and last column are NA
+		void row(const double *d, size_t nc, double dx, double dy, std::vector<double> &out, size_t ncell, size_t off) const {
+			const double *a = d;
+			const double *b = d + nc;
+			const double *c = d + 2 * nc;
+			// cell j in these buffers is column j+1
+			size_t n = nc - 2;
+			std::vector<double> slp, asp, sa, ss, sn, rmin, rmax, cD, cE, cF, cG, cH;
+
+			if (slpasp) {
+				slp.resize(n);
+				asp.resize(n);
+				if (ngb == 8) {
+					double xd = -8 * dx;
+					double yd = 8 * dy;
+					for (size_t j=0; j<n; j++) {
+						slp[j] = ((a[j+2] + 2*b[j+2] + c[j+2]) - (a[j] + 2*b[j] + c[j])) / xd;
+						asp[j] = ((c[j] + 2*c[j+1] + c[j+2]) - (a[j] + 2*a[j+1] + a[j+2])) / yd;
+					}
+				} else {
+					double xd = -2 * dx;
+					double yd = 2 * dy;
+					for (size_t j=0; j<n; j++) {
+						slp[j] = (b[j+2] - b[j]) / xd;
+						asp[j] = (c[j+1] - a[j+1]) / yd;
+					}
 				}
-				val.push_back(NAN); // last col
-			}
-		} else { // ngb == 8
-
-			double xw[2] = {-1,1};
-			double yw[2] = {-1,1};
-			for (size_t i=0; i<2; i++) {
-				xw[i] /= -2 * dx;
-				yw[i] /=  2 * dy;
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN);
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					double zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					val.push_back(  atan( sqrt( pow(zy, 2) + pow(zx, 2)  )));
+				double const twoPI = 2 * M_PI;
+				double const halfPI = M_PI / 2;
+				for (size_t j=0; j<n; j++) {
+					double zx = slp[j];
+					double zy = asp[j];
+					slp[j] = atan(sqrt(zx * zx + zy * zy));
+					asp[j] = dmod(halfPI - atan2(zy, zx), twoPI);
 				}
-				val.push_back(NAN);
 			}
-		}
-	} else {
-
-		if (geo) {
-
-			double xwi[6] = {-1,-2,-1,1,2,1};
-			double xw[6] = {0,0,0,0,0,0};
-			double yw[6] = {-1,1,-2,2,-1,1};
-
-			for (size_t i=0; i<6; i++) {
-				yw[i] = yw[i] / (8 * dy);
-			}
-
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t k=0; k<6; k++) {
-					xw[k] = xwi[k] / (8 * ddx[row]);
+			if (sumabs) {
+				sa.resize(n);
+				for (size_t j=0; j<n; j++) {
+					double z = b[j+1];
+					sa[j] = fabs(a[j]-z) + fabs(b[j]-z) + fabs(c[j]-z) + fabs(a[j+1]-z)
+						+ fabs(c[j+1]-z) + fabs(a[j+2]-z) + fabs(b[j+2]-z) + fabs(c[j+2]-z);
 				}
-				val.push_back(NAN);
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-					   + d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-
-					double zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2]
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					val.push_back( atan(sqrt( pow(zy, 2) + pow(zx, 2))));
-				}
-				val.push_back(NAN);
 			}
-		} else {
-
-			double xw[6] = {-1,-2,-1,1,2,1};
-			double yw[6] = {-1,1,-2,2,-1,1};
-			for (size_t i=0; i<6; i++) {
-				xw[i] /= -8 * dx;
-				yw[i] /= 8 * dy;
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN);
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-							+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					double zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2]
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					val.push_back( atan(sqrt( pow(zy, 2) + pow(zx, 2) )));
+			if (sumsq) {
+				ss.resize(n);
+				for (size_t j=0; j<n; j++) {
+					double z = b[j+1];
+					double e[8] = {a[j]-z, b[j]-z, c[j]-z, a[j+1]-z, c[j+1]-z, a[j+2]-z, b[j+2]-z, c[j+2]-z};
+					ss[j] = e[0]*e[0] + e[1]*e[1] + e[2]*e[2] + e[3]*e[3] + e[4]*e[4] + e[5]*e[5] + e[6]*e[6] + e[7]*e[7];
 				}
-				val.push_back(NAN);
-			}
-		}
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-	if (degrees) {
-		to_degrees(val, start);
-	}
-}
-
-
-double dmod(double x, double n) {
-	return(x - n * std::floor(x/n));
-}
-
-
-
-void do_aspect(std::vector<double> &val, const std::vector<double> &d, size_t ngb, size_t nrow, size_t ncol, double dx, double dy, bool geo, std::vector<double> &gy, bool degrees, bool before, bool after) {
-
-	size_t start = val.size();
-	if (!before) {
-		val.resize(start + ncol, NAN);
-	}
-	std::vector<double> ddx;
-	if (geo) {
-		ddx.resize(nrow);
-		for (size_t i=0; i<nrow; i++) {
-			ddx[i] = distance_lonlat(-dx, gy[i], dx, gy[i]) / 2 ;
-		}
-	}
-	double zy, zx;
-
-	//double const pi2 = M_PI / 2;
-	double const twoPI = 2 * M_PI;
-	double const halfPI = M_PI / 2;
-
-	if (ngb == 4) {
-		if (geo) {
-			double xwi[2] = {-1,1};
-			double xw[2] = {0,0};
-			double yw[2] = {-1,1};
-
-			for (size_t i=0; i<2; i++) {
-				yw[i] = yw[i] / (2 * dy);
 			}
-
-			for (size_t row=1; row < (nrow-1); row++) {
-				val.push_back(NAN);
-				for (size_t k=0; k<2; k++) {
-					xw[k] = xwi[k] / (-2 * ddx[row]);
-				}
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					zx = atan2(zy, zx);
-					val.push_back( std::fmod( halfPI - zx, twoPI) );
+			if (sumnb) {
+				sn.resize(n);
+				for (size_t j=0; j<n; j++) {
+					sn[j] = a[j] + b[j] + c[j] + a[j+1] + c[j+1] + a[j+2] + b[j+2] + c[j+2];
 				}
-				val.push_back(NAN);
 			}
-		} else {
-
-			double xw[2] = {-1,1};
-			double yw[2] = {-1,1};
-			for (size_t i=0; i<2; i++) {
-				xw[i] = xw[i] / (-2 * dx);
-				yw[i] = yw[i] / (2 * dy);
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN);
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					zx = atan2(zy, zx);
-					val.push_back( dmod( halfPI - zx, twoPI));
+			if (range) {
+				// std::min and std::max ignore a NaN second argument;
+				// a NaN in the first cell of the window gives NaN
+				rmin.resize(n);
+				rmax.resize(n);
+				for (size_t j=0; j<n; j++) {
+					double mn = a[j];
+					double mx = a[j];
+					const double w[8] = {b[j], c[j], a[j+1], b[j+1], c[j+1], a[j+2], b[j+2], c[j+2]};
+					for (size_t k=0; k<8; k++) {
+						mn = std::min(mn, w[k]);
+						mx = std::max(mx, w[k]);
+					}
+					rmin[j] = mn;
+					rmax[j] = mx;
 				}
-				val.push_back(NAN);
 			}
-		}
-	} else { //	(ngb == 8) {
-
-		if (geo) {
-
-			double xwi[6] = {-1,-2,-1,1,2,1};
-			double xw[6] = {0,0,0,0,0,0};
-			double yw[6] = {-1,1,-2,2,-1,1};
-
-			for (size_t i=0; i<6; i++) {
-				yw[i] /= (8 * dy);
-			}
-
-			for (size_t row=1; row < (nrow-1); row++) {
-				val.push_back(NAN);
-				for (size_t k=0; k<6; k++) {
-					xw[k] = xwi[k] / (-8 * ddx[row]);
-				}
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-
-					zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-							+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2]
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-
-					zx = atan2(zy, zx);
-					val.push_back( dmod( halfPI - zx, twoPI) );
+			if (curv) {
+				// Zevenbergen and Thorne (1987)
+				cD.resize(n); cE.resize(n); cF.resize(n); cG.resize(n); cH.resize(n);
+				double dx2 = dx * dx;
+				double dy2 = dy * dy;
+				double dxy4 = 4 * dx * dy;
+				for (size_t j=0; j<n; j++) {
+					double z = b[j+1];
+					cD[j] = ((b[j] + b[j+2]) / 2 - z) / dx2;
+					cE[j] = ((a[j+1] + c[j+1]) / 2 - z) / dy2;
+					cF[j] = (-a[j] + a[j+2] + c[j] - c[j+2]) / dxy4;
+					cG[j] = (b[j+2] - b[j]) / (2 * dx);
+					cH[j] = (a[j+1] - c[j+1]) / (2 * dy);
 				}
-				val.push_back(NAN);
 			}
 
-		} else {
-
-			double xw[6] = {-1,-2,-1,1,2,1};
-			double yw[6] = {-1,1,-2,2,-1,1};
-			for (size_t i=0; i<6; i++) {
-				xw[i] /= -8 * dx;
-				yw[i] /= 8 * dy;
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN);
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-						+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2]
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					zx = atan2(zy, zx);
-					val.push_back( dmod( halfPI - zx, twoPI) );
+			double const adj = 180 / M_PI;
+			for (size_t k=0; k<vars.size(); k++) {
+				double *o = &out[k * ncell + off + 1];
+				switch (vars[k]) {
+					case tv_slope:
+						if (degrees) {
+							for (size_t j=0; j<n; j++) o[j] = slp[j] * adj;
+						} else {
+							for (size_t j=0; j<n; j++) o[j] = slp[j];
+						}
+						break;
+					case tv_aspect:
+						if (degrees) {
+							for (size_t j=0; j<n; j++) o[j] = asp[j] * adj;
+						} else {
+							for (size_t j=0; j<n; j++) o[j] = asp[j];
+						}
+						break;
+					case tv_hillshade:
+						for (size_t j=0; j<n; j++) {
+							o[j] = cos(slp[j]) * coszen + sin(slp[j]) * sinzen * cos(dir - asp[j]);
+						}
+						break;
+					case tv_mdhillshade: {
+						// weighted mean of the (non-negative) hillshade for four directions.
+						// The weight for direction "az" is sin^2(aspect - az); see Mark (1992)
+						const double az[4] = {225 * M_PI / 180, 270 * M_PI / 180, 315 * M_PI / 180, 2 * M_PI};
+						for (size_t j=0; j<n; j++) {
+							double cs = cos(slp[j]) * coszen;
+							double si = sin(slp[j]) * sinzen;
+							double s = 0;
+							for (size_t q=0; q<4; q++) {
+								double w = sin(asp[j] - az[q]);
+								s += w * w * std::max(0.0, cs + si * cos(az[q] - asp[j]));
+							}
+							o[j] = s / 2;
+						}
+						break;
+					}
+					case tv_TPI:
+						for (size_t j=0; j<n; j++) o[j] = b[j+1] - sn[j] / 8;
+						break;
+					case tv_TRI:
+						for (size_t j=0; j<n; j++) o[j] = sa[j] / 8;
+						break;
+					case tv_TRIriley:
+						for (size_t j=0; j<n; j++) o[j] = sqrt(ss[j]);
+						break;
+					case tv_TRIrmsd:
+						for (size_t j=0; j<n; j++) o[j] = sqrt(ss[j] / 8);
+						break;
+					case tv_roughness:
+						for (size_t j=0; j<n; j++) o[j] = rmax[j] - rmin[j];
+						break;
+					case tv_curvature:
+						for (size_t j=0; j<n; j++) o[j] = -2 * (cD[j] + cE[j]);
+						break;
+					case tv_profcurv:
+						for (size_t j=0; j<n; j++) {
+							double g2 = cG[j] * cG[j];
+							double h2 = cH[j] * cH[j];
+							double gh = g2 + h2;
+							o[j] = (gh == 0) ? 0 : -2 * (cD[j] * g2 + cE[j] * h2 + cF[j] * cG[j] * cH[j]) / gh;
+						}
+						break;
+					case tv_plancurv:
+						for (size_t j=0; j<n; j++) {
+							double g2 = cG[j] * cG[j];
+							double h2 = cH[j] * cH[j];
+							double gh = g2 + h2;
+							o[j] = (gh == 0) ? 0 : 2 * (cD[j] * h2 + cE[j] * g2 - cF[j] * cG[j] * cH[j]) / gh;
+						}
+						break;
+					default:
+						break;
 				}
-				val.push_back(NAN);
 			}
 		}
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-	if (degrees) {
-		to_degrees(val, start);
-	}
-}
+};
 
 
-SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, bool degrees, unsigned seed, SpatOptions &opt) {
-
-//TPI, TRI, aspect, flowdir, slope, roughness
-	//std::sort(v.begin(), v.end());
-	//v.erase(std::unique(v.begin(), v.end()), v.end());
+SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, bool degrees, double angle, double direction, unsigned seed, SpatOptions &opt) {
 
 	SpatRaster out = geometry(v.size());
 	out.setNames(v);
@@ -3079,16 +2892,15 @@ SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, b
 		return out;
 	}
 
-	bool aspslope = false;
-	std::vector<std::string> f {"TPI", "TRI", "TRIriley", "TRIrmsd", "aspect", "flowdir", "slope", "roughness"};
+	TerrainKernel tk;
+	std::vector<std::string> f {"TPI", "TRI", "TRIriley", "TRIrmsd", "aspect", "flowdir", "slope", "roughness", "hillshade", "mdhillshade", "curvature", "profcurv", "plancurv"};
 	for (size_t i=0; i<v.size(); i++) {
-		if (std::find(f.begin(), f.end(), v[i]) == f.end()) {
+		auto it = std::find(f.begin(), f.end(), v[i]);
+		if (it == f.end()) {
 			out.setError("unknown terrain variable: " + v[i]);
 			return(out);
 		}
-		if (v[i] == "slope" || v[i] == "aspect") {
-			aspslope=true;
-		}
+		tk.vars.push_back(it - f.begin());
 	}
 	if ((v.size() == 1) && (v[0] == "flowdir")) {
 		out.setValueType(1);
@@ -3098,8 +2910,16 @@ SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, b
 		out.setError("neighbors should be 4 or 8");
 		return out;
 	}
+	tk.ngb = neighbors;
+	tk.degrees = degrees;
+	tk.prepare(angle, direction);
+
 	bool lonlat = is_lonlat();
+	double xr = xres();
 	double yr = yres();
+	if (lonlat && tk.needs_distance()) {
+		yr = distance_lonlat(0, 0, 0, yres());
+	}
 
 	if (!readStart()) {
 		out.setError(getError());
@@ -3115,14 +2935,14 @@ SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, b
 
 	if (nrow() < 3 || nc < 3) {
 		for (size_t i = 0; i < out.bs.n; i++) {
-			std::vector<double> val(out.bs.nrows[i] * nc, NAN);
+			std::vector<double> val(out.bs.nrows[i] * nc * v.size(), NAN);
 			if (!out.writeBlock(val, i)) return out;
 		}
+		out.writeStop();
+		readStop();
 		return out;
 	}
 
-
-	std::vector<double> y;
 	for (size_t i = 0; i < out.bs.n; i++) {
 		std::vector<double> d;
 		bool before= false;
@@ -3139,41 +2959,58 @@ SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, b
 			after = true;
 		}
 		readValues(d, rrow, rnrw, 0, nc);
-		if (lonlat && aspslope) {
+
+		std::vector<double> ddx;
+		if (lonlat && tk.needs_distance()) {
 			std::vector<int64_t> rows(rnrw);
 			std::iota(rows.begin(), rows.end(), rrow);
-			y = yFromRow(rows);
-			yr = distance_lonlat(0, 0, 0, yres());
-		}
-		std::vector<double> val;
-		val.reserve(out.bs.nrows[i] * ncol() * v.size());
-		for (size_t j =0; j<v.size(); j++) {
-			if (v[j] == "slope") {
-				do_slope(val, d, neighbors, rnrw, nc, xres(), yr, lonlat, y, degrees, before, after);
-			} else if (v[j] == "aspect") {
-				do_aspect(val, d, neighbors, rnrw, nc, xres(), yr, lonlat, y, degrees, before, after);
-			} else if (v[j] == "flowdir") {
-				double dx = xres();
-				double dy = yres();
-				if (lonlat) {
-					double yhalf = yFromRow((size_t) nrow()/2);
-					dx = distance_lonlat(0, yhalf, dx, yhalf);
-					dy = distance_lonlat(0, 0, 0, dy);
-				}
-				do_flowdir(val, d, rnrw, nc, dx, dy, seed, before, after);
-			} else if (v[j] == "roughness") {
-				do_roughness(val, d, rnrw, nc, before, after);
-			} else if (v[j] == "TPI") {
-				do_TPI(val, d, rnrw, nc, before, after);
-			} else if (v[j] == "TRI") {
-				do_TRI(val, d, rnrw, nc, before, after);
-			} else if (v[j] == "TRIriley") {
-				do_TRI_riley(val, d, rnrw, nc, before, after);
-			} else if (v[j] == "TRIrmsd") {
-				do_TRI_rmsd(val, d, rnrw, nc, before, after);			
-			} else {
-				out.setError("?"); return out;
-			}
+			std::vector<double> y = yFromRow(rows);
+			ddx.resize(rnrw);
+			for (size_t j=0; j<rnrw; j++) {
+				ddx[j] = distance_lonlat(-xr, y[j], xr, y[j]) / 2;
+			}
+		}
+
+		size_t nr = out.bs.nrows[i];
+		size_t ncell = nr * nc;
+		std::vector<double> val(ncell * v.size(), NAN);
+		// output row r is row r+before in d; the first and last row of the raster are NA
+		auto do_rows = [&](size_t start, size_t end) {
+			for (size_t r=start; r<end; r++) {
+				size_t dr = r + before;
+				if ((dr == 0) || (dr >= (rnrw-1))) continue;
+				double dx = lonlat ? (ddx.empty() ? xr : ddx[dr]) : xr;
+				tk.row(&d[(dr-1) * nc], nc, dx, yr, val, ncell, r * nc);
+			}
+		};
+#if defined(USE_TBB)
+		if (opt.parallel && (nr > 16)) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, nr, 8),
+				[&](const tbb::blocked_range<size_t>& range) {
+				do_rows(range.begin(), range.end());
+			});
+		} else {
+			do_rows(0, nr);
+		}
+#else
+		do_rows(0, nr);
+#endif
+
+		for (size_t k=0; k<v.size(); k++) {
+			if (tk.vars[k] != tv_flowdir) continue;
+			double dx = xr;
+			double dy = yres();
+			if (lonlat) {
+				double yhalf = yFromRow((size_t) nrow()/2);
+				dx = distance_lonlat(0, yhalf, dx, yhalf);
+				dy = distance_lonlat(0, 0, 0, dy);
+			}
+			// do_flowdir pads a copy of d
+			std::vector<double> dc = d;
+			std::vector<double> fd;
+			fd.reserve(ncell);
+			do_flowdir(fd, dc, rnrw, nc, dx, dy, seed, before, after);
+			std::copy(fd.begin(), fd.end(), val.begin() + k * ncell);
 		}
 		if (!out.writeBlock(val, i)) return out;
 	}
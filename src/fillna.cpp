@@ -0,0 +1,285 @@
+// Copyright (c) 2018-2026  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+// Fill missing values by interpolation from the surrounding cells, like
+// GDALFillNodata. For each missing cell, the nearest cell with a value within
+// "maxdist" cells is searched in each of four directions (cones of 90 degrees
+// centered on the north, east, south and west) and the missing value is the
+// inverse distance weighted mean of these values. This can be followed by
+// "niter" iterations of a 3x3 mean filter on the filled cells.
+// As in GDALFillNodata, the search uses sweeps over the rows and columns
+// that give, for each cell, the nearest cell with a value above, below, to
+// the left and to the right of it. For a cone, only one cell per column (or
+// row) within "maxdist" needs to be considered.
+// The output is computed by chunk of rows. A chunk is read with the
+// (maxdist + niter) rows above and below it, so that the raster does not need
+// to fit in memory. The rows of a chunk are processed in parallel.
+
+#include "spatRaster.h"
+
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+
+// the nearest row (or column) with a value, at or before (or after) each
+// cell in its column (or row); -1 if there is none
+struct FillIndex {
+	std::vector<int> up, down, left, right;
+
+	void make(const std::vector<double> &v, size_t nr, size_t nc) {
+		size_t n = nr * nc;
+		up.resize(n);
+		down.resize(n);
+		left.resize(n);
+		right.resize(n);
+		for (size_t r=0; r<nr; r++) {
+			size_t off = r * nc;
+			for (size_t c=0; c<nc; c++) {
+				size_t cell = off + c;
+				bool has = !std::isnan(v[cell]);
+				up[cell] = has ? (int)r : (r > 0 ? up[cell - nc] : -1);
+				left[cell] = has ? (int)c : (c > 0 ? left[cell - 1] : -1);
+			}
+			for (size_t c=nc; c>0; c--) {
+				size_t cell = off + c - 1;
+				right[cell] = std::isnan(v[cell]) ? (c < nc ? right[cell + 1] : -1) : (int)(c - 1);
+			}
+		}
+		for (size_t r=nr; r>0; r--) {
+			size_t off = (r - 1) * nc;
+			for (size_t c=0; c<nc; c++) {
+				size_t cell = off + c;
+				down[cell] = std::isnan(v[cell]) ? (r < nr ? down[cell + nc] : -1) : (int)(r - 1);
+			}
+		}
+	}
+};
+
+
+// the interpolated value for cell (r, c) in v (with nr rows and nc columns)
+double fill_cell(const std::vector<double> &v, const FillIndex &ix, size_t nr, size_t nc, size_t r, size_t c, long m) {
+	double d2[4] = {INFINITY, INFINITY, INFINITY, INFINITY};
+	double z[4] = {NAN, NAN, NAN, NAN};
+	double m2 = (double)m * m;
+	long lr = r, lc = c;
+	auto update = [&](size_t q, long i, long j, double dd) {
+		if ((dd <= m2) && (dd < d2[q])) {
+			d2[q] = dd;
+			z[q] = v[i * nc + j];
+		}
+	};
+	// north and south: in column c +/- k, the nearest cell at least k rows away
+	for (long k=0; k<=m; k++) {
+		double k2 = 2.0 * k * k;
+		if ((k2 > m2) || ((k2 >= d2[0]) && (k2 >= d2[2]))) break;
+		for (long s=-1; s<=1; s+=2) {
+			if ((k == 0) && (s == 1)) continue;
+			long j = lc + s * k;
+			if ((j < 0) || (j >= (long)nc)) continue;
+			if (lr >= k) {
+				long i = ix.up[(lr - k) * nc + j];
+				if ((i >= 0) && (i < lr)) update(0, i, j, (double)(lr-i) * (lr-i) + (double)k * k);
+			}
+			if (lr + k < (long)nr) {
+				long i = ix.down[(lr + k) * nc + j];
+				if (i > lr) update(2, i, j, (double)(i-lr) * (i-lr) + (double)k * k);
+			}
+		}
+	}
+	// east and west: in row r +/- k, the nearest cell more than k columns away
+	for (long k=0; k<m; k++) {
+		double k2 = (double)k * k + (double)(k+1) * (k+1);
+		if ((k2 > m2) || ((k2 >= d2[1]) && (k2 >= d2[3]))) break;
+		for (long s=-1; s<=1; s+=2) {
+			if ((k == 0) && (s == 1)) continue;
+			long i = lr + s * k;
+			if ((i < 0) || (i >= (long)nr)) continue;
+			if (lc > k) {
+				long j = ix.left[i * nc + lc - k - 1];
+				if (j >= 0) update(3, i, j, (double)(lc-j) * (lc-j) + (double)k * k);
+			}
+			if (lc + k + 1 < (long)nc) {
+				long j = ix.right[i * nc + lc + k + 1];
+				if (j >= 0) update(1, i, j, (double)(j-lc) * (j-lc) + (double)k * k);
+			}
+		}
+	}
+	double sw = 0, swz = 0;
+	for (size_t q=0; q<4; q++) {
+		if (std::isnan(z[q])) continue;
+		double w = 1 / std::sqrt(d2[q]);
+		sw += w;
+		swz += w * z[q];
+	}
+	return sw > 0 ? swz / sw : NAN;
+}
+
+
+// 3x3 mean (of the cells with a value) for the filled cells of rows a to b-1
+void fill_smooth(const std::vector<double> &v, const std::vector<double> &f, std::vector<double> &g, size_t nr, size_t nc, size_t a, size_t b) {
+	for (size_t r=a; r<b; r++) {
+		size_t r1 = r > 0 ? r - 1 : 0;
+		size_t r2 = std::min(r + 1, nr - 1);
+		for (size_t c=0; c<nc; c++) {
+			size_t cell = r * nc + c;
+			if ((!std::isnan(v[cell])) || std::isnan(f[cell])) {
+				g[cell] = f[cell];
+				continue;
+			}
+			size_t c1 = c > 0 ? c - 1 : 0;
+			size_t c2 = std::min(c + 1, nc - 1);
+			double s = 0;
+			size_t n = 0;
+			for (size_t i=r1; i<=r2; i++) {
+				for (size_t j=c1; j<=c2; j++) {
+					double x = f[i * nc + j];
+					if (!std::isnan(x)) {
+						s += x;
+						n++;
+					}
+				}
+			}
+			g[cell] = s / n;
+		}
+	}
+}
+
+
+SpatRaster SpatRaster::fillNA(double missing, double maxdist, int niter, SpatOptions &opt) {
+
+	SpatRaster out = geometry(nlyr(), true, true, true);
+
+	if (!hasValues()) {
+		out.setError("input raster has no values");
+		return out;
+	}
+	if (maxdist <= 0) {
+		out.setError("maxdist should be > 0");
+		return out;
+	}
+	if (niter < 0) {
+		out.setError("niter should be >= 0");
+		return out;
+	}
+
+	long m = std::ceil(maxdist);
+	size_t nr = nrow();
+	size_t nc = ncol();
+	size_t nl = nlyr();
+	size_t halo = m + niter;
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	// the values, and for one layer at a time: a copy, the filled and smoothed
+	// values, and the FillIndex. The rows of a chunk are read with the halo,
+	// and chunkSize does not consider that
+	opt.ncopies = std::max(opt.ncopies, (size_t)8);
+	size_t cs = chunkSize(opt);
+	if ((cs < nr) && (halo > 0)) {
+		double f = cs > (2 * halo) ? (double)cs / (cs - 2 * halo) : cs;
+		opt.ncopies = std::ceil(opt.ncopies * f);
+	}
+	if (!out.writeStart(opt, filenames())) {
+		readStop();
+		return out;
+	}
+
+	for (size_t i = 0; i < out.bs.n; i++) {
+		size_t r0 = out.bs.row[i];
+		size_t r1 = r0 + out.bs.nrows[i];
+		// the rows that are read
+		size_t R0 = r0 > halo ? r0 - halo : 0;
+		size_t R1 = std::min(nr, r1 + halo);
+		size_t bnr = R1 - R0;
+		size_t bn = bnr * nc;
+		// the rows that are filled (local row numbers)
+		size_t a = (r0 > (size_t)niter ? r0 - niter : 0) - R0;
+		size_t b = std::min(nr, r1 + niter) - R0;
+
+		std::vector<double> v;
+		readValues(v, R0, bnr, 0, nc);
+		if (hasError() || (v.size() != (bn * nl))) {
+			out.setError(hasError() ? getError() : "cannot read the values");
+			readStop();
+			return out;
+		}
+		if (!std::isnan(missing)) {
+			for (double &x : v) if (x == missing) x = NAN;
+		}
+
+		std::vector<double> w;
+		w.reserve(out.bs.nrows[i] * nc * nl);
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			std::vector<double> vl(v.begin() + lyr * bn, v.begin() + (lyr+1) * bn);
+			std::vector<double> f(vl);
+			FillIndex ix;
+			ix.make(vl, bnr, nc);
+
+			auto do_fill = [&](size_t start, size_t end) {
+				for (size_t r=start; r<end; r++) {
+					for (size_t c=0; c<nc; c++) {
+						size_t cell = r * nc + c;
+						if (std::isnan(vl[cell])) {
+							f[cell] = fill_cell(vl, ix, bnr, nc, r, c, m);
+						}
+					}
+				}
+			};
+#if defined(USE_TBB)
+			if (opt.parallel) {
+				tbb::parallel_for(tbb::blocked_range<size_t>(a, b, 1),
+					[&](const tbb::blocked_range<size_t>& range) {
+					do_fill(range.begin(), range.end());
+				});
+			} else {
+				do_fill(a, b);
+			}
+#else
+			do_fill(a, b);
+#endif
+
+			// each iteration is needed for one row less above and below
+			std::vector<double> g(f);
+			for (int it=1; it<=niter; it++) {
+				size_t sa = (r0 > (size_t)(niter-it) ? r0 - (niter-it) : 0) - R0;
+				size_t sb = std::min(nr, r1 + (niter-it)) - R0;
+#if defined(USE_TBB)
+				if (opt.parallel) {
+					tbb::parallel_for(tbb::blocked_range<size_t>(sa, sb, 1),
+						[&](const tbb::blocked_range<size_t>& range) {
+						fill_smooth(vl, f, g, bnr, nc, range.begin(), range.end());
+					});
+				} else {
+					fill_smooth(vl, f, g, bnr, nc, sa, sb);
+				}
+#else
+				fill_smooth(vl, f, g, bnr, nc, sa, sb);
+#endif
+				f.swap(g);
+			}
+			w.insert(w.end(), f.begin() + (r0 - R0) * nc, f.begin() + (r1 - R0) * nc);
+		}
+		if (!out.writeBlock(w, i)) return out;
+	}
+	readStop();
+	out.writeStop();
+	return out;
+}
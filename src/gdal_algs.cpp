@@ -32,6 +32,11 @@
 #include "recycle.h"
 #include <sstream>
 
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
 
 /*
 GDAL 3.10
@@ -593,12 +598,53 @@ SpatRaster SpatRaster::warper(SpatRaster x, std::string crs, std::string method,
 		return out;
 	}
 
+	if (opt.overviews >= 1) {
+		// output resolution expressed in the units of the input crs
+		double oxres = NAN, oyres = NAN;
+		if (use_crs) {
+			// the output extent covers the input
+			oxres = xres() * ncol() / out.ncol();
+			oyres = yres() * nrow() / out.nrow();
+		} else if (resample || (out.getSRS("wkt") == srccrs)) {
+			oxres = out.xres();
+			oyres = out.yres();
+		}
+		SpatRaster ovr;
+		size_t fx, fy;
+		if ((!std::isnan(oxres)) && useOverview(oxres, oyres, method, false, ovr, fx, fy, opt)) {
+			// warp to the output geometry that was computed from the original data
+			return ovr.warper(out, "", method, mask, false, resample, opt);
+		}
+	}
+
 	SpatOptions mopt;
 	if (mask) {
 		mopt = opt;
 		opt = SpatOptions(opt);
 	}
 
+	// native, with exact cell fractions for aligned grids, or with a cached
+	// warp plan (see warp.cpp)
+	bool native = false;
+	if (resample || (out.getSRS("wkt") == srccrs)) {
+		native = resample_aligned(out, method, opt);
+	}
+	if ((!native) && (!out.hasError()) && ((method == "near") || (method == "bilinear") || (method == "cubic") || (method == "average"))) {
+		native = warp_native(out, srccrs, method, opt);
+	}
+	if (native || out.hasError()) {
+		if (mask && !out.hasError()) {
+			SpatVector v = dense_extent(true, true);
+			v = v.project(out.getSRS("wkt"), true);
+			if (v.nrow() > 0) {
+				out = out.mask(v, false, NAN, true, mopt);
+			} else {
+				out.addWarning("masking failed");
+			}
+		}
+		return out;
+	}
+
 	opt.ncopies += 4;
 	if (!out.writeStart(opt, filenames())) {
 		return out;
@@ -1363,6 +1409,137 @@ SpatRaster SpatRaster::rectify(std::string method, SpatRaster aoi, unsigned usea
 
 
 
+// Polygonize by tiles (bands of rows) that are processed in parallel.
+// The cells are first labeled with the IDs of the (4-connected) patches of
+// cells with the same value. The IDs are polygonized by tile, and the polygons
+// of patches that cross the tile boundaries are stitched together by
+// dissolving the pieces with the same patch ID.
+SpatVector polygonize_tiled(SpatRaster &x, std::string name, bool round, SpatOptions &opt) {
+
+	SpatVector out;
+	out.srs = x.source[0].srs;
+
+	SpatRaster ids = x.geometry(1, false);
+	SpatDataFrame stats;
+	SpatOptions ops(opt);
+	ops.set_filenames({""});
+	ops.names = {"id"};
+	ops.set_datatype("INT4S");
+	if (!x.label_patches(4, true, false, 0, true, ids, stats, ops)) {
+		out.setError(ids.getError());
+		return out;
+	}
+	std::vector<double> value = stats.getD(1);
+	size_t np = value.size();
+	std::vector<std::vector<SpatGeom>> pieces(np);
+
+	if (!ids.readStart()) {
+		out.setError(ids.getError());
+		return out;
+	}
+	size_t nc = x.ncol();
+	double yr = x.yres();
+	SpatExtent e = x.getExtent();
+	opt.ncopies = std::max(opt.ncopies, (size_t)8);
+	BlockSize bs = ids.getBlockSize(opt);
+	SpatOptions copt(opt);
+	copt.parallel = false;
+	copt.set_filenames({""});
+
+	std::vector<double> v;
+	for (size_t i=0; i<bs.n; i++) {
+		ids.readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+		if (ids.hasError() || (v.size() != (bs.nrows[i] * nc))) {
+			out.setError(ids.hasError() ? ids.getError() : "cannot read the patches");
+			ids.readStop();
+			return out;
+		}
+		std::vector<size_t> tiles = {0};
+		size_t nt = std::min(bs.nrows[i], std::max((size_t)1, v.size() / 1048576));
+		double step = bs.nrows[i] / (double)nt;
+		for (size_t k=1; k<nt; k++) {
+			tiles.push_back(std::round(k * step));
+		}
+		tiles.push_back(bs.nrows[i]);
+
+		std::vector<SpatVector> tv(nt);
+		auto do_tile = [&](size_t k) {
+			size_t nr = tiles[k+1] - tiles[k];
+			double ymax = e.ymax - (bs.row[i] + tiles[k]) * yr;
+			SpatExtent te(e.xmin, e.xmax, ymax - nr * yr, ymax);
+			SpatRaster tile(nr, nc, 1, te, "");
+			std::vector<double> tvals(v.begin() + tiles[k] * nc, v.begin() + tiles[k+1] * nc);
+			SpatOptions topt(copt);
+			if (!tile.setValues(tvals, topt)) {
+				tv[k].setError(tile.getError());
+				return;
+			}
+			tv[k] = tile.polygonize(true, true, true, false, 0, topt);
+		};
+#if defined(USE_TBB)
+		if (nt > 1) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, nt),
+				[&](const tbb::blocked_range<size_t>& range) {
+				QuietGDALErrors quiet;
+				for (size_t k = range.begin(); k != range.end(); k++) {
+					do_tile(k);
+				}
+			});
+		} else {
+			do_tile(0);
+		}
+#else
+		for (size_t k=0; k<nt; k++) do_tile(k);
+#endif
+		for (size_t k=0; k<nt; k++) {
+			if (tv[k].hasError()) {
+				out.setError(tv[k].getError());
+				ids.readStop();
+				return out;
+			}
+			if (tv[k].nrow() == 0) continue;
+			std::vector<double> pid = tv[k].df.as_double(0);
+			for (size_t j=0; j<pid.size(); j++) {
+				pieces[pid[j] - 1].push_back(tv[k].getGeom(j));
+			}
+		}
+	}
+	ids.readStop();
+
+	std::vector<double> dval;
+	std::vector<long> ival;
+	for (size_t i=0; i<np; i++) {
+		if (pieces[i].empty()) continue;
+		if (pieces[i].size() == 1) {
+			out.addGeom(pieces[i][0]);
+		} else {
+			SpatVector p;
+			for (size_t j=0; j<pieces[i].size(); j++) {
+				p.addGeom(pieces[i][j]);
+			}
+			p = p.aggregate(true);
+			if (p.hasError()) {
+				out.setError(p.getError());
+				return out;
+			}
+			out.addGeom(p.getGeom(0));
+		}
+		pieces[i].clear();
+		if (round) {
+			ival.push_back(value[i]);
+		} else {
+			dval.push_back(value[i]);
+		}
+	}
+	if (round) {
+		out.df.add_column(ival, name);
+	} else {
+		out.df.add_column(dval, name);
+	}
+	return out;
+}
+
+
 SpatVector SpatRaster::polygonize(bool round, bool values, bool narm, bool aggregate, int digits, SpatOptions &opt) {
 
 	SpatVector out;
@@ -1377,6 +1554,36 @@ SpatVector SpatRaster::polygonize(bool round, bool values, bool narm, bool aggre
 		tmp = *this;
 	}
 
+	std::vector<std::string> nms = getNames();
+	std::string name = nms[0];
+
+	if (round && (digits > 0)) {
+		tmp = tmp.math2("round", digits, topt);
+		round = false;
+	}
+
+#if defined(USE_TBB)
+	// by tiles, in parallel
+	if (narm && opt.parallel) {
+		if (round && (tmp.getValueType(false)[0] == 0)) {
+			// GDALPolygonize uses the values as integers
+			tmp = tmp.math2("round", 0, topt);
+		}
+		out = polygonize_tiled(tmp, name, round, topt);
+		if (aggregate && (out.nrow() > 0)) {
+			out = out.aggregate(name, false);
+		}
+		if (!values) {
+			out.df = SpatDataFrame();
+		}
+		return out;
+	}
+#endif
+
+	if (tmp.source[0].extset || tmp.source[0].flipped) { 
+		tmp = tmp.hardCopy(topt);
+	}
+
 //	bool usemask = false;
 	SpatRaster mask;
 	if (narm) {
@@ -1386,14 +1593,6 @@ SpatVector SpatRaster::polygonize(bool round, bool values, bool narm, bool aggre
 		mask = tmp.isfinite(false, mopt);
 	} 
 
-		
-	if (round && (digits > 0)) {
-		tmp = tmp.math2("round", digits, topt);
-		round = false;
-	} else if (tmp.source[0].extset || tmp.source[0].flipped) { 
-		tmp = tmp.hardCopy(topt);
-	}
-
 /*
 	} else if (tmp.sources_from_file()) {
 		// for NAN and INT files. Should have a check for that
@@ -1449,9 +1648,6 @@ SpatVector SpatRaster::polygonize(bool round, bool values, bool narm, bool aggre
         out.setError("Creation of output dataset failed" );
         return out;
     }
-	std::vector<std::string> nms = getNames();
-	std::string name = nms[0];
-
 	OGRSpatialReference *SRS = NULL;
 
     OGRLayer *poLayer;
@@ -1935,231 +2131,7 @@ SpatRaster SpatRaster::proximity(double target, double exclude, bool keepNA, std
 	return out;
 }
 
-SpatRaster SpatRaster::sieveFilter(int threshold, int connections, SpatOptions &opt) {
-
-	if (nlyr() > 1) {
-		SpatOptions sopt(opt);
-		SpatRaster tmp = subset({0}, sopt);
-		tmp = tmp.sieveFilter(threshold, connections, opt);
-		tmp.addWarning("only the first layer was used");
-		return tmp;
-	}
-
-	SpatRaster out = geometry(1, true, true, true);
-
-	if (!hasValues()) {
-		out.setError("input raster has no values");
-		return out;
-	}
-	if (!((connections == 4) || (connections == 8))) {
-		out.setError("connections should be 4 or 8");
-		return out;
-	}
-	if (threshold < 2) {
-		out.setError("a threshold < 2 is not meaningful");
-		return out;
-	}
-	
-		
-	if (source[0].extset || source[0].flipped) { 
-		SpatOptions topt(opt);
-		SpatRaster etmp = hardCopy(topt);
-		return etmp.sieveFilter(threshold, connections, opt);
-	}
-
-
-	std::string tmp_filename = "";
-	std::string driver = "MEM";
-	SpatOptions ops(opt);
-	if (!canProcessInMemory(ops)) {
-		tmp_filename = tempFile(ops.get_tempdir(), ops.tmpfile, "_sieve.tif");
-		driver = "GTiff";
-		ops.set_filenames({tmp_filename});
-	}
 
-	SpatOptions mopt(opt);
-	SpatRaster mask = isnotnan(false, mopt);
-
-	GDALDatasetH hSrcDS, hMskDS, hDstDS;
-
-	if (!open_gdal(hSrcDS, 0, false, ops)) {
-		out.setError("cannot open input dataset");
-		return out;
-	}
-	if (!mask.open_gdal(hMskDS, 0, false, ops)) {
-		out.setError("cannot open mask dataset");
-		return out;
-	}
-
-	GDALDriverH hDriver = GDALGetDriverByName( driver.c_str() );
-	if ( hDriver == NULL ) {
-		out.setError("empty driver");
-		return out;
-	}
-	//opt.datatype = "INT4S";
-	if (!out.create_gdalDS(hDstDS, tmp_filename, driver, true, 0, source[0].has_scale_offset, source[0].scale, source[0].offset, ops)) {
-		out.setError("cannot create new dataset");
-		GDALClose(hSrcDS);
-		return out;
-	}
-
-	GDALRasterBandH hSrcBand = GDALGetRasterBand(hSrcDS, 1);
-	GDALRasterBandH hMskBand = GDALGetRasterBand(hMskDS, 1);
-	GDALRasterBandH hTargetBand = GDALGetRasterBand(hDstDS, 1);
-
-	if (GDALSieveFilter(hSrcBand, hMskBand, hTargetBand, threshold, connections, nullptr, NULL, NULL) != CE_None) {
-		GDALClose(hSrcDS);
-		GDALClose(hMskDS);
-		GDALClose(hDstDS);
-		out.setError("sieve failed");
-		return out;
-	}
-
-	GDALClose(hSrcDS);
-	GDALClose(hMskDS);
-
-	if (driver == "MEM") {
-		if (!out.from_gdalMEM(hDstDS, false, true)) {
-			out.setError("conversion failed (mem)");
-		}
-		GDALClose(hDstDS);
-
-	} else {
-		GDALClose(hDstDS);
-		out = SpatRaster(tmp_filename, {-1}, {""}, {}, {}, false, false, {});
-	}
-	
-	opt.names = getNames();
-	out.source[0].source_name = "";
-	return out.mask(mask, false, 0, NAN, opt);
-}
-
-
-
-bool getGridderAlgo(std::string algo, GDALGridAlgorithm &a) {
-	if (algo == "nearest") {
-		a = GGA_NearestNeighbor;
-	} else if (algo == "invdistpow") {
-		a = GGA_InverseDistanceToAPower;
-	} else if (algo == "invdistpownear") {
-		a = GGA_InverseDistanceToAPowerNearestNeighbor;
-	} else if (algo == "mean") {
-		a = GGA_MovingAverage;
-	} else if (algo == "min") {
-		a = GGA_MetricMinimum;
-	} else if (algo == "max") {
-		a = GGA_MetricMaximum;
-	} else if (algo == "range") {
-		a = GGA_MetricRange;
-	} else if (algo == "count") {
-		a = GGA_MetricCount;
-	} else if (algo == "distto") {
-		a = GGA_MetricAverageDistance;
-	} else if (algo == "distbetween") {
-		a = GGA_MetricAverageDistancePts;
-	} else if (algo == "linear") {
-		a = GGA_Linear;
-	} else {
-		return false;
-	}
-	return true;
-}
-
-
-void *metricOptions(std::vector<double> op) {
-	GDALGridDataMetricsOptions *poOptions = static_cast<GDALGridDataMetricsOptions *>(
-		CPLCalloc(sizeof(GDALGridDataMetricsOptions), 1));
-
-	#if GDAL_VERSION_MAJOR <= 3 && GDAL_VERSION_MINOR < 6
-	#else
-	poOptions->nSizeOfStructure = sizeof(GDALGridDataMetricsOptions);
-	#endif 
-		
-	poOptions->dfRadius1 = op[0];
-	poOptions->dfRadius2 = op[1];
-	poOptions->dfAngle = op[2];
-	poOptions->nMinPoints = std::max(0.0, op[3]);
-	poOptions->dfNoDataValue = op[4];
-	return poOptions;
-}
-
-void *invDistPowerOps(std::vector<double> op) {
-	GDALGridInverseDistanceToAPowerOptions *poOptions = static_cast<GDALGridInverseDistanceToAPowerOptions *>(
-		CPLCalloc(sizeof(GDALGridInverseDistanceToAPowerOptions), 1));
-
-	#if GDAL_VERSION_MAJOR <= 3 && GDAL_VERSION_MINOR < 6
-	#else
-	poOptions->nSizeOfStructure = sizeof(GDALGridInverseDistanceToAPowerOptions);
-	#endif
-	
-	poOptions->dfPower = op[0];
-	poOptions->dfSmoothing = op[1];
-	poOptions->dfRadius1 = op[2];
-	poOptions->dfRadius2 = op[3];
-	poOptions->dfAngle = op[4];
-	poOptions->nMaxPoints = std::max(0.0, op[5]);
-	poOptions->nMinPoints = std::max(0.0, op[6]);
-	poOptions->dfNoDataValue = op[7];
-
-	poOptions->dfAnisotropyRatio = 1;
-	poOptions->dfAnisotropyAngle = 0;
-
-	return poOptions;
-}
-
-void *invDistPowerNNOps(std::vector<double> op) {
-	GDALGridInverseDistanceToAPowerNearestNeighborOptions *poOptions = static_cast<GDALGridInverseDistanceToAPowerNearestNeighborOptions *>(
-		CPLCalloc(sizeof(GDALGridInverseDistanceToAPowerNearestNeighborOptions), 1));
-
-	#if GDAL_VERSION_MAJOR <= 3 && GDAL_VERSION_MINOR < 6
-	#else
-	poOptions->nSizeOfStructure = sizeof(GDALGridInverseDistanceToAPowerNearestNeighborOptions);
-	//poOptions->nMaxPointsPerQuadrant = 
-	//poOptions->nMinPointsPerQuadrant = 
-	#endif
-	poOptions->dfPower = op[0];
-	poOptions->dfSmoothing = op[1];
-	poOptions->dfRadius = op[2];
-	poOptions->nMaxPoints = std::max(0.0, op[3]);
-	poOptions->nMinPoints = std::max(0.0, op[4]);
-	poOptions->dfNoDataValue = op[5];
-	return poOptions;
-}
-
-void *moveAvgOps(std::vector<double> op) {
-	GDALGridMovingAverageOptions *poOptions = static_cast<GDALGridMovingAverageOptions *>(
-		CPLCalloc(sizeof(GDALGridMovingAverageOptions), 1));
-
-	#if GDAL_VERSION_MAJOR <= 3 && GDAL_VERSION_MINOR < 6
-	#else
-	poOptions->nSizeOfStructure = sizeof(GDALGridMovingAverageOptions);
-	#endif
-
-
-	poOptions->dfRadius1 = op[0];
-	poOptions->dfRadius2 = op[1];
-	poOptions->dfAngle = op[2];
-	poOptions->nMinPoints = std::max(op[3], 0.0);
-	poOptions->dfNoDataValue = op[4];
-	return poOptions;
-}
-
-
-void *nearngbOps(std::vector<double> op) {
-	GDALGridNearestNeighborOptions *poOptions = static_cast<GDALGridNearestNeighborOptions *>(
-		CPLCalloc(sizeof(GDALGridNearestNeighborOptions), 1));
-
-	#if GDAL_VERSION_MAJOR <= 3 && GDAL_VERSION_MINOR < 6
-	#else
-	poOptions->nSizeOfStructure = sizeof(GDALGridNearestNeighborOptions);
-	#endif
-
-	poOptions->dfRadius1 = op[0];
-	poOptions->dfRadius2 = op[1];
-	poOptions->dfAngle = op[2];
-	poOptions->dfNoDataValue = op[3];
-	return poOptions;
-}
 
 void *LinearOps(std::vector<double> op) {
 	GDALGridLinearOptions *poOptions = static_cast<GDALGridLinearOptions *>(
@@ -2177,53 +2149,18 @@ void *LinearOps(std::vector<double> op) {
 
 SpatRaster SpatRaster::rasterizeWindow(std::vector<double> x, std::vector<double> y, std::vector<double> z, std::string algo, std::vector<double> algops, SpatOptions &opt) {
 
-	SpatRaster out = geometry(1);
-	GDALGridAlgorithm eAlg;
-		if (!getGridderAlgo(algo, eAlg)) {
-		out.setError("unknown algorithm");
-		return out;
+	// all algorithms but "linear" (triangulation) are done natively (see gridding.cpp)
+	if (algo != "linear") {
+		return gridPoints(x, y, z, algo, algops, opt);
 	}
-	void *poOptions;
-	if (is_in_vector(algo, {"min", "max", "range", "count", "distto", "distbetween"})) {
-		if (algops.size() != 5) {
-			out.setError("incorrect algorithm options");
-			return out;
-		}
-		poOptions = metricOptions(algops) ;
-	} else if (algo == "mean") {
-		if (algops.size() != 5) {
-			out.setError("incorrect algorithm options");
-			return out;
-		}
-		poOptions = moveAvgOps(algops);
-	} else if (algo == "invdistpow") {
-		if (algops.size() != 8) {
-			out.setError("incorrect algorithm options");
-			return out;
-		}
-		poOptions = invDistPowerOps(algops);
-	} else if (algo == "invdistpownear") {
-		if (algops.size() != 6) {
-			out.setError("incorrect algorithm options");
-			return out;
-		}
-		poOptions = invDistPowerNNOps(algops);
-	} else if (algo == "nearest") {
-		if (algops.size() != 4) {
-			out.setError("incorrect algorithm options");
-			return out;
-		}
-		poOptions = nearngbOps(algops);
-	} else if (algo == "linear") {
-		if (algops.size() != 2) {
-			out.setError("incorrect algorithm options");
-			return out;
-		}
-		poOptions = LinearOps(algops);
-	} else {
-		out.setError("unknown algorithm");
+
+	SpatRaster out = geometry(1);
+	if (algops.size() != 2) {
+		out.setError("incorrect algorithm options");
 		return out;
 	}
+	GDALGridAlgorithm eAlg = GGA_Linear;
+	void *poOptions = LinearOps(algops);
 
 	SpatExtent e = out.getExtent();
 	if (!out.writeStart(opt, out.filenames())) {
@@ -2283,96 +2220,6 @@ CPLErr GDALFillNodata(GDALRasterBandH hTargetBand, GDALRasterBandH hMaskBand, do
 */
 
 
-SpatRaster SpatRaster::fillNA(double missing, double maxdist, int niter, SpatOptions &opt) {
-
-	SpatRaster out = geometry(1, true, true, true);
-
-	if (!hasValues()) {
-		out.setError("input raster has no values");
-		return out;
-	}
-	if (maxdist <= 0) {
-		out.setError("maxdist should be > 0");
-		return out;
-	}
-	if (niter < 0) {
-		out.setError("niter should be >= 0");
-		return out;
-	}
-
-	std::string filename = opt.get_filename();
-	std::string driver;
-	if (filename.empty()) {
-		if (canProcessInMemory(opt)) {
-			driver = "MEM";
-		} else {
-			filename = tempFile(opt.get_tempdir(), opt.tmpfile, ".tif");
-			opt.set_filenames({filename});
-			driver = "GTiff";
-		}
-	} else {
-		driver = opt.get_filetype();
-		getGDALdriver(filename, driver);
-		if (driver.empty()) {
-			setError("cannot guess file type from filename");
-			return out;
-		}
-		std::string errmsg;
-		if (!can_write({filename}, filenames(), opt.get_overwrite(), errmsg)) {
-			out.setError(errmsg);
-			return out;
-		}
-	}
-
-	SpatOptions ops(opt);
-	GDALDatasetH hSrcDS, hDstDS;
-	if (!open_gdal(hSrcDS, 0, false, ops)) {
-		out.setError("cannot open input dataset");
-		return out;
-	}
-
-	GDALDriverH hDriver = GDALGetDriverByName( driver.c_str() );
-	if ( hDriver == NULL ) {
-		out.setError("empty driver");
-		return out;
-	}
-
-	//opt.datatype = "INT4S";
-	if (!out.create_gdalDS(hDstDS, filename, driver, true, 0, source[0].has_scale_offset, source[0].scale, source[0].offset, opt)) {
-		out.setError("cannot create new dataset");
-		GDALClose(hSrcDS);
-		return out;
-	}
-
-	GDALRasterBandH hSrcBand = GDALGetRasterBand(hSrcDS, 1);
-	GDALRasterBandH hTargetBand = GDALGetRasterBand(hDstDS, 1);
-
-	if (GDALFillNodata(hTargetBand, hSrcBand, maxdist, 0, niter, NULL, NULL, NULL) != CE_None) {
-		out.setError("fillNA failed");
-		GDALClose(hSrcDS);
-		GDALClose(hDstDS);
-		return out;
-	}
-
-	GDALClose(hSrcDS);
-	if (driver == "MEM") {
-		if (!out.from_gdalMEM(hDstDS, false, true)) {
-			out.setError("conversion failed (mem)");
-		}
-		GDALClose(hDstDS);
-		return out;
-	}
-	
-	double adfMinMax[2];
-	GDALComputeRasterMinMax(hTargetBand, true, adfMinMax);
-	GDALSetRasterStatistics(hTargetBand, adfMinMax[0], adfMinMax[1], -9999, -9999);
-	GDALClose(hDstDS);
-	return SpatRaster(filename, {-1}, {""}, {}, {}, false, false, {});
-}
-
-
-
-
 /*
 #include <gdalpansharpen.h>
 SpatRaster SpatRaster::panSharpen(SpatRaster pan, SpatOptions &opt) {
@@ -8,7 +8,10 @@
 #include "string_utils.h"
 #include "file_utils.h"
 #include "vecmath.h"
+#include "ram.h"
 #include <stddef.h>
+#include <list>
+#include <unordered_map>
 
 //#include <cstdint>
 //#if INTPTR_MAX != INT32_MAX
@@ -510,6 +513,8 @@ bool SpatRaster::constructFromFileMulti(std::string fname, std::vector<int> subd
 // time
 	s.m_size = dimcount;
 	s.m_names = dimnames;
+	std::vector<GUInt64> bsize = poVar->GetBlockSize();
+	s.m_blocksize = std::vector<size_t>(bsize.begin(), bsize.end());
 	
 	setSource(s);
 	if (verbose) {
@@ -522,6 +527,18 @@ bool SpatRaster::constructFromFileMulti(std::string fname, std::vector<int> subd
 
 
 
+void md_start_cache(SpatRasterSource &s);
+
+// the memory settings for the chunk caches (from terraOptions, as there are
+// no options when a source is opened for reading)
+static double md_memmax = -1;
+static double md_memfrac = 0.5;
+
+void md_cache_options(SpatOptions* opt) {
+	md_memmax = opt->get_memmax();
+	md_memfrac = opt->get_memfrac();
+}
+
 bool SpatRaster::readStartMulti(size_t src) {
 
 	char ** drvs = NULL;
@@ -557,6 +574,7 @@ bool SpatRaster::readStartMulti(size_t src) {
 	} else {
 		source[src].m_array = poVar;
 	}
+	md_start_cache(source[src]);
 	source[src].open_read = true;
 	return true;
 }
@@ -565,161 +583,266 @@ bool SpatRaster::readStartMulti(size_t src) {
 bool SpatRaster::readStopMulti(size_t src) {
 //	Rcpp::Rcout << "readStopMulti\n";
 	source[src].open_read = false;
-	source[0].m_array.reset();
+	source[src].m_array.reset();
+	source[src].m_cache.reset();
 	return true;
 }
 
 
+// Multidimensional arrays are read chunk by chunk. The chunks are decoded once
+// and kept in a cache of the most recently used chunks, that is large enough
+// to hold a row of chunks (for all layers). Thus, each chunk is read once when
+// the values are read in blocks of rows, and also when many layers (e.g. a time
+// series) are read for the same rows or cells.
+
+class MDChunkCache {
+	public:
+		// the chunk size and the number of chunks of each dimension
+		std::vector<size_t> chunk, nchunks;
+		// maximum number of values
+		size_t maxsize = 0;
+		// read windows without the cache (a row of chunks does not fit)
+		bool direct = false;
+
+		// the values of a chunk (identified by its index in the grid of chunks)
+		// or nullptr if it is not in the cache
+		const std::vector<double>* get(size_t key) {
+			auto it = chunks.find(key);
+			if (it == chunks.end()) return nullptr;
+			used.splice(used.begin(), used, it->second.second);
+			return &it->second.first;
+		}
 
-bool SpatRaster::readChunkMulti(std::vector<double> &data, size_t src, size_t row, size_t nrows, size_t col, size_t ncols) {
+		const std::vector<double>* add(size_t key, std::vector<double> &v) {
+			size += v.size();
+			while ((size > maxsize) && (!used.empty())) {
+				auto it = chunks.find(used.back());
+				size -= it->second.first.size();
+				chunks.erase(it);
+				used.pop_back();
+			}
+			used.push_front(key);
+			auto &c = chunks[key];
+			c.first = std::move(v);
+			c.second = used.begin();
+			return &c.first;
+		}
 
-//	Rcpp::Rcout << "readChunkMulti\n";
-	std::vector<GUInt64> offset(source[src].m_ndims, 0);
+	private:
+		size_t size = 0;
+		std::list<size_t> used;
+		std::unordered_map<size_t, std::pair<std::vector<double>, std::list<size_t>::iterator>> chunks;
+};
+
+
+void md_start_cache(SpatRasterSource &s) {
+	size_t nd = s.m_ndims;
+	size_t dx = s.m_dims[0];
+	size_t dy = s.m_dims[1];
+	auto cache = std::make_shared<MDChunkCache>();
+	cache->chunk.resize(nd);
+	cache->nchunks.resize(nd);
+	double band = 1;
+	for (size_t d=0; d<nd; d++) {
+		size_t b = d < s.m_blocksize.size() ? s.m_blocksize[d] : 0;
+		if (b == 0) {
+			// not chunked
+			b = ((d == dx) || (d == dy)) ? 256 : 1;
+		}
+		b = std::max(std::min(b, s.m_size[d]), (size_t)1);
+		cache->chunk[d] = b;
+		cache->nchunks[d] = (s.m_size[d] + b - 1) / b;
+		band *= (d == dy) ? b : cache->nchunks[d] * b;
+	}
+	// a fourth of the memory that may be used
+	double supply = (md_memmax > 0 ? md_memmax : availableRAM()) * md_memfrac / 4;
+	double n = std::min(std::max(band, 16777216.0), supply);
+	cache->maxsize = std::max(n, 0.0);
+	cache->direct = band > n;
+	s.m_cache = cache;
+}
 
-/*	
-	std::vector<size_t> dims = source[src].m_dims;
-	Rcpp::Rcout << "dims: ";
-	for (size_t i=0; i<dims.size(); i++) {Rcpp::Rcout << dims[i] << " ";}
-	Rcpp::Rcout << "\n";
-*/
 
-	offset[source[src].m_dims[0]] = col;
-	offset[source[src].m_dims[1]] = row;
-	size_t ndim = source[src].m_dims.size();
-	std::vector<size_t> count(source[src].m_ndims, 1);
-	count[source[src].m_dims[0]] = ncols;
-	count[source[src].m_dims[1]] = nrows;
+// read a window of a layer from the array, without the cache
+bool md_read_window(SpatRasterSource &s, const std::vector<size_t> &idx, size_t a0, size_t row, size_t nrows, size_t col, size_t ncols, double *out, std::string &msg) {
+	size_t nd = s.m_ndims;
+	size_t dx = s.m_dims[0];
+	size_t dy = s.m_dims[1];
+	std::vector<GUInt64> start(idx.begin(), idx.end());
+	std::vector<size_t> count(nd, 1), stride(nd);
+	start[dy] = a0;
+	count[dy] = nrows;
+	start[dx] = col;
+	count[dx] = ncols;
+	std::vector<double> d(nrows * ncols);
+	if (!s.m_array->Read(start.data(), count.data(), nullptr, nullptr, GDALExtendedDataType::Create(GDT_Float64), d.data())) {
+		msg = "cannot read from " + s.m_arrayname;
+		return false;
+	}
+	if (s.m_hasNA) {
+		std::replace(d.begin(), d.end(), s.m_missing_value, (double)NAN);
+	}
+	stride[nd-1] = 1;
+	for (size_t i=nd-1; i>0; i--) {
+		stride[i-1] = stride[i] * count[i];
+	}
+	size_t ny = s.m_size[dy];
+	for (size_t ay=a0; ay<(a0+nrows); ay++) {
+		size_t r = s.flipped ? (ay - row) : (ny - 1 - ay - row);
+		const double *vv = d.data() + (ay - a0) * stride[dy];
+		double *o = out + r * ncols;
+		for (size_t ax=0; ax<ncols; ax++) {
+			o[ax] = vv[ax * stride[dx]];
+		}
+	}
+	return true;
+}
 
-//	std::vector<GPtrDiff_t> stride;
-	std::vector<long long int> stride;
-	if (!source[src].flipped) { 
-		stride.resize(ndim, 1);
-		stride[ndim-2] = -1;
-		offset[ndim-2] = nrow() - row - 1;
+
+// the values of a chunk, and (in count) its size, which is smaller than the
+// chunk size for chunks at the end of a dimension
+const std::vector<double>* md_chunk(SpatRasterSource &s, const std::vector<size_t> &cidx, std::vector<size_t> &count, std::string &msg) {
+	MDChunkCache &cache = *s.m_cache;
+	size_t nd = cidx.size();
+	size_t key = 0;
+	std::vector<GUInt64> start(nd);
+	for (size_t d=0; d<nd; d++) {
+		key = key * cache.nchunks[d] + cidx[d];
+		start[d] = cidx[d] * cache.chunk[d];
+		count[d] = std::min(cache.chunk[d], (size_t)(s.m_size[d] - start[d]));
 	}
+	const std::vector<double>* v = cache.get(key);
+	if (v != nullptr) return v;
 
-	size_t insize = data.size();
+	std::vector<double> d(vprod(count, false));
+	if (!s.m_array->Read(start.data(), count.data(), nullptr, nullptr, GDALExtendedDataType::Create(GDT_Float64), d.data())) {
+		msg = "cannot read from " + s.m_arrayname;
+		return nullptr;
+	}
+	if (s.m_hasNA) {
+		std::replace(d.begin(), d.end(), s.m_missing_value, (double)NAN);
+	}
+	return cache.add(key, d);
+}
 
-	auto dt = GDALExtendedDataType::Create(GDT_Float64);
 
-	if (source[src].in_order(false)) {
-		if (ndim == 3) {
-			offset[source[src].m_dims[2]] = source[src].layers[0];
-			count[source[src].m_dims[2]] = source[src].layers.size();
-		} else if (ndim == 4) {
-			count[source[src].m_dims[2]] = source[src].depth.size();
-			count[source[src].m_dims[3]] = source[src].time.size();		
-		}
-		size_t n=vprod(count, false);
-		data.resize(insize + n);
-		source[src].m_array->Read(&offset[0], &count[0], &stride[0], NULL, dt, &data[insize], NULL, 0);
-    } else {
-		count[source[src].m_dims[2]] = 1;
-
-		data.resize(insize + ncols*nrows*source[src].layers.size());
-//		size_t n=vprod(count, false);
-		for (size_t i=0; i<source[src].layers.size(); i++) {
-			if (ndim == 3) {
-				offset[source[src].m_dims[2]] = source[src].layers[i];
-			} else if (ndim == 4) {
-				setError("not handled yet");
-				return false;
-				count[source[src].m_dims[3]] = 1;		
+// read a window of a layer into "out" (nrows * ncols values; by row from top to bottom)
+// The layers are the time steps (three dimensions), or all time steps of
+// the first depth, then of the second depth, etc (four dimensions)
+bool md_read_layer(SpatRasterSource &s, size_t lyr, size_t row, size_t nrows, size_t col, size_t ncols, double *out, std::string &msg) {
+	MDChunkCache &cache = *s.m_cache;
+	size_t nd = s.m_ndims;
+	size_t dx = s.m_dims[0];
+	size_t dy = s.m_dims[1];
+	std::vector<size_t> idx(nd, 0);
+	if (s.m_dims.size() == 3) {
+		idx[s.m_dims[2]] = lyr;
+	} else if (s.m_dims.size() == 4) {
+		size_t nt = s.m_size[s.m_dims[3]];
+		idx[s.m_dims[2]] = lyr / nt;
+		idx[s.m_dims[3]] = lyr % nt;
+	}
+	// rows are in the opposite order in the array, unless it is "flipped"
+	size_t ny = s.m_size[dy];
+	size_t a0 = s.flipped ? row : ny - row - nrows;
+	size_t a1 = a0 + nrows;
+	if (cache.direct) {
+		return md_read_window(s, idx, a0, row, nrows, col, ncols, out, msg);
+	}
+	std::vector<size_t> cidx(nd), count(nd), stride(nd);
+	for (size_t d=0; d<nd; d++) {
+		cidx[d] = idx[d] / cache.chunk[d];
+	}
+	size_t by = cache.chunk[dy];
+	size_t bx = cache.chunk[dx];
+
+	for (size_t cy = a0 / by; (cy * by) < a1; cy++) {
+		cidx[dy] = cy;
+		for (size_t cx = col / bx; (cx * bx) < (col + ncols); cx++) {
+			cidx[dx] = cx;
+			const std::vector<double>* v = md_chunk(s, cidx, count, msg);
+			if (v == nullptr) return false;
+			stride[nd-1] = 1;
+			for (size_t d=nd-1; d>0; d--) {
+				stride[d-1] = stride[d] * count[d];
+			}
+			size_t base = 0;
+			for (size_t d=0; d<nd; d++) {
+				if ((d != dx) && (d != dy)) {
+					base += (idx[d] - cidx[d] * cache.chunk[d]) * stride[d];
+				}
+			}
+			size_t y0 = std::max(a0, cy * by);
+			size_t y1 = std::min(a1, cy * by + count[dy]);
+			size_t x0 = std::max(col, cx * bx);
+			size_t x1 = std::min(col + ncols, cx * bx + count[dx]);
+			for (size_t ay=y0; ay<y1; ay++) {
+				size_t r = s.flipped ? (ay - row) : (ny - 1 - ay - row);
+				const double *vv = v->data() + base + (ay - cy * by) * stride[dy];
+				double *o = out + r * ncols;
+				for (size_t ax=x0; ax<x1; ax++) {
+					o[ax - col] = vv[(ax - cx * bx) * stride[dx]];
+				}
 			}
-			source[src].m_array->Read(&offset[0], &count[0], NULL, NULL, dt, &data[insize+i], NULL, 0);
 		}
 	}
+	return true;
+}
 
-	if (source[src].m_hasNA) {
-//		Rcpp::Rcout << source[src].m_missing_value << std::endl;
-		std::replace (data.begin()+insize, data.end(), source[src].m_missing_value, (double)NAN);
-	}
 
-//	data.insert(data.end(), out.begin(), out.end());
+bool SpatRaster::readChunkMulti(std::vector<double> &data, size_t src, size_t row, size_t nrows, size_t col, size_t ncols) {
+
+	SpatRasterSource &s = source[src];
+	size_t insize = data.size();
+	size_t nl = s.layers.size();
+	size_t nc = nrows * ncols;
+	data.resize(insize + nl * nc, NAN);
+	std::string msg;
+	for (size_t i=0; i<nl; i++) {
+		if (!md_read_layer(s, s.layers[i], row, nrows, col, ncols, &data[insize + i * nc], msg)) {
+			setError(msg);
+			return false;
+		}
+	}
 	return true;
 }
 
+
 bool SpatRaster::readRowColMulti(size_t src, std::vector<std::vector<double>> &out, size_t outstart, std::vector<int64_t> &rows, const std::vector<int64_t> &cols) {
 	
 //	Rcpp::Rcout << "readRowColMulti " << src << "\n";
 	if (!readStartMulti(src)) {
 		return false;
 	}
+	SpatRasterSource &s = source[src];
 	size_t n = rows.size();
-	size_t nl = source[src].layers.size();
-
-	out.resize(n);
-	size_t outend = outstart + nl;
-	for (size_t i=outstart; i<outend; i++) {
-		out[i].reserve(n);
-	}
-
-	std::vector<GUInt64> offset(source[src].m_ndims, 0);
-
-	size_t ndim = source[src].m_dims.size();
-	std::vector<size_t> count(source[src].m_ndims, 1);
-
-//	std::vector<GPtrDiff_t> stride;
-	std::vector<long long> stride;
-	if (!source[src].flipped) { 
-		stride.resize(ndim, 1);
-		stride[ndim-2] = -1;
-		int64_t nr = nrow();
-		for (int64_t &r : rows) r = nr - r - 1;  
-	}
-	if (source[src].in_order(false)) {
-		if (ndim == 3) {
-			offset[source[src].m_dims[2]] = source[src].layers[0];
-			count[source[src].m_dims[2]] = source[src].layers.size();
-		} else if (ndim == 4) {
-			count[source[src].m_dims[2]] = source[src].depth.size();
-			count[source[src].m_dims[3]] = source[src].time.size();		
-		}
-	} else {
-		if (ndim == 4) {
-			setError("not handled yet");
-			return false;
-		}
-		count[source[src].m_dims[3]] = 1;			
-	}
-
-	auto dt = GDALExtendedDataType::Create(GDT_Float64);
-
-	std::vector<double> v(n, NAN);
-	for (size_t i=0; i<n; i++) {
-	
-		if (std::isnan(cols[i]) || std::isnan(rows[i])) {
-			for (size_t i=0; i<n; i++) {
-				out[outstart+i].push_back(NAN);
-			}			
-			continue;
-		}
-		offset[source[src].m_dims[0]] = cols[i];
-		offset[source[src].m_dims[1]] = rows[i];
+	size_t nl = s.layers.size();
 
-		if (source[src].in_order(false)) {
-			source[src].m_array->Read(&offset[0], &count[0], &stride[0], NULL, dt, &v[0], NULL, 0);
-		} else {
-			for (size_t j=0; j<source[src].layers.size(); j++) {
-				offset[source[src].m_dims[2]] = source[src].layers[j];
-				source[src].m_array->Read(&offset[0], &count[0], NULL, NULL, dt, &v[j], NULL, 0);
+	out.resize(outstart + nl);
+	for (size_t i=outstart; i<(outstart+nl); i++) {
+		out[i].resize(n, NAN);
+	}
+	int64_t nr = nrow();
+	int64_t nc = ncol();
+	std::string msg;
+	// by layer, such that all cells in a chunk are read together
+	for (size_t j=0; j<nl; j++) {
+		std::vector<double> &v = out[outstart + j];
+		for (size_t i=0; i<n; i++) {
+			if ((rows[i] < 0) || (rows[i] >= nr) || (cols[i] < 0) || (cols[i] >= nc)) continue;
+			if (!md_read_layer(s, s.layers[j], rows[i], 1, cols[i], 1, &v[i], msg)) {
+				setError(msg);
+				readStopMulti(src);
+				return false;
 			}
 		}
-		if (source[src].m_hasNA) {
-			std::replace(v.begin(), v.end(), source[src].m_missing_value, (double)NAN);
-		}
-		for (size_t i=0; i<nl; i++) {
-			out[outstart+i].push_back(v[i]);
-		}
 	}
-
 	readStopMulti(src);	
 	return true;
 }
 
 
 
-
 bool SpatRaster::writeStartMulti(SpatOptions &opt, const std::vector<std::string> &srcnames) {
 
 	if (!hasValues()) {
@@ -836,6 +959,172 @@ bool SpatRaster::writeStopMulti() {
 	return true;
 }
 
+
+// Write the values to a multidimensional (netCDF or Zarr) file with chunks of
+// chunks[0] layers, chunks[1] rows and chunks[2] columns. With many layers in a
+// chunk, the time series of a cell are stored together. The values are read and
+// written in blocks of rows that are a multiple of the chunk height, such that
+// each chunk is written once, and memory use is bounded by the block size.
+SpatRaster SpatRaster::rechunk(std::vector<size_t> chunks, SpatOptions &opt) {
+
+	SpatRaster out;
+	if (!hasValues()) {
+		out.setError("there are no cell values");
+		return out;
+	}
+	if (chunks.size() != 3) {
+		out.setError("chunks should have three values");
+		return out;
+	}
+	size_t nl = nlyr();
+	size_t ny = nrow();
+	size_t nx = ncol();
+	chunks[0] = std::max(std::min(chunks[0], nl), (size_t)1);
+	chunks[1] = std::max(std::min(chunks[1], ny), (size_t)1);
+	chunks[2] = std::max(std::min(chunks[2], nx), (size_t)1);
+
+	std::string filename = opt.get_filename();
+	if (filename.empty()) {
+		out.setError("empty filename");
+		return out;
+	}
+	std::string msg;
+	if (!can_write({filename}, filenames(), opt.get_overwrite(), msg)) {
+		out.setError(msg);
+		return out;
+	}
+	std::string driver = opt.get_filetype();
+	if (driver.empty()) {
+		std::string ext = getFileExt(filename);
+		lowercase(ext);
+		driver = (ext == ".zarr") ? "Zarr" : "netCDF";
+	}
+	if ((driver != "netCDF") && (driver != "Zarr")) {
+		out.setError("filetype should be netCDF or Zarr");
+		return out;
+	}
+	GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName(driver.c_str());
+	if (poDriver == NULL) {
+		out.setError("GDAL driver not available: " + driver);
+		return out;
+	}
+	GDALDataset *poDS = poDriver->CreateMultiDimensional(filename.c_str(), NULL, NULL);
+	if (poDS == NULL) {
+		out.setError("failed writing " + driver + " file");
+		return out;
+	}
+	auto rg = poDS->GetRootGroup();
+	auto dt = GDALExtendedDataType::Create(GDT_Float64);
+
+	bool time = hasTime();
+	std::string zname = time ? "time" : "layer";
+	std::vector<std::shared_ptr<GDALDimension>> dims = {
+		rg->CreateDimension(zname, time ? "TEMPORAL" : "", "", nl),
+		rg->CreateDimension("y", "HORIZONTAL_Y", "", ny),
+		rg->CreateDimension("x", "HORIZONTAL_X", "", nx)
+	};
+
+	// coordinates
+	std::vector<double> z(nl);
+	std::string zunit = "";
+	if (time) {
+		std::vector<int64_t> tm = getTime();
+		bool days = getTimeStep() == "days";
+		for (size_t i=0; i<nl; i++) {
+			z[i] = days ? tm[i] / 86400.0 : tm[i];
+		}
+		zunit = days ? "days since 1970-01-01" : "seconds since 1970-01-01 00:00:00";
+	} else {
+		std::iota(z.begin(), z.end(), 1);
+	}
+	std::vector<double> yc, xc;
+	yFromRow(yc);
+	xFromCol(xc);
+	std::vector<std::vector<double>> crds = {z, yc, xc};
+	std::vector<std::string> cnames = {zname, "y", "x"};
+	for (size_t i=0; i<3; i++) {
+		auto a = rg->CreateMDArray(cnames[i], {dims[i]}, dt);
+		if (!a) {
+			GDALClose(poDS);
+			out.setError("cannot create dimension " + cnames[i]);
+			return out;
+		}
+		if ((i == 0) && (!zunit.empty())) a->SetUnit(zunit);
+		GUInt64 start = 0;
+		size_t count = crds[i].size();
+		a->Write(&start, &count, nullptr, nullptr, dt, crds[i].data());
+		dims[i]->SetIndexingVariable(a);
+	}
+
+	CPLStringList aopt;
+	std::string bsize = "BLOCKSIZE=" + std::to_string(chunks[0]) + "," + std::to_string(chunks[1]) + "," + std::to_string(chunks[2]);
+	aopt.AddString(bsize.c_str());
+	for (size_t i=0; i<opt.gdal_options.size(); i++) {
+		aopt.AddString(opt.gdal_options[i].c_str());
+	}
+	// Float32 if requested, or if the values are Float32 in the source file(s)
+	std::vector<std::string> dtypes = getDataType(true, false);
+	bool flt4 = opt.datatype_set ? (opt.get_datatype() == "FLT4S") : ((dtypes.size() == 1) && (dtypes[0] == "FLT4S"));
+	GDALDataType gdt = flt4 ? GDT_Float32 : GDT_Float64;
+
+	std::vector<std::string> vn = strsplit_last(source[0].source_name, "/");
+	std::string vname = vn[vn.size()-1];
+	if (vname.empty()) vname = "values";
+	auto var = rg->CreateMDArray(vname, dims, GDALExtendedDataType::Create(gdt), aopt.List());
+	if (!var) {
+		GDALClose(poDS);
+		out.setError("cannot create array");
+		return out;
+	}
+	var->SetNoDataValue((double)NAN);
+
+	std::string wkt = source[0].srs.wkt;
+	if (!wkt.empty()) {
+		OGRSpatialReference srs;
+		if (srs.importFromWkt(wkt.c_str()) == OGRERR_NONE) {
+			if (!var->SetSpatialRef(&srs)) {
+				addWarning("failed to assign CRS to array");
+			}
+		}
+	}
+
+	BlockSize bs = getBlockSize(opt);
+	size_t rows = std::max(bs.nrows[0] / chunks[1], (size_t)1) * chunks[1];
+	if (!readStart()) {
+		GDALClose(poDS);
+		out.setError(getError());
+		return out;
+	}
+	for (size_t r=0; r<ny; r+=rows) {
+		size_t nr = std::min(rows, ny - r);
+		std::vector<double> v;
+		readValues(v, r, nr, 0, nx);
+		if (hasError() || (v.size() != (nl * nr * nx))) {
+			readStop();
+			GDALClose(poDS);
+			out.setError(hasError() ? getError() : "cannot read values");
+			return out;
+		}
+		std::vector<GUInt64> start = {0, r, 0};
+		std::vector<size_t> count = {nl, nr, nx};
+		if (!var->Write(start.data(), count.data(), nullptr, nullptr, dt, v.data())) {
+			readStop();
+			GDALClose(poDS);
+			out.setError("cannot write values");
+			return out;
+		}
+	}
+	readStop();
+	var.reset();
+	dims.clear();
+	rg.reset();
+	GDALClose(poDS);
+
+	std::vector<std::string> empty;
+	out.constructFromFileMulti(filename, {0}, {vname}, {driver}, empty, {-1}, false, false, {""});
+	return out;
+}
+
 #else
 
 
@@ -849,6 +1138,9 @@ bool SpatRaster::readStartMulti(size_t src) {
 	return false;
 }
 
+void md_cache_options(SpatOptions* opt) {
+}
+
 bool SpatRaster::readStopMulti(size_t src) {
 	return false;
 }
@@ -873,24 +1165,31 @@ bool SpatRaster::writeStopMulti() {
 	return false;
 }
 
+SpatRaster SpatRaster::rechunk(std::vector<size_t> chunks, SpatOptions &opt) {
+	SpatRaster out;
+	out.setError("multidim is not supported with GDAL < 3.4 or on 32-bit systems");
+	return out;
+}
+
 #endif
 
 
 std::vector<double> SpatRaster::readValuesMulti(size_t src, size_t row, size_t nrows, size_t col, size_t ncols, int lyr) {
 
-	Rcpp::Rcout << "readValuesMulti\n";
 	std::vector<double> out;
+	if (!readStartMulti(src)) {
+		return out;
+	}
 	if (lyr < 0) {
-		if (!readStartMulti(src)) {
-			return out;
-		}
 		readChunkMulti(out, src, row, nrows, col, ncols);
-		readStopMulti(src);
-		return out;
-	} else {
-		Rcpp::Rcout << "empty\n";
-		return out;
+	} else if (lyr < (int)source[src].layers.size()) {
+		std::vector<size_t> lyrs = source[src].layers;
+		source[src].layers = {lyrs[lyr]};
+		readChunkMulti(out, src, row, nrows, col, ncols);
+		source[src].layers = lyrs;
 	}
+	readStopMulti(src);
+	return out;
 }
 
 
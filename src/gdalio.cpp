@@ -842,7 +842,7 @@ bool SpatRaster::from_gdalMEM(GDALDatasetH hDS, bool set_geometry, bool get_valu
 
 
 
-char ** set_GDAL_options(std::string driver, double diskNeeded, bool writeRGB, std::vector<std::string> gdal_options) {
+char ** set_GDAL_options(std::string driver, double diskNeeded, bool writeRGB, std::vector<std::string> gdal_options, bool threads) {
 
 	char ** gdalops = NULL;
 	if (driver == "GTiff") {
@@ -872,6 +872,19 @@ char ** set_GDAL_options(std::string driver, double diskNeeded, bool writeRGB, s
 				gdalops = CSLSetNameValue( gdalops, "BIGTIFF", "YES");
 			}
 		}
+		if (compressed && threads) {
+			// multi-threaded compression, unless the user set NUM_THREADS
+			bool nthreads = true;
+			for (size_t i=0; i<gdal_options.size(); i++) {
+				if (gdal_options[i].substr(0, 11) == "NUM_THREADS") {
+					nthreads = false;
+					break;
+				}
+			}
+			if (nthreads) {
+				gdalops = CSLSetNameValue( gdalops, "NUM_THREADS", "ALL_CPUS");
+			}
+		}
 		if (writeRGB) {
 			gdalops = CSLSetNameValue( gdalops, "PROFILE", "GeoTIFF");
 		}
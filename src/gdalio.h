@@ -25,5 +25,20 @@ std::vector<std::vector<std::string>> parse_metadata_sds(std::vector<std::string
 void getGDALdriver(std::string &filename, std::string &driver);
 bool getNAvalue(GDALDataType gdt, double & naval);
 GDALDataset* openGDAL(std::string filename, unsigned OpenFlag, std::vector<std::string> allowed_drivers, std::vector<std::string> open_options);
-char ** set_GDAL_options(std::string driver, double diskNeeded, bool writeRGB, std::vector<std::string> gdal_options);
+char ** set_GDAL_options(std::string driver, double diskNeeded, bool writeRGB, std::vector<std::string> gdal_options, bool threads=false);
 std::vector<std::string> ncdf_filternames(std::vector<std::string> const &s);
+
+
+#ifndef QUIETGDALERRORS_GUARD
+#define QUIETGDALERRORS_GUARD
+#include "cpl_error.h"
+
+// GDAL errors are passed to the R error handler, that cannot be called from
+// other threads. An object of this class (created in such a thread) ignores
+// GDAL errors while it exists; the return values should be checked instead.
+class QuietGDALErrors {
+	public:
+		QuietGDALErrors() { CPLPushErrorHandler(CPLQuietErrorHandler); }
+		~QuietGDALErrors() { CPLPopErrorHandler(); }
+};
+#endif
@@ -0,0 +1,415 @@
+// Copyright (c) 2018-2026  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+// Interpolation (gridding) of points to a raster, with the algorithms
+// (and parameters) of GDALGrid: nearest neighbor, inverse distance to a power
+// (with a search ellipse, or with the nearest points within a radius),
+// moving average and the "metrics" (min, max, range, count, average distance
+// to the points and average distance between the points).
+// The points are indexed once in a grid of buckets (sorted by bucket), and
+// the search windows of the cells only visit the buckets that they overlap.
+// The rows of a block are computed in parallel and each block is written
+// before the next one is computed.
+
+#include "spatRaster.h"
+
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+
+class PointBuckets {
+	public:
+		std::vector<double> x, y, z;
+		double xmin=0, ymin=0, size=1;
+		size_t nx=1, ny=1;
+		// the points of bucket b are start[b] to start[b+1]
+		std::vector<size_t> start;
+
+		void build(const std::vector<double> &px, const std::vector<double> &py, const std::vector<double> &pz) {
+			size_t n = 0;
+			double xmax = -INFINITY, ymax = -INFINITY;
+			xmin = INFINITY;
+			ymin = INFINITY;
+			for (size_t i=0; i<px.size(); i++) {
+				if (std::isnan(px[i]) || std::isnan(py[i])) continue;
+				xmin = std::min(xmin, px[i]);
+				xmax = std::max(xmax, px[i]);
+				ymin = std::min(ymin, py[i]);
+				ymax = std::max(ymax, py[i]);
+				n++;
+			}
+			if (n == 0) {
+				xmin = ymin = 0;
+				nx = ny = 1;
+				start = {0, 0};
+				return;
+			}
+			double w = xmax - xmin;
+			double h = ymax - ymin;
+			// about two points per bucket
+			size = std::sqrt(std::max(w * h, 0.0) * 2 / n);
+			if (!(size > 0)) size = std::max(std::max(w, h) / std::max(n, (size_t)1), 1e-9);
+			nx = std::floor(w / size) + 1;
+			ny = std::floor(h / size) + 1;
+			while ((nx * ny) > (2 * n + 16)) {
+				size *= 1.5;
+				nx = std::floor(w / size) + 1;
+				ny = std::floor(h / size) + 1;
+			}
+			std::vector<size_t> b(px.size());
+			start.resize(0);
+			start.resize(nx * ny + 1, 0);
+			for (size_t i=0; i<px.size(); i++) {
+				if (std::isnan(px[i]) || std::isnan(py[i])) continue;
+				b[i] = bucket(px[i], py[i]);
+				start[b[i] + 1]++;
+			}
+			for (size_t i=1; i<start.size(); i++) {
+				start[i] += start[i-1];
+			}
+			std::vector<size_t> pos(start.begin(), start.end()-1);
+			x.resize(n);
+			y.resize(n);
+			z.resize(n);
+			for (size_t i=0; i<px.size(); i++) {
+				if (std::isnan(px[i]) || std::isnan(py[i])) continue;
+				size_t j = pos[b[i]]++;
+				x[j] = px[i];
+				y[j] = py[i];
+				z[j] = pz[i];
+			}
+		}
+
+		size_t col(double px) const {
+			double c = std::floor((px - xmin) / size);
+			return c < 0 ? 0 : std::min((size_t)c, nx-1);
+		}
+		size_t row(double py) const {
+			double r = std::floor((py - ymin) / size);
+			return r < 0 ? 0 : std::min((size_t)r, ny-1);
+		}
+		size_t bucket(double px, double py) const {
+			return row(py) * nx + col(px);
+		}
+
+		// call f(i) for the points in the buckets that overlap with a rectangle
+		template <typename F>
+		void rect(double x1, double x2, double y1, double y2, F f) const {
+			if ((x2 < xmin) || (y2 < ymin) || (x1 > (xmin + nx * size)) || (y1 > (ymin + ny * size))) return;
+			size_t c1 = col(x1), c2 = col(x2);
+			size_t r1 = row(y1), r2 = row(y2);
+			for (size_t r=r1; r<=r2; r++) {
+				size_t off = r * nx;
+				// the buckets in a row are contiguous
+				size_t a = start[off + c1];
+				size_t b = start[off + c2 + 1];
+				for (size_t i=a; i<b; i++) f(i);
+			}
+		}
+
+		// the k nearest points within distance maxd (if maxd > 0), as
+		// (squared distance, index) pairs sorted by distance
+		void nearest(double px, double py, size_t k, double maxd, std::vector<std::pair<double, size_t>> &nb) const {
+			nb.resize(0);
+			if (x.empty() || (k == 0)) return;
+			double maxd2 = maxd > 0 ? maxd * maxd : INFINITY;
+			size_t cc = col(px);
+			size_t cr = row(py);
+			size_t nring = std::max(nx, ny);
+			for (size_t ring=0; ring<=nring; ring++) {
+				long c1 = (long)cc - (long)ring, c2 = (long)cc + (long)ring;
+				long r1 = (long)cr - (long)ring, r2 = (long)cr + (long)ring;
+				for (long r=std::max(r1, 0L); r<=std::min(r2, (long)ny-1); r++) {
+					bool edge = (r == r1) || (r == r2);
+					for (long c=std::max(c1, 0L); c<=std::min(c2, (long)nx-1); c++) {
+						if ((!edge) && (c != c1) && (c != c2)) {
+							// skip the inside of the ring
+							c = std::max(c, c2 - 1);
+							continue;
+						}
+						size_t bb = r * nx + c;
+						for (size_t i=start[bb]; i<start[bb+1]; i++) {
+							double dx = x[i] - px;
+							double dy = y[i] - py;
+							double d2 = dx * dx + dy * dy;
+							if (d2 <= maxd2) nb.push_back({d2, i});
+						}
+					}
+				}
+				if (nb.size() > k) {
+					std::nth_element(nb.begin(), nb.begin() + (k-1), nb.end());
+					nb.resize(k);
+				}
+				// the distance to the points that have not been visited
+				double bound = INFINITY;
+				if (c1 > 0) bound = std::min(bound, px - (xmin + c1 * size));
+				if ((size_t)(c2 + 1) < nx) bound = std::min(bound, (xmin + (c2 + 1) * size) - px);
+				if (r1 > 0) bound = std::min(bound, py - (ymin + r1 * size));
+				if ((size_t)(r2 + 1) < ny) bound = std::min(bound, (ymin + (r2 + 1) * size) - py);
+				if (std::isinf(bound)) break; // all buckets visited
+				if (bound > 0) {
+					double b2 = bound * bound;
+					if (b2 > maxd2) break;
+					if (nb.size() == k) {
+						double dk = 0;
+						for (size_t j=0; j<nb.size(); j++) dk = std::max(dk, nb[j].first);
+						if (dk <= b2) break;
+					}
+				}
+			}
+			std::sort(nb.begin(), nb.end());
+		}
+};
+
+
+enum GridAlgo {ga_nearest, ga_invdistpow, ga_invdistpownear, ga_mean, ga_min, ga_max, ga_range, ga_count, ga_distto, ga_distbetween};
+
+class GridAlgorithm {
+	public:
+		int algo;
+		double power=2, smoothing=0, r1=0, r2=0, cosa=1, sina=0, nodata=NAN;
+		size_t maxpts=0, minpts=0;
+		bool all=true;
+
+		bool set(const std::string &a, std::vector<double> op, std::string &msg) {
+			std::vector<std::string> algos {"nearest", "invdistpow", "invdistpownear", "mean", "min", "max", "range", "count", "distto", "distbetween"};
+			auto it = std::find(algos.begin(), algos.end(), a);
+			if (it == algos.end()) {
+				msg = "unknown algorithm";
+				return false;
+			}
+			algo = it - algos.begin();
+			double angle = 0;
+			if (algo >= ga_mean) {
+				if (op.size() != 5) {
+					msg = "incorrect algorithm options";
+					return false;
+				}
+				r1 = op[0]; r2 = op[1]; angle = op[2]; minpts = npts(op[3]); nodata = op[4];
+			} else if (algo == ga_invdistpow) {
+				if (op.size() != 8) {
+					msg = "incorrect algorithm options";
+					return false;
+				}
+				power = op[0]; smoothing = op[1]; r1 = op[2]; r2 = op[3]; angle = op[4];
+				maxpts = npts(op[5]); minpts = npts(op[6]); nodata = op[7];
+			} else if (algo == ga_invdistpownear) {
+				if (op.size() != 6) {
+					msg = "incorrect algorithm options";
+					return false;
+				}
+				power = op[0]; smoothing = op[1]; r1 = op[2]; r2 = op[2];
+				maxpts = npts(op[3]); minpts = npts(op[4]); nodata = op[5];
+			} else { // nearest
+				if (op.size() != 4) {
+					msg = "incorrect algorithm options";
+					return false;
+				}
+				r1 = op[0]; r2 = op[1]; angle = op[2]; nodata = op[3];
+			}
+			r1 = std::fabs(r1);
+			r2 = std::fabs(r2);
+			all = (r1 == 0) || (r2 == 0);
+			angle = angle * M_PI / 180.0;
+			cosa = cos(angle);
+			sina = sin(angle);
+			return true;
+		}
+
+		// the value for the cell centered at (cx, cy)
+		double cell(const PointBuckets &p, double cx, double cy, std::vector<size_t> &w, std::vector<std::pair<double, size_t>> &nb) const {
+			if (algo == ga_invdistpownear) {
+				p.nearest(cx, cy, maxpts == 0 ? p.x.size() : maxpts, all ? 0 : r1, nb);
+				if (nb.empty() || (nb.size() < minpts)) return nodata;
+				return idw(p, nb);
+			}
+			if ((algo == ga_nearest) && (all || (r1 == r2))) {
+				p.nearest(cx, cy, 1, all ? 0 : r1, nb);
+				return nb.empty() ? nodata : p.z[nb[0].second];
+			}
+
+			// the points in the search ellipse
+			w.resize(0);
+			if (all) {
+				w.resize(p.x.size());
+				std::iota(w.begin(), w.end(), 0);
+			} else {
+				double r = std::max(r1, r2);
+				double r12 = r1 * r1;
+				double r22 = r2 * r2;
+				double rr = r12 * r22;
+				p.rect(cx - r, cx + r, cy - r, cy + r, [&](size_t i) {
+					double dx = p.x[i] - cx;
+					double dy = p.y[i] - cy;
+					double rx = dx * cosa + dy * sina;
+					double ry = dy * cosa - dx * sina;
+					if ((r22 * rx * rx + r12 * ry * ry) <= rr) w.push_back(i);
+				});
+			}
+			size_t n = w.size();
+			if ((n == 0) && (algo != ga_count)) return nodata;
+			if (n < minpts) return nodata;
+
+			if (algo == ga_nearest) {
+				double dmin = INFINITY;
+				double v = nodata;
+				for (size_t i : w) {
+					double d = sqdist(p, i, cx, cy);
+					if (d < dmin) {
+						dmin = d;
+						v = p.z[i];
+					}
+				}
+				return v;
+			} else if (algo == ga_invdistpow) {
+				nb.resize(0);
+				for (size_t i : w) nb.push_back({sqdist(p, i, cx, cy), i});
+				if ((maxpts > 0) && (maxpts < n)) {
+					std::nth_element(nb.begin(), nb.begin() + (maxpts-1), nb.end());
+					nb.resize(maxpts);
+				}
+				return idw(p, nb);
+			} else if (algo == ga_mean) {
+				double s = 0;
+				for (size_t i : w) s += p.z[i];
+				return s / n;
+			} else if (algo == ga_min) {
+				double v = p.z[w[0]];
+				for (size_t i : w) v = std::min(v, p.z[i]);
+				return v;
+			} else if (algo == ga_max) {
+				double v = p.z[w[0]];
+				for (size_t i : w) v = std::max(v, p.z[i]);
+				return v;
+			} else if (algo == ga_range) {
+				double mn = p.z[w[0]];
+				double mx = mn;
+				for (size_t i : w) {
+					mn = std::min(mn, p.z[i]);
+					mx = std::max(mx, p.z[i]);
+				}
+				return mx - mn;
+			} else if (algo == ga_count) {
+				return n;
+			} else if (algo == ga_distto) {
+				double s = 0;
+				for (size_t i : w) s += std::sqrt(sqdist(p, i, cx, cy));
+				return s / n;
+			} else { // distbetween
+				if (n == 1) return 0;
+				double s = 0;
+				for (size_t i=0; i<n; i++) {
+					for (size_t j=i+1; j<n; j++) {
+						double dx = p.x[w[i]] - p.x[w[j]];
+						double dy = p.y[w[i]] - p.y[w[j]];
+						s += std::sqrt(dx * dx + dy * dy);
+					}
+				}
+				return s / (n * (n - 1) / 2.0);
+			}
+		}
+
+	private:
+		static size_t npts(double x) {
+			if (!(x > 0)) return 0;
+			if (x > 1e15) return 0; // Inf: no limit
+			return x;
+		}
+
+		static double sqdist(const PointBuckets &p, size_t i, double cx, double cy) {
+			double dx = p.x[i] - cx;
+			double dy = p.y[i] - cy;
+			return dx * dx + dy * dy;
+		}
+
+		double idw(const PointBuckets &p, const std::vector<std::pair<double, size_t>> &nb) const {
+			double s2 = smoothing * smoothing;
+			double hp = power / 2;
+			double sw = 0, swz = 0;
+			for (size_t j=0; j<nb.size(); j++) {
+				double r2 = nb[j].first + s2;
+				// a point on the cell center
+				if (r2 < 1e-13) return p.z[nb[j].second];
+				double wt = 1 / std::pow(r2, hp);
+				sw += wt;
+				swz += wt * p.z[nb[j].second];
+			}
+			return swz / sw;
+		}
+};
+
+
+SpatRaster SpatRaster::gridPoints(std::vector<double> x, std::vector<double> y, std::vector<double> z, std::string algo, std::vector<double> algops, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	if ((x.size() != y.size()) || (x.size() != z.size())) {
+		out.setError("x, y, and z must have the same length");
+		return out;
+	}
+	GridAlgorithm ga;
+	std::string msg;
+	if (!ga.set(algo, algops, msg)) {
+		out.setError(msg);
+		return out;
+	}
+
+	PointBuckets pb;
+	pb.build(x, y, z);
+	std::vector<double>().swap(x);
+	std::vector<double>().swap(y);
+	std::vector<double>().swap(z);
+
+	if (!out.writeStart(opt, out.filenames())) {
+		return out;
+	}
+	size_t nc = out.ncol();
+	std::vector<double> xc;
+	out.xFromCol(xc);
+
+	for (size_t i=0; i < out.bs.n; i++) {
+		size_t nr = out.bs.nrows[i];
+		std::vector<double> v(nr * nc);
+		auto do_rows = [&](size_t start, size_t end) {
+			std::vector<size_t> w;
+			std::vector<std::pair<double, size_t>> nb;
+			for (size_t r=start; r<end; r++) {
+				double yr = out.yFromRow((int64_t)(out.bs.row[i] + r));
+				double *vr = &v[r * nc];
+				for (size_t c=0; c<nc; c++) {
+					vr[c] = ga.cell(pb, xc[c], yr, w, nb);
+				}
+			}
+		};
+#if defined(USE_TBB)
+		if (opt.parallel && (nr > 1)) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, nr, 1),
+				[&](const tbb::blocked_range<size_t>& range) {
+				do_rows(range.begin(), range.end());
+			});
+		} else {
+			do_rows(0, nr);
+		}
+#else
+		do_rows(0, nr);
+#endif
+		if (!out.writeBlock(v, i)) return out;
+	}
+	out.writeStop();
+	return out;
+}
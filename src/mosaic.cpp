@@ -0,0 +1,300 @@
+// Copyright (c) 2018-2026  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+// Streaming merge and mosaic of rasters that are aligned with the output.
+// The output is written block by block. An R-tree of the (row/col) extents
+// of the input rasters is used to find the rasters that overlap with a block.
+// Only these are read (in parallel if possible), and their values are combined
+// in memory. Input files are opened when they are first needed and closed
+// after their last row has been read.
+
+#include "spatRasterMultiple.h"
+#include "gdalio.h"
+
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+
+class CellBox {
+	public:
+		size_t r1, r2, c1, c2;
+		bool overlaps(const CellBox &b) const {
+			return (r1 <= b.r2) && (b.r1 <= r2) && (c1 <= b.c2) && (b.c1 <= c2);
+		}
+		void unite(const CellBox &b) {
+			r1 = std::min(r1, b.r1);
+			r2 = std::max(r2, b.r2);
+			c1 = std::min(c1, b.c1);
+			c2 = std::max(c2, b.c2);
+		}
+};
+
+
+// packed R-tree, bulk loaded with the Sort-Tile-Recursive algorithm
+class CellBoxIndex {
+	public:
+		void build(const std::vector<CellBox> &boxes, size_t capacity=16) {
+			M = std::max(capacity, (size_t)2);
+			levels.resize(0);
+			std::vector<Node> nodes(boxes.size());
+			for (size_t i=0; i<boxes.size(); i++) {
+				nodes[i] = {boxes[i], i, 1};
+			}
+			while (true) {
+				std::vector<Node> parents = pack(nodes);
+				levels.push_back(nodes);
+				if (nodes.size() <= 1) break;
+				nodes = parents;
+			}
+		}
+
+		// the (sorted) indices of the boxes that overlap with b
+		std::vector<size_t> query(const CellBox &b) const {
+			std::vector<size_t> out;
+			if (levels.empty() || levels[0].empty()) return out;
+			size_t top = levels.size() - 1;
+			for (size_t i=0; i<levels[top].size(); i++) {
+				search(top, i, b, out);
+			}
+			std::sort(out.begin(), out.end());
+			return out;
+		}
+
+	private:
+		class Node {
+			public:
+				CellBox box;
+				// the first child (in the level below) and the number of children.
+				// At the lowest level, "first" is the index of the box
+				size_t first, n;
+		};
+		size_t M = 16;
+		std::vector<std::vector<Node>> levels;
+
+		// sort the nodes into tiles and return their parent nodes
+		std::vector<Node> pack(std::vector<Node> &nodes) {
+			std::vector<Node> parents;
+			size_t n = nodes.size();
+			if (n <= 1) return parents;
+			size_t np = std::ceil(n / (double)M);
+			size_t ns = std::ceil(std::sqrt((double)np));
+			size_t sn = ns * M;
+			std::sort(nodes.begin(), nodes.end(), [](const Node &a, const Node &b) {
+				return (a.box.c1 + a.box.c2) < (b.box.c1 + b.box.c2);
+			});
+			for (size_t s=0; s<n; s+=sn) {
+				size_t se = std::min(n, s + sn);
+				std::sort(nodes.begin()+s, nodes.begin()+se, [](const Node &a, const Node &b) {
+					return (a.box.r1 + a.box.r2) < (b.box.r1 + b.box.r2);
+				});
+				for (size_t i=s; i<se; i+=M) {
+					size_t ie = std::min(se, i + M);
+					Node p = {nodes[i].box, i, ie - i};
+					for (size_t j=i+1; j<ie; j++) {
+						p.box.unite(nodes[j].box);
+					}
+					parents.push_back(p);
+				}
+			}
+			return parents;
+		}
+
+		void search(size_t level, size_t i, const CellBox &b, std::vector<size_t> &out) const {
+			const Node &nd = levels[level][i];
+			if (!nd.box.overlaps(b)) return;
+			if (level == 0) {
+				out.push_back(nd.first);
+				return;
+			}
+			for (size_t j=nd.first; j<(nd.first + nd.n); j++) {
+				search(level-1, j, b, out);
+			}
+		}
+};
+
+
+// can all rasters be written into "out" without resampling?
+bool SpatRasterCollection::aligned_with(SpatRaster &out, std::vector<size_t> &use, SpatOptions &opt) {
+	SpatOptions topt(opt);
+	SpatRaster g = out.geometry(1);
+	for (size_t i=0; i<use.size(); i++) {
+		SpatRaster tmp = g.crop(ds[use[i]].getExtent(), "near", false, topt);
+		if (!tmp.compare_geom(ds[use[i]], false, true, opt.get_tolerance(), false, true, true, false)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// fun is one of "first", "last", "sum", "mean", "min" or "max"
+// for "first" and "last", narm=false means that a cell takes the value of the
+// first (last) raster that covers it, even if that is NA
+SpatRaster SpatRasterCollection::mosaic_stream(SpatRaster &out, std::vector<size_t> &use, std::string fun, bool narm, SpatOptions &opt) {
+
+	size_t n = use.size();
+	size_t nc = out.ncol();
+	size_t nl = out.nlyr();
+	double hxr = out.xres() / 2;
+	double hyr = out.yres() / 2;
+
+	std::vector<CellBox> boxes(n);
+	for (size_t i=0; i<n; i++) {
+		SpatExtent e = ds[use[i]].getExtent();
+		boxes[i].r1 = out.rowFromY(e.ymax - hyr);
+		boxes[i].r2 = out.rowFromY(e.ymin + hyr);
+		boxes[i].c1 = out.colFromX(e.xmin + hxr);
+		boxes[i].c2 = out.colFromX(e.xmax - hxr);
+	}
+	CellBoxIndex index;
+	index.build(boxes);
+
+	opt.ncopies = std::max(opt.ncopies, (size_t)4);
+	if (!out.writeStart(opt, filenames())) {
+		return out;
+	}
+
+	bool isfirst = fun == "first";
+	bool islast = fun == "last";
+	bool ismean = fun == "mean";
+	bool issum = ismean || (fun == "sum");
+	bool ismin = fun == "min";
+	bool parallel = opt.parallel;
+	std::vector<char> isopen(n, 0);
+
+	for (size_t i=0; i<out.bs.n; i++) {
+		size_t R0 = out.bs.row[i];
+		size_t R1 = R0 + out.bs.nrows[i] - 1;
+		CellBox bb = {R0, R1, 0, nc-1};
+		std::vector<size_t> hits = index.query(bb);
+		size_t m = hits.size();
+
+		// open the rasters that are needed for the first time
+		for (size_t k=0; k<m; k++) {
+			size_t j = hits[k];
+			if (isopen[j]) continue;
+			if (!ds[use[j]].readStart()) {
+				out.setError(ds[use[j]].getError());
+				out.writeStop();
+				return out;
+			}
+			isopen[j] = 1;
+		}
+
+		// read the overlapping rows of each raster
+		std::vector<std::vector<double>> vals(m);
+		std::vector<std::string> errs(m);
+		auto read_part = [&](size_t k) {
+			size_t j = hits[k];
+			SpatRaster &r = ds[use[j]];
+			size_t a = std::max(R0, boxes[j].r1);
+			size_t b = std::min(R1, boxes[j].r2);
+			r.readValues(vals[k], a - boxes[j].r1, b - a + 1, 0, r.ncol());
+			if (r.hasError()) errs[k] = r.getError();
+		};
+#if defined(USE_TBB)
+		if (parallel && (m > 1)) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, m),
+				[&](const tbb::blocked_range<size_t>& range) {
+				QuietGDALErrors quiet;
+				for (size_t k = range.begin(); k != range.end(); k++) {
+					read_part(k);
+				}
+			});
+		} else {
+			for (size_t k=0; k<m; k++) read_part(k);
+		}
+#else
+		for (size_t k=0; k<m; k++) read_part(k);
+#endif
+		for (size_t k=0; k<m; k++) {
+			if (!errs[k].empty()) {
+				out.setError(errs[k]);
+				out.writeStop();
+				return out;
+			}
+		}
+
+		// combine the values
+		size_t nrows = out.bs.nrows[i];
+		size_t ncell = nrows * nc;
+		std::vector<double> w(nl * ncell, NAN);
+		std::vector<uint8_t> covered;
+		std::vector<double> cnt;
+		if ((isfirst || islast) && (!narm)) covered.resize(w.size(), 0);
+		if (ismean) cnt.resize(w.size(), 0);
+
+		for (size_t kk=0; kk<m; kk++) {
+			size_t k = islast ? (m - 1 - kk) : kk;
+			size_t j = hits[k];
+			const std::vector<double> &v = vals[k];
+			size_t a = std::max(R0, boxes[j].r1);
+			size_t b = std::min(R1, boxes[j].r2);
+			size_t rnc = boxes[j].c2 - boxes[j].c1 + 1;
+			size_t rnr = b - a + 1;
+			size_t rnl = ds[use[j]].nlyr();
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				// layers are recycled
+				size_t ioff = (lyr % rnl) * rnr * rnc;
+				for (size_t row=a; row<=b; row++) {
+					size_t vi = ioff + (row - a) * rnc;
+					size_t wi = lyr * ncell + (row - R0) * nc + boxes[j].c1;
+					for (size_t c=0; c<rnc; c++) {
+						double x = v[vi + c];
+						size_t o = wi + c;
+						if (isfirst || islast) {
+							if (narm) {
+								if (std::isnan(w[o])) w[o] = x;
+							} else if (!covered[o]) {
+								w[o] = x;
+								covered[o] = 1;
+							}
+						} else if (!std::isnan(x)) {
+							if (std::isnan(w[o])) {
+								w[o] = x;
+							} else if (issum) {
+								w[o] += x;
+							} else if (ismin) {
+								w[o] = std::min(w[o], x);
+							} else {
+								w[o] = std::max(w[o], x);
+							}
+							if (ismean) cnt[o]++;
+						}
+					}
+				}
+			}
+			if (boxes[j].r2 <= R1) {
+				ds[use[j]].readStop();
+				isopen[j] = 0;
+			}
+		}
+		if (ismean) {
+			for (size_t o=0; o<w.size(); o++) {
+				if (cnt[o] > 1) w[o] /= cnt[o];
+			}
+		}
+		if (!out.writeBlock(w, i)) return out;
+	}
+	for (size_t j=0; j<n; j++) {
+		if (isopen[j]) ds[use[j]].readStop();
+	}
+	out.writeStop();
+	return out;
+}
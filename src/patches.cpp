@@ -18,6 +18,11 @@
 #include "spatRaster.h"
 #include "math_utils.h"
 
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
 struct PatchUnionFind {
 	std::vector<double> parents;
 	size_t start_id;
@@ -311,4 +316,651 @@ SpatRaster SpatRaster::patches(size_t directions, SpatOptions &opt) {
 	}
 
 	return(out);
-}
\ No newline at end of file
+}
+
+
+
+// Connected component labeling with union-find. Each block of rows is split into
+// bands that are labeled independently (in parallel if possible), and the labels
+// are joined across the band (and block) boundaries. The cell count, area and
+// extent of each patch are computed in the same pass.
+// Patches are numbered in the order of their first cell, so the IDs are
+// 1, 2, ..., n. Patches with fewer than "minsize" cells can be removed.
+
+class PatchInfo {
+	public:
+		double value, n=0, area=0;
+		size_t first, rmin, rmax, cmin, cmax;
+
+		void add(double v, size_t row, size_t col, size_t cell, double a) {
+			if (n == 0) {
+				value = v;
+				first = cell;
+				rmin = rmax = row;
+				cmin = cmax = col;
+			} else {
+				rmax = std::max(rmax, row);
+				cmin = std::min(cmin, col);
+				cmax = std::max(cmax, col);
+			}
+			n++;
+			area += a;
+		}
+
+		void merge(const PatchInfo &x) {
+			n += x.n;
+			area += x.area;
+			first = std::min(first, x.first);
+			rmin = std::min(rmin, x.rmin);
+			rmax = std::max(rmax, x.rmax);
+			cmin = std::min(cmin, x.cmin);
+			cmax = std::max(cmax, x.cmax);
+		}
+};
+
+
+inline int64_t uf_find(std::vector<int64_t> &parent, int64_t i) {
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+inline void uf_unite(std::vector<int64_t> &parent, int64_t a, int64_t b) {
+	a = uf_find(parent, a);
+	b = uf_find(parent, b);
+	if (a < b) {
+		parent[b] = a;
+	} else if (b < a) {
+		parent[a] = b;
+	}
+}
+
+
+inline bool patch_connected(double a, double b, bool values) {
+	if (std::isnan(a) || std::isnan(b)) return false;
+	return values ? is_equal(a, b) : true;
+}
+
+
+// label the cells in rows "start" to "end" of v. The labels are numbered from zero
+// in the order of the first cell of each patch; cells that are NA get -1
+void label_band(const std::vector<double> &v, size_t start, size_t end, size_t nc, size_t row0, bool d8, bool values, bool wrap, const std::vector<double> &rowarea, std::vector<int64_t> &lab, std::vector<PatchInfo> &info) {
+
+	size_t off = start * nc;
+	size_t n = (end - start) * nc;
+	lab.resize(n);
+	std::vector<int64_t> parent;
+	wrap = wrap && (nc > 1);
+
+	auto join = [&](size_t i, size_t j) {
+		// i is the current cell, j a cell that was labeled before
+		if ((lab[j] < 0) || (!patch_connected(v[off+i], v[off+j], values))) return;
+		if (lab[i] < 0) {
+			lab[i] = lab[j];
+		} else {
+			uf_unite(parent, lab[i], lab[j]);
+		}
+	};
+
+	for (size_t r=0; r<(end-start); r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t i = r * nc + c;
+			lab[i] = -1;
+			if (std::isnan(v[off+i])) continue;
+			if (c > 0) {
+				join(i, i-1);
+			} else if (wrap && (r > 0) && d8) {
+				join(i, i-1); // the last cell of the row above
+			}
+			if (r > 0) {
+				size_t up = i - nc;
+				join(i, up);
+				if (d8) {
+					if (c > 0) join(i, up-1);
+					if (c < (nc-1)) {
+						join(i, up+1);
+					} else if (wrap) {
+						join(i, up+1-nc);
+					}
+				}
+			}
+			if (wrap && (c == (nc-1))) {
+				join(i, i+1-nc);
+			}
+			if (lab[i] < 0) {
+				lab[i] = parent.size();
+				parent.push_back(lab[i]);
+			}
+		}
+	}
+
+	std::vector<int64_t> dense(parent.size(), -1);
+	info.resize(0);
+	for (size_t i=0; i<n; i++) {
+		if (lab[i] < 0) continue;
+		int64_t root = uf_find(parent, lab[i]);
+		if (dense[root] < 0) {
+			dense[root] = info.size();
+			info.push_back(PatchInfo());
+		}
+		lab[i] = dense[root];
+		size_t row = row0 + start + i / nc;
+		info[lab[i]].add(v[off+i], row, i % nc, row * nc + i % nc, rowarea[row]);
+	}
+}
+
+
+// the area of the cells in each row, in m2. For lon/lat data, this is the
+// area computed by rst_area (cellSize) for the first column
+bool patch_row_area(SpatRaster &x, std::vector<double> &out, std::string &msg, SpatOptions &opt) {
+	SpatRaster g = x.geometry(1, false);
+	if (g.is_lonlat()) {
+		SpatOptions xopt(opt);
+		xopt.set_filenames({""});
+		xopt.names = {"area"};
+		SpatExtent e = g.getExtent();
+		e.xmax = e.xmin + g.xres();
+		SpatRaster onecol = g.crop(e, "near", false, xopt);
+		SpatRaster a = onecol.rst_area(false, "m", true, 100, xopt);
+		if (a.hasError()) {
+			msg = a.getError();
+			return false;
+		}
+		out = a.getValues(0, xopt);
+		if (out.size() != g.nrow()) {
+			msg = "cannot compute the area of the cells";
+			return false;
+		}
+	} else {
+		double m = g.source[0].srs.to_meter();
+		m = (std::isnan(m) || (m == 0)) ? 1 : m;
+		out = std::vector<double>(g.nrow(), g.xres() * g.yres() * m * m);
+	}
+	return true;
+}
+
+
+bool SpatRaster::label_patches(size_t directions, bool values, bool zeroAsNA, double minsize, bool write, SpatRaster &out, SpatDataFrame &stats, SpatOptions &opt) {
+
+	if (!hasValues()) {
+		out.setError("cannot compute patches for a raster with no values");
+		return false;
+	}
+	if (!((directions == 4) || (directions == 8))) {
+		out.setError("directions should be 4 or 8");
+		return false;
+	}
+
+	bool d8 = directions == 8;
+	bool wrap = is_global_lonlat();
+	zeroAsNA = zeroAsNA && (!values);
+	size_t nc = ncol();
+	std::vector<double> rowarea;
+	std::string msg;
+	if (!patch_row_area(*this, rowarea, msg, opt)) {
+		out.setError(msg);
+		return false;
+	}
+
+	BlockSize bs;
+	if (write) {
+		if (opt.names.empty()) {
+			opt.names = {"patches"};
+		}
+		opt.ncopies = std::max(opt.ncopies, (size_t)6);
+		if (!out.writeStart(opt, filenames())) {
+			return false;
+		}
+		bs = out.bs;
+	} else {
+		opt.ncopies = std::max(opt.ncopies, (size_t)4);
+		bs = getBlockSize(opt);
+	}
+	if (!readStart()) {
+		out.setError(getError());
+		return false;
+	}
+
+	// the values of the first layer
+	auto read_block = [&](size_t i, std::vector<double> &v) {
+		readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+		if (hasError() || (v.size() < (bs.nrows[i] * nc))) {
+			out.setError(hasError() ? getError() : "cannot read the values");
+			readStop();
+			return false;
+		}
+		v.resize(bs.nrows[i] * nc);
+		if (zeroAsNA) {
+			std::replace(v.begin(), v.end(), 0.0, (double)NAN);
+		}
+		return true;
+	};
+
+	auto get_bands = [&](size_t i) {
+		std::vector<size_t> b = {0};
+#if defined(USE_TBB)
+		size_t nrc = bs.nrows[i] * nc;
+		if (opt.parallel && (nrc > 65536)) {
+			size_t nb = std::min(bs.nrows[i], nrc / 65536);
+			double step = bs.nrows[i] / (double)nb;
+			for (size_t k=1; k<nb; k++) {
+				b.push_back(std::round(k * step));
+			}
+		}
+#endif
+		b.push_back(bs.nrows[i]);
+		return b;
+	};
+
+	auto label_block = [&](size_t i, const std::vector<double> &v, const std::vector<size_t> &bands, std::vector<std::vector<int64_t>> &labs, std::vector<std::vector<PatchInfo>> &infos) {
+		size_t nb = bands.size() - 1;
+		labs.resize(nb);
+		infos.resize(nb);
+#if defined(USE_TBB)
+		if (nb > 1) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, nb),
+				[&](const tbb::blocked_range<size_t>& range) {
+				for (size_t k = range.begin(); k != range.end(); k++) {
+					label_band(v, bands[k], bands[k+1], nc, bs.row[i], d8, values, wrap, rowarea, labs[k], infos[k]);
+				}
+			});
+			return;
+		}
+#endif
+		for (size_t k=0; k<nb; k++) {
+			label_band(v, bands[k], bands[k+1], nc, bs.row[i], d8, values, wrap, rowarea, labs[k], infos[k]);
+		}
+	};
+
+	// pass 1: label the bands, join them, and collect the patch statistics
+	std::vector<PatchInfo> info;
+	std::vector<int64_t> parent;
+	std::vector<size_t> offsets;
+	std::vector<double> above_v;
+	std::vector<int64_t> above_p;
+	std::vector<double> v;
+	std::vector<std::vector<int64_t>> labs;
+	for (size_t i=0; i<bs.n; i++) {
+		if (!read_block(i, v)) return false;
+		std::vector<size_t> bands = get_bands(i);
+		std::vector<std::vector<PatchInfo>> infos;
+		label_block(i, v, bands, labs, infos);
+		for (size_t k=0; k<labs.size(); k++) {
+			size_t offset = info.size();
+			offsets.push_back(offset);
+			for (size_t j=0; j<infos[k].size(); j++) {
+				parent.push_back(offset + j);
+			}
+			info.insert(info.end(), infos[k].begin(), infos[k].end());
+			// join with the row above
+			size_t first = bands[k] * nc;
+			if (!above_p.empty()) {
+				for (size_t c=0; c<nc; c++) {
+					int64_t p = labs[k][c];
+					if (p < 0) continue;
+					p += offset;
+					double x = v[first + c];
+					for (int dc=-1; dc<=1; dc++) {
+						if ((!d8) && (dc != 0)) continue;
+						int64_t ac = (int64_t)c + dc;
+						if ((ac < 0) || (ac >= (int64_t)nc)) {
+							if (!wrap || (nc < 2)) continue;
+							ac = ac < 0 ? nc-1 : 0;
+						}
+						if ((above_p[ac] >= 0) && patch_connected(x, above_v[ac], values)) {
+							uf_unite(parent, p, above_p[ac]);
+						}
+					}
+				}
+			}
+			size_t nlast = (bands[k+1] - bands[k] - 1) * nc;
+			above_v.assign(v.begin() + first + nlast, v.begin() + first + nlast + nc);
+			above_p.resize(nc);
+			for (size_t c=0; c<nc; c++) {
+				int64_t p = labs[k][nlast + c];
+				above_p[c] = p < 0 ? -1 : p + offset;
+			}
+		}
+		if (bs.n > 1) labs.clear();
+	}
+
+	// merge the statistics of joined labels and number the patches
+	std::vector<int64_t> roots;
+	for (size_t i=0; i<parent.size(); i++) {
+		int64_t r = uf_find(parent, i);
+		if (r == (int64_t)i) {
+			roots.push_back(r);
+		} else {
+			info[r].merge(info[i]);
+		}
+	}
+	if (minsize > 0) {
+		roots.erase(std::remove_if(roots.begin(), roots.end(),
+			[&](int64_t r) { return info[r].n < minsize; }), roots.end());
+	}
+	std::sort(roots.begin(), roots.end(),
+		[&](int64_t a, int64_t b) { return info[a].first < info[b].first; });
+	std::vector<double> id(parent.size(), NAN);
+	for (size_t i=0; i<roots.size(); i++) {
+		id[roots[i]] = i + 1;
+	}
+
+	size_t np = roots.size();
+	std::vector<double> pid(np), pval(np), pn(np), parea(np), xmin(np), xmax(np), ymin(np), ymax(np);
+	double dx = xres() / 2;
+	double dy = yres() / 2;
+	for (size_t i=0; i<np; i++) {
+		PatchInfo &p = info[roots[i]];
+		pid[i] = i + 1;
+		pval[i] = p.value;
+		pn[i] = p.n;
+		parea[i] = p.area;
+		xmin[i] = xFromCol(p.cmin) - dx;
+		xmax[i] = xFromCol(p.cmax) + dx;
+		ymin[i] = yFromRow(p.rmax) - dy;
+		ymax[i] = yFromRow(p.rmin) + dy;
+	}
+	stats.add_column(pid, "id");
+	if (values) stats.add_column(pval, "value");
+	stats.add_column(pn, "ncells");
+	stats.add_column(parea, "area");
+	stats.add_column(xmin, "xmin");
+	stats.add_column(xmax, "xmax");
+	stats.add_column(ymin, "ymin");
+	stats.add_column(ymax, "ymax");
+	info.clear();
+	roots.clear();
+
+	if (!write) {
+		readStop();
+		return true;
+	}
+	for (size_t i=0; i<parent.size(); i++) {
+		id[i] = id[uf_find(parent, i)];
+	}
+	parent.clear();
+
+	// pass 2: label the bands again (unless the raster was processed in one block) and write the patch IDs
+	size_t bi = 0;
+	for (size_t i=0; i<bs.n; i++) {
+		std::vector<size_t> bands = get_bands(i);
+		if (bs.n > 1) {
+			if (!read_block(i, v)) return false;
+			std::vector<std::vector<PatchInfo>> infos;
+			label_block(i, v, bands, labs, infos);
+		}
+		std::vector<double> w(bs.nrows[i] * nc);
+		for (size_t k=0; k<labs.size(); k++) {
+			size_t first = bands[k] * nc;
+			size_t offset = offsets[bi++];
+			for (size_t j=0; j<labs[k].size(); j++) {
+				w[first + j] = labs[k][j] < 0 ? NAN : id[offset + labs[k][j]];
+			}
+		}
+		if (!out.writeBlock(w, i)) return false;
+	}
+	readStop();
+	out.writeStop();
+	return true;
+}
+
+
+SpatRaster SpatRaster::patches_uf(size_t directions, bool values, bool zeroAsNA, double minsize, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1, false);
+	if (nlyr() > 1) {
+		SpatOptions ops(opt);
+		std::vector<std::string> nms = getNames();
+		if (ops.names.size() == nms.size()) {
+			nms = opt.names;
+		}
+		for (size_t i=0; i<nlyr(); i++) {
+			std::vector<size_t> lyr = {i};
+			ops.names = {nms[i]};
+			SpatRaster x = subset(lyr, ops);
+			x = x.patches_uf(directions, values, zeroAsNA, minsize, ops);
+			if (x.hasError()) {
+				out.setError(x.getError());
+				return out;
+			}
+			out.addSource(x, false, ops);
+		}
+		if (!opt.get_filename().empty()) {
+			out = out.writeRaster(opt);
+		}
+		return out;
+	}
+	SpatDataFrame stats;
+	label_patches(directions, values, zeroAsNA, minsize, true, out, stats, opt);
+	return out;
+}
+
+
+SpatDataFrame SpatRaster::patch_stats(size_t directions, bool values, bool zeroAsNA, double minsize, SpatOptions &opt) {
+	SpatDataFrame stats;
+	SpatRaster out = geometry(1, false);
+	std::vector<size_t> lyr = {0};
+	SpatRaster x = nlyr() > 1 ? subset(lyr, opt) : *this;
+	if (!x.label_patches(directions, values, zeroAsNA, minsize, false, out, stats, opt)) {
+		stats.setError(out.getError());
+	}
+	return stats;
+}
+
+
+// Sieve filter, like GDALSieveFilter. The clumps of cells with the same value
+// are labeled with label_patches. Clumps with fewer than "threshold" cells are
+// merged into their largest neighboring clump (the one with most cells, or the
+// lowest ID if there is a tie). This is repeated on the graph of clumps for
+// merged clumps that are still too small. A clump without (larger) neighbors
+// keeps its value. The neighbors are found per block of rows, with the last row
+// of the previous block, and the rows of a block are processed in parallel.
+
+// the neighbors of the small patches in rows "start" to "end" of the patch IDs
+// in v. "above" has the IDs of the row above the first row of v, or is empty
+void sieve_neighbors(const std::vector<double> &v, const std::vector<double> &above, size_t start, size_t end, size_t nc, bool d8, bool wrap, const std::vector<char> &small, std::vector<std::pair<int64_t, int64_t>> &pairs) {
+
+	wrap = wrap && (nc > 1);
+	auto add = [&](double a, double b) {
+		if (std::isnan(b) || (a == b)) return;
+		int64_t i = a - 1;
+		int64_t j = b - 1;
+		if (small[i]) pairs.push_back({i, j});
+		if (small[j]) pairs.push_back({j, i});
+	};
+
+	for (size_t r=start; r<end; r++) {
+		const double *row = &v[r * nc];
+		const double *up = NULL;
+		if (r > 0) {
+			up = &v[(r-1) * nc];
+		} else if (!above.empty()) {
+			up = &above[0];
+		}
+		for (size_t c=0; c<nc; c++) {
+			double a = row[c];
+			if (std::isnan(a)) continue;
+			size_t left = c > 0 ? c - 1 : nc - 1;
+			size_t right = c < (nc-1) ? c + 1 : 0;
+			if ((c > 0) || wrap) add(a, row[left]);
+			if (up == NULL) continue;
+			add(a, up[c]);
+			if (d8) {
+				if ((c > 0) || wrap) add(a, up[left]);
+				if ((c < (nc-1)) || wrap) add(a, up[right]);
+			}
+		}
+	}
+	std::sort(pairs.begin(), pairs.end());
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+}
+
+
+SpatRaster SpatRaster::sieveFilter(int threshold, int connections, SpatOptions &opt) {
+
+	if (nlyr() > 1) {
+		SpatOptions sopt(opt);
+		SpatRaster tmp = subset({0}, sopt);
+		tmp = tmp.sieveFilter(threshold, connections, opt);
+		tmp.addWarning("only the first layer was used");
+		return tmp;
+	}
+
+	SpatRaster out = geometry(1, true, true, true);
+
+	if (!hasValues()) {
+		out.setError("input raster has no values");
+		return out;
+	}
+	if (!((connections == 4) || (connections == 8))) {
+		out.setError("connections should be 4 or 8");
+		return out;
+	}
+	if (threshold < 2) {
+		out.setError("a threshold < 2 is not meaningful");
+		return out;
+	}
+
+	bool d8 = connections == 8;
+	bool wrap = is_global_lonlat();
+	size_t nc = ncol();
+
+	SpatRaster ids = geometry(1, false);
+	SpatDataFrame stats;
+	SpatOptions ops(opt);
+	ops.set_filenames({""});
+	ops.names = {"id"};
+	ops.set_datatype("INT4S");
+	if (!label_patches(connections, true, false, 0, true, ids, stats, ops)) {
+		out.setError(ids.getError());
+		return out;
+	}
+	std::vector<double> value = stats.getD(1);
+	std::vector<double> size = stats.getD(2);
+	size_t np = size.size();
+	std::vector<char> small(np);
+	for (size_t i=0; i<np; i++) {
+		small[i] = size[i] < threshold;
+	}
+
+	if (!ids.readStart()) {
+		out.setError(ids.getError());
+		return out;
+	}
+	opt.ncopies = std::max(opt.ncopies, (size_t)4);
+	BlockSize bs = ids.getBlockSize(opt);
+
+	auto get_bands = [&](size_t i) {
+		std::vector<size_t> b = {0};
+#if defined(USE_TBB)
+		size_t nrc = bs.nrows[i] * nc;
+		if (opt.parallel && (nrc > 65536)) {
+			size_t nb = std::min(bs.nrows[i], nrc / 65536);
+			double step = bs.nrows[i] / (double)nb;
+			for (size_t k=1; k<nb; k++) {
+				b.push_back(std::round(k * step));
+			}
+		}
+#endif
+		b.push_back(bs.nrows[i]);
+		return b;
+	};
+
+	// the neighbors of the small patches
+	std::vector<std::pair<int64_t, int64_t>> pairs;
+	std::vector<double> v, above;
+	for (size_t i=0; i<bs.n; i++) {
+		ids.readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+		if (ids.hasError() || (v.size() != (bs.nrows[i] * nc))) {
+			out.setError(ids.hasError() ? ids.getError() : "cannot read the patches");
+			ids.readStop();
+			return out;
+		}
+		std::vector<size_t> bands = get_bands(i);
+		size_t nb = bands.size() - 1;
+		std::vector<std::vector<std::pair<int64_t, int64_t>>> bpairs(nb);
+#if defined(USE_TBB)
+		if (nb > 1) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, nb),
+				[&](const tbb::blocked_range<size_t>& range) {
+				for (size_t k = range.begin(); k != range.end(); k++) {
+					sieve_neighbors(v, above, bands[k], bands[k+1], nc, d8, wrap, small, bpairs[k]);
+				}
+			});
+		} else {
+			sieve_neighbors(v, above, 0, bs.nrows[i], nc, d8, wrap, small, bpairs[0]);
+		}
+#else
+		sieve_neighbors(v, above, 0, bs.nrows[i], nc, d8, wrap, small, bpairs[0]);
+#endif
+		for (size_t k=0; k<nb; k++) {
+			pairs.insert(pairs.end(), bpairs[k].begin(), bpairs[k].end());
+		}
+		above.assign(v.end() - nc, v.end());
+	}
+	std::sort(pairs.begin(), pairs.end());
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+	// merge the small patches (in the order of their size) into their largest neighbor
+	std::vector<int64_t> parent(np);
+	for (size_t i=0; i<np; i++) parent[i] = i;
+	auto larger = [&](int64_t a, int64_t b) {
+		return (size[a] > size[b]) || ((size[a] == size[b]) && (a < b));
+	};
+	std::vector<int64_t> best(np, -1);
+	bool merged = true;
+	while (merged) {
+		merged = false;
+		std::vector<int64_t> roots;
+		for (size_t j=0; j<pairs.size(); j++) {
+			int64_t a = uf_find(parent, pairs[j].first);
+			if (size[a] >= threshold) continue;
+			int64_t b = uf_find(parent, pairs[j].second);
+			if (a == b) continue;
+			if (best[a] < 0) {
+				roots.push_back(a);
+				best[a] = b;
+			} else if (larger(b, best[a])) {
+				best[a] = b;
+			}
+		}
+		std::sort(roots.begin(), roots.end(), [&](int64_t a, int64_t b) { return larger(b, a); });
+		for (int64_t a : roots) {
+			int64_t b = uf_find(parent, best[a]);
+			best[a] = -1;
+			if ((b != a) && larger(b, a)) {
+				parent[a] = b;
+				size[b] += size[a];
+				merged = true;
+			}
+		}
+	}
+	for (size_t i=0; i<np; i++) {
+		value[i] = value[uf_find(parent, i)];
+	}
+	parent.clear();
+	pairs.clear();
+
+	opt.names = getNames();
+	if (!out.writeStart(opt, filenames())) {
+		ids.readStop();
+		return out;
+	}
+	for (size_t i = 0; i < out.bs.n; i++) {
+		ids.readValues(v, out.bs.row[i], out.bs.nrows[i], 0, nc);
+		if (ids.hasError() || (v.size() != (out.bs.nrows[i] * nc))) {
+			out.setError(ids.hasError() ? ids.getError() : "cannot read the patches");
+			ids.readStop();
+			return out;
+		}
+		for (double &d : v) {
+			if (!std::isnan(d)) d = value[d - 1];
+		}
+		if (!out.writeBlock(v, i)) return out;
+	}
+	ids.readStop();
+	out.writeStop();
+	return out;
+}
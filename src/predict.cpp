@@ -0,0 +1,232 @@
+// Copyright (c) 2018-2026  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+// Prediction with simple models that are described by a numeric vector
+// (prepared in R, see predict.R), so that the values do not go through R.
+//
+// type "glm": {link, intercept, coefficient for each layer}
+//   link is 0 (identity), 1 (log), 2 (logit), 3 (probit), 4 (cloglog),
+//   5 (inverse), 6 (sqrt), 7 (1/mu^2)
+//
+// type "trees": {ntree, rule, root of each tree, nodes}
+//   each node has five numbers: {layer, split, left, right, value}. layer is -1
+//   for a leaf. left and right are node numbers (counting from zero, for all
+//   trees). Go left if "x < split" (rule 0) or "x <= split" (rule 1).
+//   The prediction is the mean of the values predicted by the trees.
+//
+// If narm is true, cells that are NA in any layer are NA in the output
+// (as when these cells are removed before calling the R predict method).
+
+#include "spatRaster.h"
+#include <cfloat>
+
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+
+void lincomb_cells(const std::vector<double> &v, std::vector<double> &out, const std::vector<double> &m, const std::vector<double> &offset, size_t nl, size_t nout, size_t n, size_t start, size_t end);
+
+
+// as in R's "family" objects
+inline double linkinv(double eta, int link) {
+	const double thresh = 8.125890664701906; // -qnorm(DBL_EPSILON)
+	switch (link) {
+		case 1:
+			return std::max(std::exp(eta), DBL_EPSILON);
+		case 2: {
+			double e = eta < -30 ? DBL_EPSILON : (eta > 30 ? 1 / DBL_EPSILON : std::exp(eta));
+			return e / (1 + e);
+		}
+		case 3:
+			eta = std::min(std::max(eta, -thresh), thresh);
+			return 0.5 * std::erfc(-eta / std::sqrt(2.0));
+		case 4:
+			return std::max(std::min(-std::expm1(-std::exp(eta)), 1 - DBL_EPSILON), DBL_EPSILON);
+		case 5:
+			return 1 / eta;
+		case 6:
+			return eta * eta;
+		case 7:
+			return 1 / std::sqrt(eta);
+		default:
+			return eta;
+	}
+}
+
+
+class TreeModel {
+	public:
+		size_t ntree;
+		bool le;
+		std::vector<size_t> roots;
+		std::vector<int> var;
+		std::vector<double> split, value;
+		std::vector<size_t> left, right;
+
+		bool set(const std::vector<double> &m, size_t nl, std::string &msg) {
+			if (m.size() < 2) {
+				msg = "invalid tree model";
+				return false;
+			}
+			ntree = m[0];
+			le = m[1] == 1;
+			size_t off = 2 + ntree;
+			if ((ntree == 0) || (m.size() < off) || (((m.size() - off) % 5) != 0)) {
+				msg = "invalid tree model";
+				return false;
+			}
+			size_t nn = (m.size() - off) / 5;
+			roots.resize(ntree);
+			for (size_t i=0; i<ntree; i++) {
+				roots[i] = m[2+i];
+				if (roots[i] >= nn) {
+					msg = "invalid tree model";
+					return false;
+				}
+			}
+			var.resize(nn);
+			split.resize(nn);
+			left.resize(nn);
+			right.resize(nn);
+			value.resize(nn);
+			for (size_t i=0; i<nn; i++) {
+				const double *d = &m[off + i * 5];
+				var[i] = d[0];
+				split[i] = d[1];
+				if (var[i] >= 0) {
+					if ((var[i] >= (int)nl) || (d[2] < 0) || (d[2] >= nn) || (d[3] < 0) || (d[3] >= nn)) {
+						msg = "invalid tree model";
+						return false;
+					}
+					left[i] = d[2];
+					right[i] = d[3];
+				}
+				value[i] = d[4];
+			}
+			return true;
+		}
+
+		// v has nl layers of n cells
+		void predict(const std::vector<double> &v, std::vector<double> &out, size_t n, size_t start, size_t end) const {
+			for (size_t c=start; c<end; c++) {
+				double s = 0;
+				for (size_t t=0; t<ntree; t++) {
+					size_t k = roots[t];
+					// a tree cannot have more levels than nodes; this protects against cycles
+					size_t steps = var.size();
+					while ((var[k] >= 0) && (steps > 0)) {
+						double x = v[var[k] * n + c];
+						if (std::isnan(x)) {
+							s = NAN;
+							break;
+						}
+						bool goleft = le ? (x <= split[k]) : (x < split[k]);
+						k = goleft ? left[k] : right[k];
+						steps--;
+					}
+					if (std::isnan(s)) break;
+					s += value[k];
+				}
+				out[c] = s / ntree;
+			}
+		}
+};
+
+
+SpatRaster SpatRaster::predict_model(std::string type, std::vector<double> model, bool narm, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	size_t nl = nlyr();
+	bool isglm = type == "glm";
+	TreeModel trees;
+	int link = 0;
+	std::vector<double> coef, intercept;
+	if (isglm) {
+		if (model.size() != (nl + 2)) {
+			out.setError("the number of coefficients does not match the number of layers");
+			return out;
+		}
+		link = model[0];
+		intercept = {model[1]};
+		coef = std::vector<double>(model.begin()+2, model.end());
+	} else if (type == "trees") {
+		std::string msg;
+		if (!trees.set(model, nl, msg)) {
+			out.setError(msg);
+			return out;
+		}
+	} else {
+		out.setError("unknown model type");
+		return out;
+	}
+	if (!hasValues()) return out;
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	if (!out.writeStart(opt, filenames())) {
+		readStop();
+		return out;
+	}
+
+	auto do_cells = [&](const std::vector<double> &v, std::vector<double> &w, size_t n, size_t start, size_t end) {
+		if (isglm) {
+			lincomb_cells(v, w, coef, intercept, nl, 1, n, start, end);
+			if (link != 0) {
+				for (size_t c=start; c<end; c++) {
+					w[c] = linkinv(w[c], link);
+				}
+			}
+		} else {
+			trees.predict(v, w, n, start, end);
+		}
+		if (narm) {
+			for (size_t i=0; i<nl; i++) {
+				const double *x = &v[i * n];
+				for (size_t c=start; c<end; c++) {
+					if (std::isnan(x[c])) w[c] = NAN;
+				}
+			}
+		}
+	};
+
+	for (size_t i = 0; i < out.bs.n; i++) {
+		std::vector<double> v;
+		readBlock(v, out.bs, i);
+		size_t n = out.bs.nrows[i] * ncol();
+		std::vector<double> w(n);
+#if defined(USE_TBB)
+		if (opt.parallel && (n > 4096)) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, n, 2048),
+				[&](const tbb::blocked_range<size_t>& range) {
+				do_cells(v, w, n, range.begin(), range.end());
+			});
+		} else {
+			do_cells(v, w, n, 0, n);
+		}
+#else
+		do_cells(v, w, n, 0, n);
+#endif
+		if (!out.writeBlock(w, i)) return out;
+	}
+	readStop();
+	out.writeStop();
+	return out;
+}
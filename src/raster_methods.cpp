@@ -27,6 +27,11 @@
 #include "string_utils.h"
 #include "sort.h"
 
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
 
 /*
 std::vector<double> flat(std::vector<std::vector<double>> v) {
@@ -655,6 +660,17 @@ SpatRaster SpatRaster::aggregate(std::vector<size_t> fact, std::string fun, bool
 		return out;
 	}
 
+	if ((fun == "mean") && narm && (fact[2] == 1) && (opt.overviews >= 1)) {
+		SpatRaster ovr;
+		size_t fx, fy;
+		if (useOverview(fact[1] * xres(), fact[0] * yres(), fun, true, ovr, fx, fy, opt)) {
+			if (((fact[1] % fx) == 0) && ((fact[0] % fy) == 0)) {
+				std::vector<size_t> ofact = {fact[0] / fy, fact[1] / fx, 1};
+				return ovr.aggregate(ofact, fun, narm, opt);
+			}
+		}
+	}
+
 	SpatExtent extent = getExtent();
 	double xmax = extent.xmin + fact[4] * fact[1] * xres();
 	double ymin = extent.ymax - fact[3] * fact[0] * yres();
@@ -4001,6 +4017,14 @@ SpatRaster SpatRasterCollection::merge(bool first, bool narm, int algo, std::str
 			out.setValueType(vt[0]);
 		}
 
+		std::vector<size_t> use;
+		for (size_t i=0; i<n; i++) {
+			if (ds[i].hasValues()) use.push_back(i);
+		}
+		if (aligned_with(out, use, opt)) {
+			return mosaic_stream(out, use, first ? "first" : "last", narm, opt);
+		}
+
 		opt.ncopies = std::max(opt.ncopies, size() + nl);
 		if (!out.writeStart(opt, filenames())) { return out; }
 
@@ -4328,6 +4352,17 @@ SpatRaster SpatRasterCollection::mosaic(std::string fun, SpatOptions &opt) {
 //	if (!overlaps(r1, r2, c1, c2)) {
 //		return merge(true, true, opt);
 //	}
+
+	bool samenl = true;
+	for (size_t i=1; i<n; i++) {
+		samenl = samenl && (ds[i].nlyr() == nl);
+	}
+	std::vector<size_t> all(n);
+	std::iota(all.begin(), all.end(), 0);
+	if (samenl && (fun != "median") && (fun != "modal") && aligned_with(out, all, opt)) {
+		return mosaic_stream(out, all, fun, true, opt);
+	}
+
 	double ncl = 1000;
 	if (n > 50) ncl = 500;
 	if (n > 100) ncl = 250;
@@ -4976,6 +5011,137 @@ SpatDataFrame SpatRaster::globalTF(std::string fun, SpatOptions &opt) {
 }
 
 
+// co-moments of all pairs of layers (i <= j), for the cells that are not NA in
+// the pair ("pairwise"), in all layers ("complete"), or for all cells ("everything")
+class LayerCoMoments {
+	public:
+		size_t nl;
+		std::vector<double> n, mi, mj, m2i, m2j, c;
+
+		LayerCoMoments(size_t nlyr) {
+			nl = nlyr;
+			size_t np = nl * (nl+1) / 2;
+			n.resize(np, 0);
+			mi.resize(np, 0);
+			mj.resize(np, 0);
+			m2i.resize(np, 0);
+			m2j.resize(np, 0);
+			c.resize(np, 0);
+		}
+
+		// combine with the moments of another set of cells (Chan et al., 1979)
+		void merge(const LayerCoMoments &x) {
+			for (size_t k=0; k<n.size(); k++) {
+				if (x.n[k] == 0) continue;
+				if (n[k] == 0) {
+					n[k] = x.n[k]; mi[k] = x.mi[k]; mj[k] = x.mj[k];
+					m2i[k] = x.m2i[k]; m2j[k] = x.m2j[k]; c[k] = x.c[k];
+					continue;
+				}
+				double nn = n[k] + x.n[k];
+				double f = n[k] * x.n[k] / nn;
+				double di = x.mi[k] - mi[k];
+				double dj = x.mj[k] - mj[k];
+				m2i[k] += x.m2i[k] + di * di * f;
+				m2j[k] += x.m2j[k] + dj * dj * f;
+				c[k] += x.c[k] + di * dj * f;
+				mi[k] += di * x.n[k] / nn;
+				mj[k] += dj * x.n[k] / nn;
+				n[k] = nn;
+			}
+		}
+
+		// v has the values of all layers for "off" cells; use cells "start" to "end"
+		void add(const std::vector<double> &v, size_t off, size_t start, size_t end, bool pairwise, bool complete) {
+			if (pairwise) {
+				size_t k = 0;
+				for (size_t i=0; i<nl; i++) {
+					const double *a = &v[i * off];
+					for (size_t j=i; j<nl; j++) {
+						const double *b = &v[j * off];
+						double cn=0, si=0, sj=0;
+						for (size_t m=start; m<end; m++) {
+							if (std::isnan(a[m]) || std::isnan(b[m])) continue;
+							cn++;
+							si += a[m];
+							sj += b[m];
+						}
+						if (cn > 0) {
+							si /= cn;
+							sj /= cn;
+							double qi=0, qj=0, cc=0;
+							for (size_t m=start; m<end; m++) {
+								if (std::isnan(a[m]) || std::isnan(b[m])) continue;
+								double da = a[m] - si;
+								double db = b[m] - sj;
+								qi += da * da;
+								qj += db * db;
+								cc += da * db;
+							}
+							n[k] = cn; mi[k] = si; mj[k] = sj;
+							m2i[k] = qi; m2j[k] = qj; c[k] = cc;
+						}
+						k++;
+					}
+				}
+				return;
+			}
+			// the same cells for all pairs
+			std::vector<size_t> cells;
+			cells.reserve(end - start);
+			for (size_t m=start; m<end; m++) {
+				bool ok = true;
+				if (complete) {
+					for (size_t i=0; i<nl; i++) {
+						if (std::isnan(v[i * off + m])) {
+							ok = false;
+							break;
+						}
+					}
+				}
+				if (ok) cells.push_back(m);
+			}
+			double cn = cells.size();
+			if (cn == 0) return;
+			std::vector<double> means(nl, 0);
+			std::vector<std::vector<double>> d(nl, std::vector<double>(cells.size()));
+			for (size_t i=0; i<nl; i++) {
+				const double *a = &v[i * off];
+				for (size_t m=0; m<cells.size(); m++) {
+					means[i] += a[cells[m]];
+				}
+				means[i] /= cn;
+				for (size_t m=0; m<cells.size(); m++) {
+					d[i][m] = a[cells[m]] - means[i];
+				}
+			}
+			size_t k = 0;
+			for (size_t i=0; i<nl; i++) {
+				for (size_t j=i; j<nl; j++) {
+					double cc = 0;
+					const double *a = &d[i][0];
+					const double *b = &d[j][0];
+					for (size_t m=0; m<cells.size(); m++) {
+						cc += a[m] * b[m];
+					}
+					n[k] = cn; mi[k] = means[i]; mj[k] = means[j];
+					c[k] = cc;
+					k++;
+				}
+			}
+			// the sums of squares are on the diagonal
+			k = 0;
+			for (size_t i=0; i<nl; i++) {
+				for (size_t j=i; j<nl; j++) {
+					m2i[k] = c[i * nl - i * (i-1) / 2];
+					m2j[k] = c[j * nl - j * (j-1) / 2];
+					k++;
+				}
+			}
+		}
+};
+
+
 std::vector<std::vector<double>> SpatRaster::layerCor(std::string fun, std::string use, bool asSample, SpatOptions &opt) {
 
 	std::vector<std::vector<double>> out(3);	
@@ -4989,92 +5155,84 @@ std::vector<std::vector<double>> SpatRaster::layerCor(std::string fun, std::stri
 		setError("SpatRaster must have at least two layers");
 		return(out);
 	}
-
-	if (use == "complete.observations") {
-		SpatOptions sopt(opt);
-		SpatRaster x = anynan(true, sopt);
-		x = mask(x, false, NAN, NAN, sopt);
-		return x.layerCor(fun, "", asSample, opt);
+	if ((fun != "cor") && (fun != "cov")) {
+		setError("unknown function: " + fun);
+		return(out);
 	}
 
-	bool narm = true;
-	if (use == "all.observations") {
-		narm = false;		
-	}
+	bool complete = (use == "complete.obs") || (use == "complete.observations");
+	bool everything = (use == "everything") || (use == "all.observations");
+	bool pairwise = !(complete || everything);
 
-	if (fun == "cor") { // pearson
-		std::vector<double> means(nl*nl, NAN);
-		std::vector<double> cor(nl*nl, 1);
-		std::vector<double> nn(nl*nl, NAN);
-		SpatOptions topt(opt);
+	if (!readStart()) {
+		return(out);
+	}
+	BlockSize bs = getBlockSize(opt);
+	size_t nc = ncol();
+	LayerCoMoments cm(nl);
+	for (size_t i=0; i<bs.n; i++) {
+		std::vector<double> v;
+		readBlock(v, bs, i);
+		size_t off = bs.nrows[i] * nc;
+		size_t nchunk = 1;
+#if defined(USE_TBB)
+		if (opt.parallel && (off > 65536)) {
+			nchunk = off / 65536;
+		}
+#endif
+		size_t csize = std::ceil(off / (double)nchunk);
+		std::vector<LayerCoMoments> parts(nchunk, LayerCoMoments(nl));
+		auto do_chunk = [&](size_t k) {
+			size_t start = k * csize;
+			size_t end = std::min(off, start + csize);
+			parts[k].add(v, off, start, end, pairwise, complete);
+		};
+#if defined(USE_TBB)
+		if (nchunk > 1) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, nchunk),
+				[&](const tbb::blocked_range<size_t>& range) {
+				for (size_t k = range.begin(); k != range.end(); k++) {
+					do_chunk(k);
+				}
+			});
+		} else {
+			do_chunk(0);
+		}
+#else
+		do_chunk(0);
+#endif
+		for (size_t k=0; k<nchunk; k++) {
+			cm.merge(parts[k]);
+		}
+	}
+	readStop();
 
-		BlockSize bs = getBlockSize(topt);
-		
-		std::vector<std::string> gfuns = {"mean", "sd"};
-		for (size_t i=0; i<(nl-1); i++) {
-			for (size_t j=(i+1); j<nl; j++) {
-				SpatRaster xi = subset({i}, topt);
-				SpatRaster xj = subset({j}, topt);
-				if (!xi.readStart()) {
-					setError(getError());
-					return(out);
-				}
-				if (!xj.readStart()) {
-					setError(getError());
-					return(out);
-				}
-				std::vector<std::vector<double>> stats(2);
-				std::vector<std::vector<double>> stats2(2);
-				std::vector<double> n(2);
-				std::vector<double> vi, vj;				
-				for (size_t k=0; k<bs.n; k++) {
-					xi.readBlock(vi, bs, k);
-					xj.readBlock(vj, bs, k);
-					if (use == "pairwise.complete.observations") {
-						for (size_t m=0; m<vi.size(); m++) {
-							if (std::isnan(vi[m]) || std::isnan(vj[m])) {
-								vi[m] = NAN;
-								vj[m] = NAN;
-							} 
-						}
-					}
-					do_mstats(vi, 0, vi.size(), gfuns, narm, stats[0], stats2[0], n[0], k==0, k==(bs.n-1));
-					do_mstats(vj, 0, vj.size(), gfuns, narm, stats[1], stats2[1], n[1], k==0, k==(bs.n-1));
-				}
-				double value = 0;
-				for (long kk=bs.n; kk>0; kk--) {
-					size_t k = kk-1;
-					if (k < (bs.n-1)) {
-						xi.readBlock(vi, bs, k);
-						xj.readBlock(vj, bs, k);
-					}
-					if (narm) {
-						for (size_t m=0; m<vi.size(); m++) {
-							if ((!std::isnan(vi[m])) && (!std::isnan(vj[m]))) {
-								value += (vi[m] - stats[0][0]) * (vj[m]  - stats[1][0]);
-							}
-						}
-					} else {
-						for (size_t m=0; m<vi.size(); m++) {
-							value += (vi[m] - stats[0][0]) * (vj[m]  - stats[1][0]);
-						}
-					}
-				}
-				value /= (n[0] - asSample) * (stats[0][1] * stats[1][1]);
-				means[i*nl+j] = stats[0][0];
-				means[j*nl+i] = stats[1][0];
-				cor[i*nl+j] = value;
-				cor[j*nl+i] = value;
-				nn[i*nl+j] = n[0];
-				nn[j*nl+i] = n[1];
-				xi.readStop();
-				xj.readStop();
+	std::vector<double> stat(nl*nl, NAN);
+	std::vector<double> means(nl*nl, NAN);
+	std::vector<double> nn(nl*nl, NAN);
+	size_t k = 0;
+	for (size_t i=0; i<nl; i++) {
+		for (size_t j=i; j<nl; j++) {
+			double value;
+			if (fun == "cor") {
+				value = (i == j) ? 1 : cm.c[k] / std::sqrt(cm.m2i[k] * cm.m2j[k]);
+			} else {
+				value = cm.c[k] / (cm.n[k] - asSample);
+			}
+			stat[i*nl+j] = value;
+			stat[j*nl+i] = value;
+			if ((i != j) || (fun == "cov")) {
+				means[i*nl+j] = cm.mi[k];
+				means[j*nl+i] = cm.mj[k];
+				nn[i*nl+j] = cm.n[k];
+				nn[j*nl+i] = cm.n[k];
 			}
+			k++;
 		}
-		out[0] = cor;	
-		out[1] = means;	
-		out[2] = nn;
 	}
+	out[0] = stat;
+	out[1] = means;
+	out[2] = nn;
 	return(out);	
 }
 
@@ -5344,6 +5502,87 @@ SpatRaster SpatRaster::scale_linear(double smin, double smax, SpatOptions &opt)
 }
 
 
+// out[j] = offset[j] + sum_i x[i] * m[i,j]
+// v has nl layers of n cells; the cells from "start" to "end" are done in tiles
+// that fit in the cache
+void lincomb_cells(const std::vector<double> &v, std::vector<double> &out, const std::vector<double> &m, const std::vector<double> &offset, size_t nl, size_t nout, size_t n, size_t start, size_t end) {
+	const size_t tile = 512;
+	for (size_t t=start; t<end; t+=tile) {
+		size_t te = std::min(end, t + tile);
+		for (size_t j=0; j<nout; j++) {
+			double *o = &out[j * n];
+			for (size_t c=t; c<te; c++) {
+				o[c] = offset[j];
+			}
+			for (size_t i=0; i<nl; i++) {
+				double f = m[j * nl + i];
+				if (f == 0) continue;
+				const double *x = &v[i * n];
+				for (size_t c=t; c<te; c++) {
+					o[c] += f * x[c];
+				}
+			}
+		}
+	}
+}
+
+
+SpatRaster SpatRaster::lincomb(std::vector<double> m, std::vector<double> offset, SpatOptions &opt) {
+
+	size_t nl = nlyr();
+	size_t nout = m.size() / nl;
+	SpatRaster out = geometry(std::max(nout, (size_t)1));
+	if ((nout == 0) || ((nout * nl) != m.size())) {
+		out.setError("the number of rows of the matrix must be equal to the number of layers");
+		return out;
+	}
+	if (offset.empty()) {
+		offset.resize(nout, 0);
+	} else if (offset.size() != nout) {
+		out.setError("the length of offset must be equal to the number of columns of the matrix");
+		return out;
+	}
+	if (!hasValues()) return out;
+	std::vector<std::string> nms;
+	for (size_t j=0; j<nout; j++) {
+		nms.push_back("lc" + std::to_string(j+1));
+	}
+	out.setNames(nms, false);
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	opt.ncopies = std::max(opt.ncopies, 2 + (2 * nout) / nl);
+	if (!out.writeStart(opt, filenames())) {
+		readStop();
+		return out;
+	}
+	for (size_t i = 0; i < out.bs.n; i++) {
+		std::vector<double> v;
+		readBlock(v, out.bs, i);
+		size_t n = out.bs.nrows[i] * ncol();
+		std::vector<double> w(n * nout);
+#if defined(USE_TBB)
+		if (opt.parallel && (n > 16384)) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, n, 4096),
+				[&](const tbb::blocked_range<size_t>& range) {
+				lincomb_cells(v, w, m, offset, nl, nout, n, range.begin(), range.end());
+			});
+		} else {
+			lincomb_cells(v, w, m, offset, nl, nout, n, 0, n);
+		}
+#else
+		lincomb_cells(v, w, m, offset, nl, nout, n, 0, n);
+#endif
+		if (!out.writeBlock(w, i)) return out;
+	}
+	readStop();
+	out.writeStop();
+	return out;
+}
+
+
 
 /*
 bool can_use_replace(const std::vector<double> &from, const std::vector<double> &to) {
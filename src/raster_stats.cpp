@@ -18,6 +18,7 @@
 #include "spatRaster.h"
 #include <limits>
 #include <set>
+#include <unordered_map>
 //#include <cmath>
 //#include <algorithm>
 //#include <map>
@@ -29,6 +30,11 @@
 #include "string_utils.h"
 #include "table_utils.h"
 
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
 
 
 std::vector<std::vector<double>> SpatRaster::freq(bool bylayer, bool round, int digits, SpatOptions &opt) {
@@ -133,6 +139,229 @@ std::vector<size_t> SpatRaster::count(double value, bool bylayer, bool round, in
 }
 
 
+class XtabCount {
+	public:
+		double n = 0;
+		double area = 0;
+};
+
+// lexicographic order of cell value combinations, with NA last
+class XtabLess {
+	public:
+		bool operator()(const std::vector<double> &a, const std::vector<double> &b) const {
+			for (size_t i=0; i<a.size(); i++) {
+				bool na = std::isnan(a[i]);
+				bool nb = std::isnan(b[i]);
+				if (na || nb) {
+					if (na && nb) continue;
+					return nb;
+				}
+				if (a[i] < b[i]) return true;
+				if (a[i] > b[i]) return false;
+			}
+			return false;
+		}
+};
+
+typedef std::map<std::vector<double>, XtabCount, XtabLess> XtabMap;
+typedef std::unordered_map<uint64_t, XtabCount> XtabHash;
+
+
+// the (scaled and rounded) values of each layer are packed into one 64 bit key. 
+// code 0 is used for NA; lo and hi are the lowest and highest code per layer.
+bool xtab_packing(SpatRaster &x, double scale, std::vector<double> &lo, std::vector<double> &hi, std::vector<unsigned> &shift) {
+	size_t nl = x.nlyr();
+	std::vector<bool> hr = x.hasRange();
+	std::vector<double> rmin = x.range_min();
+	std::vector<double> rmax = x.range_max();
+	lo.resize(nl);
+	hi.resize(nl);
+	shift.resize(nl);
+	unsigned bits = 0;
+	for (size_t i=0; i<nl; i++) {
+		if ((!hr[i]) || (!std::isfinite(rmin[i])) || (!std::isfinite(rmax[i]))) {
+			return false;
+		}
+		lo[i] = std::floor(rmin[i] * scale);
+		hi[i] = std::ceil(rmax[i] * scale);
+		double width = hi[i] - lo[i] + 2;
+		if (width > 9.0e15) return false;
+		unsigned b = 1;
+		while (((uint64_t)1 << b) < (uint64_t)width) b++;
+		shift[i] = bits;
+		bits += b;
+		if (bits > 64) return false;
+	}
+	return true;
+}
+
+
+void xtab_chunk(const std::vector<double> &v, const std::vector<double> &a, size_t start, size_t end, size_t nrc, size_t nl, int digits, double scale, bool narm, bool pack, const std::vector<double> &lo, const std::vector<double> &hi, const std::vector<unsigned> &shift, XtabHash &hash, XtabMap &other) {
+
+	bool area = !a.empty();
+	std::vector<double> row(nl);
+	for (size_t j=start; j<end; j++) {
+		bool skip = false;
+		bool packed = pack;
+		uint64_t key = 0;
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			double d = v[lyr*nrc + j];
+			if (std::isnan(d)) {
+				if (narm) {
+					skip = true;
+					break;
+				}
+				row[lyr] = NAN;
+				continue;
+			}
+			if (packed) {
+				double k = std::round(d * scale);
+				if (std::isfinite(k) && (k >= lo[lyr]) && (k <= hi[lyr])) {
+					key |= ((uint64_t)(k - lo[lyr] + 1)) << shift[lyr];
+				} else {
+					packed = false;
+				}
+			}
+			row[lyr] = roundn(d, digits);
+		}
+		if (skip) continue;
+		XtabCount &cnt = packed ? hash[key] : other[row];
+		cnt.n++;
+		if (area) cnt.area += a[j];
+	}
+}
+
+
+SpatDataFrame SpatRaster::crosstab(int digits, bool narm, bool area, std::string unit, SpatOptions &opt) {
+
+	SpatDataFrame out;
+	size_t nl = nlyr();
+	if (nl < 2) {
+		out.setError("crosstab needs at least 2 layers");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("SpatRaster has no values");
+		return out;
+	}
+
+	SpatRaster ar;
+	if (area) {
+		SpatOptions aopt(opt);
+		ar = geometry(1).rst_area(false, unit, true, 100, aopt);
+		if (ar.hasError()) {
+			out.setError(ar.getError());
+			return out;
+		}
+		if (!ar.readStart()) {
+			out.setError(ar.getError());
+			return out;
+		}
+	}
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+
+	double scale = pow(10.0, digits);
+	std::vector<double> lo, hi;
+	std::vector<unsigned> shift;
+	bool pack = xtab_packing(*this, scale, lo, hi, shift);
+
+	opt.ncopies = area ? 6 : 4;
+	BlockSize bs = getBlockSize(opt);
+	size_t nc = ncol();
+
+	XtabHash hash;
+	XtabMap other;
+	for (size_t i = 0; i < bs.n; i++) {
+		size_t nrc = bs.nrows[i] * nc;
+		std::vector<double> v, a;
+		readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+		if (area) {
+			ar.readValues(a, bs.row[i], bs.nrows[i], 0, nc);
+		}
+#if defined(USE_TBB)
+		if (opt.parallel && (nrc > 65536)) {
+			// one table per chunk, merged below
+			size_t nchunk = nrc / 65536;
+			size_t csize = std::ceil(nrc / (double)nchunk);
+			std::vector<XtabHash> hashes(nchunk);
+			std::vector<XtabMap> others(nchunk);
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, nchunk),
+				[&](const tbb::blocked_range<size_t>& range) {
+				for (size_t k = range.begin(); k != range.end(); k++) {
+					size_t start = k * csize;
+					size_t end = std::min(nrc, start + csize);
+					xtab_chunk(v, a, start, end, nrc, nl, digits, scale, narm, pack, lo, hi, shift, hashes[k], others[k]);
+				}
+			});
+			for (size_t k=0; k<nchunk; k++) {
+				for (auto& it : hashes[k]) {
+					XtabCount &cnt = hash[it.first];
+					cnt.n += it.second.n;
+					cnt.area += it.second.area;
+				}
+				for (auto& it : others[k]) {
+					XtabCount &cnt = other[it.first];
+					cnt.n += it.second.n;
+					cnt.area += it.second.area;
+				}
+			}
+		} else {
+			xtab_chunk(v, a, 0, nrc, nrc, nl, digits, scale, narm, pack, lo, hi, shift, hash, other);
+		}
+#else
+		xtab_chunk(v, a, 0, nrc, nrc, nl, digits, scale, narm, pack, lo, hi, shift, hash, other);
+#endif
+	}
+	readStop();
+	if (area) ar.readStop();
+
+	if (pack) { // unpack the keys
+		std::vector<uint64_t> mask(nl);
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			unsigned b = (lyr < (nl-1)) ? (shift[lyr+1] - shift[lyr]) : (64 - shift[lyr]);
+			mask[lyr] = (b >= 64) ? UINT64_MAX : (((uint64_t)1 << b) - 1);
+		}
+		std::vector<double> row(nl);
+		for (auto& it : hash) {
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				uint64_t code = (it.first >> shift[lyr]) & mask[lyr];
+				row[lyr] = (code == 0) ? NAN : (code - 1 + lo[lyr]) / scale;
+			}
+			XtabCount &cnt = other[row];
+			cnt.n += it.second.n;
+			cnt.area += it.second.area;
+		}
+		hash.clear();
+	}
+
+	size_t n = other.size();
+	std::vector<std::vector<double>> vals(nl, std::vector<double>(n));
+	std::vector<double> cnts(n), areas;
+	if (area) areas.resize(n);
+	size_t j = 0;
+	for (auto& it : other) {
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			vals[lyr][j] = it.first[lyr];
+		}
+		cnts[j] = it.second.n;
+		if (area) areas[j] = it.second.area;
+		j++;
+	}
+
+	std::vector<std::string> nms = getNames();
+	make_unique_names(nms);
+	for (size_t lyr=0; lyr<nl; lyr++) {
+		out.add_column(vals[lyr], nms[lyr]);
+	}
+	out.add_column(cnts, "n");
+	if (area) out.add_column(areas, "area");
+	return out;
+}
+
 
 SpatRaster SpatRaster::quantile(std::vector<double> probs, bool narm, SpatOptions &opt) {
 
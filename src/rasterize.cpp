@@ -11,258 +11,234 @@
 #include "recycle.h"
 #include "sort.h"
 #include "gdalio.h"
+#include <functional>
 
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
 
-SpatRaster SpatRaster::rasterizePoints(std::vector<double>&x, std::vector<double> &y, std::string fun, std::vector<double> &values, bool narm, double background, SpatOptions &opt) {
 
-	SpatRaster out = geometry(1, false, false, false);
-	
-	if (!out.writeStart(opt, filenames())) {
+// Point rasterization. The points are binned by block of output rows with a
+// stable counting sort on the block number (in parallel), and then, within a
+// block, by cell; such that the points of a cell are contiguous and in their
+// original order. All statistics are computed from these in a single pass, in
+// parallel over the cells of a block.
+
+static const std::vector<std::string> point_funs {"first", "last", "pa", "sum", "mean", "count", "min", "max", "prod", "sd", "distinct"};
+
+
+// the indices of the points with a cell number grouped by block.
+// off[b] is the position of the first point of block b in "order"
+void bin_points(const std::vector<double> &cells, const std::vector<size_t> &rowblock, size_t nc, size_t nb, std::vector<size_t> &order, std::vector<size_t> &off, bool parallel) {
+
+	size_t n = cells.size();
+	size_t nchunk = parallel ? std::min((size_t)64, n / 65536 + 1) : 1;
+	size_t csize = n / nchunk + 1;
+	std::vector<std::vector<size_t>> pos(nchunk, std::vector<size_t>(nb, 0));
+
+	auto count = [&](size_t k) {
+		size_t end = std::min(n, (k+1) * csize);
+		for (size_t j=k*csize; j<end; j++) {
+			if (cells[j] >= 0) pos[k][rowblock[(size_t)cells[j] / nc]]++;
+		}
+	};
+	auto scatter = [&](size_t k) {
+		size_t end = std::min(n, (k+1) * csize);
+		for (size_t j=k*csize; j<end; j++) {
+			if (cells[j] >= 0) order[pos[k][rowblock[(size_t)cells[j] / nc]]++] = j;
+		}
+	};
+	auto run = [&](std::function<void(size_t)> f) {
+#if defined(USE_TBB)
+		if (nchunk > 1) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, nchunk, 1),
+				[&](const tbb::blocked_range<size_t>& r) {
+				for (size_t k=r.begin(); k<r.end(); k++) f(k);
+			});
+			return;
+		}
+#endif
+		for (size_t k=0; k<nchunk; k++) f(k);
+	};
+
+	run(count);
+	// the first position of each chunk in each block
+	off.resize(nb+1);
+	size_t p = 0;
+	for (size_t b=0; b<nb; b++) {
+		off[b] = p;
+		for (size_t k=0; k<nchunk; k++) {
+			size_t h = pos[k][b];
+			pos[k][b] = p;
+			p += h;
+		}
+	}
+	off[nb] = p;
+	order.resize(p);
+	run(scatter);
+}
+
+
+// the statistics of the values of the points (idx) in a cell.
+// out has a layer (of ncell values) for each function
+void point_stats(const std::vector<double> &values, const size_t *idx, size_t n, const std::vector<int> &funs, bool narm, double background, std::vector<double> &out, size_t cell, size_t ncell, std::vector<double> &buf) {
+
+	size_t cnt = 0, nv = 0;
+	bool hasna = false, first = true;
+	double vfirst = NAN, vlast = NAN;
+	double sum = 0, prod = 1, mean = 0, m2 = 0;
+	double vmin = std::numeric_limits<double>::infinity();
+	double vmax = -vmin;
+	buf.resize(0);
+	for (size_t i=0; i<n; i++) {
+		double v = values[idx[i]];
+		bool isna = std::isnan(v);
+		if (narm && isna) continue;
+		cnt++;
+		if (first) {
+			vfirst = v;
+			first = false;
+		}
+		vlast = v;
+		if (isna) {
+			hasna = true;
+			continue;
+		}
+		nv++;
+		sum += v;
+		prod *= v;
+		vmin = std::min(vmin, v);
+		vmax = std::max(vmax, v);
+		double d = v - mean;
+		mean += d / nv;
+		m2 += d * (v - mean);
+		buf.push_back(v);
+	}
+
+	for (size_t f=0; f<funs.size(); f++) {
+		double r;
+		if (cnt == 0) {
+			r = background;
+		} else {
+			switch (funs[f]) {
+				case 0: r = vfirst; break;
+				case 1: r = vlast; break;
+				case 2: r = 1; break;
+				case 3: r = sum; break;
+				case 4: r = mean; break;
+				case 5: r = cnt; break;
+				case 6: r = vmin; break;
+				case 7: r = vmax; break;
+				case 8: r = prod; break;
+				case 9: r = nv > 1 ? std::sqrt(m2 / (nv - 1)) : NAN; break;
+				default: {
+					std::sort(buf.begin(), buf.end());
+					r = (std::unique(buf.begin(), buf.end()) - buf.begin()) + hasna;
+				}
+			}
+			if (hasna && (funs[f] > 2) && (funs[f] != 5) && (funs[f] != 10)) r = NAN;
+		}
+		out[f * ncell + cell] = r;
+	}
+}
+
+
+SpatRaster SpatRaster::rasterizePointStats(std::vector<double>&x, std::vector<double> &y, std::vector<std::string> funs, std::vector<double> &values, bool narm, double background, SpatOptions &opt) {
+
+	size_t nl = funs.size();
+	SpatRaster out = geometry(std::max(nl, (size_t)1), false, false, false);
+	if (nl == 0) {
+		out.setError("no function");
 		return out;
 	}
-	
+	std::vector<int> ifuns(nl);
+	for (size_t i=0; i<nl; i++) {
+		auto it = std::find(point_funs.begin(), point_funs.end(), funs[i]);
+		if (it == point_funs.end()) {
+			out.setError("unknown function: " + funs[i]);
+			return out;
+		}
+		ifuns[i] = it - point_funs.begin();
+	}
+	out.setNames(funs);
 	if (y.size() != x.size()) {
 		out.setError("number of x and y coordinates do not match");
 		return out;
 	}
-	if ((fun == "count") && (values.size() != x.size()) && (!values.empty())) {
-		out.setError("number of values does not match the number of points");
-		return out;
+	if (values.empty()) {
+		values.resize(x.size(), 1);
 	} else if (values.size() != x.size()) {
 		out.setError("number of values does not match the number of points");
 		return out;
 	}
 
-	size_t nc = ncol();
-	std::vector<double> cells = cellFromXY(x, y, -9);
-	// order for multiple chunks, but also to remove NAs (-9)
-	std::vector<std::size_t> so = sort_order_a(cells);
-	permute(cells, so);
-	permute(values, so);
-
-	size_t cellcnt = 0;
-	for (size_t i=0; i<cells.size(); i++) {
-		if (cells[i] < 0) {
-			cellcnt++;
-		} else {
-			break;
-		}
+	if (!out.writeStart(opt, filenames())) {
+		return out;
 	}
 
-	if (fun == "count") {
-		bool dotest = (!values.empty()) && narm;
-		for (size_t i=0; i < out.bs.n; i++) {
-			double cmin = out.bs.row[i] * nc;
-			double cmax = (out.bs.row[i]+out.bs.nrows[i]) * nc - 1;
-			std::vector<double> v(out.bs.nrows[i] * out.ncol(), 0);
+	size_t nc = ncol();
+	std::vector<double> cells = cellFromXY(x, y, -9);
 
-			for (size_t j=cellcnt; j<cells.size(); j++) {
-				if (dotest && std::isnan(values[j])) continue;
-				if (cells[j] <= cmax) {
-					size_t k = cells[j] - cmin;
-					v[k]++;
-				} else {
-					cellcnt = j;
-					break;
-				}
-			}
-			if (background != 0) {
-				for (size_t j=0; j<v.size(); j++) {
-					if (v[j] == 0) {
-						v[j] = background;
-					}
-				}
-			}
-			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i]))  return out;
-		}
-	} else if (fun == "mean") {
-		for (size_t i=0; i < out.bs.n; i++) {
-			double cmin = out.bs.row[i] * nc;
-			double cmax = (out.bs.row[i]+out.bs.nrows[i]) * nc - 1;
-			std::vector<double> v(out.bs.nrows[i] * out.ncol(), 0);
-			std::vector<double> cnt = v;
-			for (size_t j=cellcnt; j<cells.size(); j++) {
-				if (narm && std::isnan(values[j])) continue;
-				if (cells[j] <= cmax) {
-					size_t k = cells[j] - cmin;
-					v[k] += values[j];
-					cnt[k]++;
-				} else {
-					cellcnt = j;
-					break;
-				}
-			}
-			if (background != 0) {
-				for (size_t j=0; j<v.size(); j++) {
-					if (cnt[j] == 0) {
-						v[j] = background;
-					} else {
-						v[j] /= cnt[j];						
-					}
-				}
-			} else {
-				for (size_t j=0; j<cnt.size(); j++) {
-					if (cnt[j] > 0) {
-						v[j] /= cnt[j];
-					}
-				}				
-			}			
-			
-			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i]))  return out;
-		}
-	} else if (fun == "sum") {
-		for (size_t i=0; i < out.bs.n; i++) {
-			double cmin = out.bs.row[i] * nc;
-			double cmax = (out.bs.row[i]+out.bs.nrows[i]) * nc - 1;
-			std::vector<double> v(out.bs.nrows[i] * out.ncol(), background);
-			std::vector<bool> newcell(out.bs.nrows[i] * out.ncol(), true);
-			for (size_t j=cellcnt; j<cells.size(); j++) {
-				if (narm && std::isnan(values[j])) continue;
-				if (cells[j] <= cmax) {
-					size_t k = cells[j] - cmin;
-					if (newcell[k]) {
-						v[k] = values[j];
-						newcell[k] = false;
-					} else {
-						v[k] += values[j];
-					}
-				} else {
-					cellcnt = j;
-					break;
-				}
-			}
-			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i]))  return out;
-		}
-	} else if (fun == "min") {
-		for (size_t i=0; i < out.bs.n; i++) {
-			double cmin = out.bs.row[i] * nc;
-			double cmax = (out.bs.row[i]+out.bs.nrows[i]) * nc - 1;
-			std::vector<double> v(out.bs.nrows[i] * out.ncol(), background);
-			std::vector<bool> newcell(out.bs.nrows[i] * out.ncol(), true);
-			for (size_t j=cellcnt; j<cells.size(); j++) {
-				if (narm && std::isnan(values[j])) continue;
-				if (cells[j] <= cmax) {
-					size_t k = cells[j] - cmin;
-					if (newcell[k]) {
-						v[k] = values[j];
-						newcell[k] = false;
-					} else {
-						v[k] = std::min(v[k], values[j]);
-					}
-				} else {
-					cellcnt = j;
-					break;
-				}
-			}
-			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i]))  return out;
-		}
-	} else if (fun == "max") {
-		for (size_t i=0; i < out.bs.n; i++) {
-			double cmin = out.bs.row[i] * nc;
-			double cmax = (out.bs.row[i]+out.bs.nrows[i]) * nc - 1;
-			std::vector<double> v(out.bs.nrows[i] * out.ncol(), background);
-			std::vector<bool> newcell(out.bs.nrows[i] * out.ncol(), true);
-			for (size_t j=cellcnt; j<cells.size(); j++) {
-				if (narm && std::isnan(values[j])) continue;
-				if (cells[j] <= cmax) {
-					size_t k = cells[j] - cmin;
-					if (newcell[k]) {
-						v[k] = values[j];
-						newcell[k] = false;
-					} else {
-						v[k] = std::max(v[k], values[j]);
-					}
-				} else {
-					cellcnt = j;
-					break;
-				}
-			}
-			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i]))  return out;
-		}
-	} else if (fun == "prod") {
-		for (size_t i=0; i < out.bs.n; i++) {
-			double cmin = out.bs.row[i] * nc;
-			double cmax = (out.bs.row[i]+out.bs.nrows[i]) * nc - 1;
-			std::vector<double> v(out.bs.nrows[i] * out.ncol(), background);
-			std::vector<bool> newcell(out.bs.nrows[i] * out.ncol(), true);
-			for (size_t j=cellcnt; j<cells.size(); j++) {
-				if (narm && std::isnan(values[j])) continue;
-				if (cells[j] <= cmax) {
-					size_t k = cells[j] - cmin;
-					if (newcell[k]) {
-						v[k] = values[j];
-						newcell[k] = false;
-					} else {
-						v[k] *= values[j];
-					}
-				} else {
-					cellcnt = j;
-					break;
-				}
-			}
-			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i]))  return out;
+	std::vector<size_t> rowblock(nrow());
+	for (size_t i=0; i<out.bs.n; i++) {
+		std::fill(rowblock.begin() + out.bs.row[i], rowblock.begin() + out.bs.row[i] + out.bs.nrows[i], i);
+	}
+	std::vector<size_t> order, boff;
+	bin_points(cells, rowblock, nc, out.bs.n, order, boff, opt.parallel);
+
+	for (size_t i=0; i < out.bs.n; i++) {
+		size_t ncell = out.bs.nrows[i] * nc;
+		size_t cmin = out.bs.row[i] * nc;
+		// group the points of this block by cell
+		std::vector<size_t> coff(ncell+1, 0);
+		for (size_t j=boff[i]; j<boff[i+1]; j++) {
+			coff[(size_t)cells[order[j]] - cmin + 1]++;
 		}
-	} else if (fun == "pa") {
-		for (size_t i=0; i < out.bs.n; i++) {
-			double cmin = out.bs.row[i] * nc;
-			double cmax = (out.bs.row[i]+out.bs.nrows[i]) * nc - 1;
-			std::vector<double> v(out.bs.nrows[i] * out.ncol(), background);
-			for (size_t j=cellcnt; j<cells.size(); j++) {
-				if (narm && std::isnan(values[j])) continue;
-				if (cells[j] <= cmax) {
-					size_t k = cells[j] - cmin;
-					v[k] = 1;
-				} else {
-					cellcnt = j;
-					break;
-				}
-			}
-			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i]))  return out;
+		for (size_t c=0; c<ncell; c++) {
+			coff[c+1] += coff[c];
 		}
-	} else if (fun == "first") {
-		for (size_t i=0; i < out.bs.n; i++) {
-			double cmin = out.bs.row[i] * nc;
-			double cmax = (out.bs.row[i]+out.bs.nrows[i]) * nc - 1;
-			std::vector<double> v(out.bs.nrows[i] * out.ncol(), background);
-			std::vector<bool> newcell(out.bs.nrows[i] * out.ncol(), true);;
-			for (size_t j=cellcnt; j<cells.size(); j++) {
-				if (narm && std::isnan(values[j])) continue;
-				if (cells[j] <= cmax) {
-					size_t k = cells[j] - cmin;
-					if (newcell[k]) {
-						v[k] = values[j];
-						newcell[k] = false;
-					} 
-				} else {
-					cellcnt = j;
-					break;
-				}
-			}
-			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i]))  return out;
+		std::vector<size_t> idx(boff[i+1] - boff[i]);
+		std::vector<size_t> pos(coff.begin(), coff.end()-1);
+		for (size_t j=boff[i]; j<boff[i+1]; j++) {
+			idx[pos[(size_t)cells[order[j]] - cmin]++] = order[j];
 		}
-	} else { // "last"
-		for (size_t i=0; i < out.bs.n; i++) {
-			double cmin = out.bs.row[i] * nc;
-			double cmax = (out.bs.row[i]+out.bs.nrows[i]) * nc - 1;
-			std::vector<double> v(out.bs.nrows[i] * out.ncol(), background);
-			for (size_t j=cellcnt; j<cells.size(); j++) {
-				if (narm && std::isnan(values[j])) continue;
-				if (cells[j] <= cmax) {
-					size_t k = cells[j] - cmin;
-					v[k] = values[j];
-				} else {
-					cellcnt = j;
-					break;
-				}
+
+		std::vector<double> v(nl * ncell);
+		auto do_cells = [&](size_t start, size_t end) {
+			std::vector<double> buf;
+			for (size_t c=start; c<end; c++) {
+				point_stats(values, idx.data() + coff[c], coff[c+1] - coff[c], ifuns, narm, background, v, c, ncell, buf);
 			}
-			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i]))  return out;
+		};
+#if defined(USE_TBB)
+		if (opt.parallel && (idx.size() > 65536)) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, ncell, 1024),
+				[&](const tbb::blocked_range<size_t>& r) {
+				do_cells(r.begin(), r.end());
+			});
+		} else {
+			do_cells(0, ncell);
 		}
+#else
+		do_cells(0, ncell);
+#endif
+		if (!out.writeBlock(v, i)) return out;
 	}
 	out.writeStop();
 	return out;
 }
 
 
+SpatRaster SpatRaster::rasterizePoints(std::vector<double>&x, std::vector<double> &y, std::string fun, std::vector<double> &values, bool narm, double background, SpatOptions &opt) {
+	std::vector<std::string> funs = {fun};
+	if (std::find(point_funs.begin(), point_funs.end(), fun) == point_funs.end()) {
+		funs[0] = "last";
+	}
+	return rasterizePointStats(x, y, funs, values, narm, background, opt);
+}
+
+
 SpatRaster SpatRaster::rasterizePoints(SpatVector &x, std::string fun, std::vector<double> &values, bool narm, double background, SpatOptions &opt) {
 	if (values.empty()) {
 		values = std::vector<double>(x.nrow(), 1);
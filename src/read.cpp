@@ -282,6 +282,7 @@ void SpatRaster::readValuesWhileWriting(std::vector<double> &out, size_t row, si
 		} else {
 			// read from file
 			#ifdef useGDAL
+			if (wqueue) wqueue->wait();
 			readChunkGDAL(out, src, row, nrows, col, ncols);
 			#endif // useGDAL
 		}
@@ -1713,6 +1713,87 @@ std::vector<double> SpatRaster::readGDALsample(size_t src, size_t srows, size_t
 }
 
 
+bool SpatRaster::useOverview(double xres_out, double yres_out, std::string method, bool aligned, SpatRaster &out, size_t &fx, size_t &fy, SpatOptions &opt) {
+
+	// use the coarsest overview with a resolution that is at least "opt.overviews" 
+	// times finer than the output resolution. If "aligned", the overview cells must 
+	// combine a whole number of cells (fx, fy) of the original data 
+	fx = 1;
+	fy = 1;
+	#if GDAL_VERSION_MAJOR <= 3 && GDAL_VERSION_MINOR < 3
+	return false;
+	#endif
+	if ((opt.overviews < 1) || (!hasValues())) return false;
+
+	// the overviews are assumed to be averages
+	std::vector<std::string> methods {"mean", "average", "bilinear", "cubic", "cubicspline", "lanczos"};
+	if (std::find(methods.begin(), methods.end(), method) == methods.end()) return false;
+	std::vector<bool> hc = hasCategories();
+	std::vector<bool> hcol = hasColors();
+	for (size_t i=0; i<hc.size(); i++) {
+		if (hc[i] || hcol[i]) return false;
+	}
+
+	size_t ns = nsrc();
+	std::vector<std::vector<size_t>> ovnc(ns), ovnr(ns);
+	for (size_t i=0; i<ns; i++) {
+		if (source[i].memory || source[i].is_multidim || source[i].hasWindow || source[i].extset || source[i].flipped || source[i].rotated) {
+			return false;
+		}
+		for (size_t j=0; j<source[i].open_ops.size(); j++) {
+			if (source[i].open_ops[j].substr(0, 14) == "OVERVIEW_LEVEL") return false;
+		}
+		GDALDataset *poDS = openGDAL(source[i].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, source[i].open_drivers, source[i].open_ops);
+		if (poDS == NULL) return false;
+		GDALRasterBand *poBand = poDS->GetRasterBand(source[i].layers[0]+1);
+		int n = poBand->GetOverviewCount();
+		for (int k=0; k<n; k++) {
+			GDALRasterBand *ovBand = poBand->GetOverview(k);
+			if (ovBand == NULL) break;
+			ovnc[i].push_back(ovBand->GetXSize());
+			ovnr[i].push_back(ovBand->GetYSize());
+		}
+		GDALClose( (GDALDatasetH) poDS );
+	}
+
+	SpatExtent e = getExtent();
+	double factor = opt.overviews;
+	int level = -1;
+	for (size_t k=0; k<ovnc[0].size(); k++) {
+		size_t nc = ovnc[0][k];
+		size_t nr = ovnr[0][k];
+		if ((nc == 0) || (nr == 0)) continue;
+		double oxres = (e.xmax - e.xmin) / nc;
+		double oyres = (e.ymax - e.ymin) / nr;
+		if ((oxres * factor > xres_out) || (oyres * factor > yres_out)) continue;
+		if (aligned && (((ncol() % nc) != 0) || ((nrow() % nr) != 0))) continue;
+		bool same = true;
+		for (size_t i=1; i<ns; i++) {
+			if ((ovnc[i].size() <= k) || (ovnc[i][k] != nc) || (ovnr[i][k] != nr)) {
+				same = false;
+				break;
+			}
+		}
+		if (!same) continue;
+		if ((level < 0) || (nc < ovnc[0][level])) {
+			level = k;
+		}
+	}
+	if (level < 0) return false;
+
+	out = *this;
+	std::string ovl = "OVERVIEW_LEVEL=" + std::to_string(level);
+	for (size_t i=0; i<ns; i++) {
+		out.source[i].open_ops.push_back(ovl);
+		out.source[i].ncol = ovnc[0][level];
+		out.source[i].nrow = ovnr[0][level];
+	}
+	fx = ncol() / ovnc[0][level];
+	fy = nrow() / ovnr[0][level];
+	return true;
+}
+
+
 void SpatRaster::readRowColGDAL(size_t src, std::vector<std::vector<double>> &out, size_t outstart, std::vector<int64_t> &rows, const std::vector<int64_t> &cols) {
 
 
@@ -26,6 +26,14 @@
 #include "NA.h"
 
 #include "string_utils.h"
+#include "spatArrow.h"
+#include "gdalio.h"
+#include <algorithm>
+
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
 
 
 std::string geomType(OGRLayer *poLayer) {
@@ -77,6 +85,11 @@ SpatDataFrame readAttributes(OGRLayer *poLayer, bool as_proxy) {
 			dtype = 2;
 		}
 		df.add_column(dtype, fname);
+		if (ft == OFTDate) {
+			df.tv.back().step = "days";
+		} else if (ft == OFTDateTime) {
+			df.tv.back().step = "seconds";
+		}
 	}
 
     OGRFeature *poFeature;
@@ -118,9 +131,6 @@ SpatDataFrame readAttributes(OGRLayer *poLayer, bool as_proxy) {
 					}
 					break;
 				case OFTDate:  
-					if (i == 0) {
-						df.tv[j].step = "days";
-					}
 					if (not_null) {
 						int pnYear, pnMonth, pnDay, pnHour, pnMinute, pnTZFlag;
 						float pfSecond;
@@ -132,9 +142,6 @@ SpatDataFrame readAttributes(OGRLayer *poLayer, bool as_proxy) {
 					}
 					break;
 				case OFTDateTime:
-					if (i == 0) {
-						df.tv[j].step = "seconds";
-					}
 					if (not_null) {
 						int pnYear, pnMonth, pnDay, pnHour, pnMinute, pnTZFlag;
 						float pfSecond;
@@ -571,6 +578,220 @@ bool layerQueryFilter(GDALDataset *&poDS, OGRLayer *&poLayer, std::string &layer
 
 
 
+#if GDAL_VERSION_NUM >= 3060000
+
+// decode one WKB geometry
+// zm is set to 1 for Z, 2 for M and 3 for both
+bool wkb_geom(const unsigned char *wkb, size_t size, SpatGeom &g, char &zm, std::string &msg) {
+	OGRGeometry *poGeometry = NULL;
+	OGRErr err = OGRGeometryFactory::createFromWkb(wkb, NULL, &poGeometry, size);
+	if ((err != OGRERR_NONE) || (poGeometry == NULL)) {
+		msg = "not valid WKB";
+		return false;
+	}
+	zm = (poGeometry->Is3D() ? 1 : 0) + (poGeometry->IsMeasured() ? 2 : 0);
+	OGRwkbGeometryType gtype = wkbFlatten(poGeometry->getGeometryType());
+	bool ok = true;
+	if (gtype == wkbPoint) {
+		g = getPointGeom(poGeometry);
+	} else if (gtype == wkbMultiPoint) {
+		g = getMultiPointGeom(poGeometry);
+	} else if (gtype == wkbLineString) {
+		g = getLinesGeom(poGeometry);
+	} else if (gtype == wkbMultiLineString) {
+		g = getMultiLinesGeom(poGeometry);
+	} else if (gtype == wkbPolygon) {
+		g = getPolygonsGeom(poGeometry);
+	} else if (gtype == wkbMultiPolygon) {
+		g = getMultiPolygonsGeom(poGeometry);
+	} else {
+		msg = "cannot read geometry type: " + std::string(OGRGeometryTypeToName(gtype));
+		ok = false;
+	}
+	OGRGeometryFactory::destroyGeometry(poGeometry);
+	return ok;
+}
+
+
+// Read a layer with the columnar Arrow interface of OGR (GDAL >= 3.6),
+// in batches of features. The attributes go straight into the columns of
+// the SpatDataFrame. The WKB geometries of a batch are decoded in parallel
+// if possible. Returns false, without changing the SpatVector, if the layer
+// cannot be read in this way. The feature by feature reader is then used.
+bool SpatVector::read_ogr_arrow(OGRLayer *poLayer, std::string what) {
+
+	bool getgeoms = what != "attributes";
+	bool getatts = what != "geoms";
+
+	OGRwkbGeometryType wkbgeom = wkbFlatten(poLayer->GetGeomType());
+	if (getgeoms) {
+		if (!((wkbgeom == wkbPoint) || (wkbgeom == wkbMultiPoint) ||
+				(wkbgeom == wkbLineString) || (wkbgeom == wkbMultiLineString) ||
+				(wkbgeom == wkbPolygon) || (wkbgeom == wkbMultiPolygon))) {
+			return false;
+		}
+	}
+
+	// the same data types as in readAttributes
+	SpatDataFrame d;
+	OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
+	size_t nfields = poFDefn->GetFieldCount();
+	std::vector<std::string> fields;
+	for (size_t i = 0; i < nfields; i++ ) {
+		OGRFieldDefn *poFieldDefn = poFDefn->GetFieldDefn(i);
+		std::string fname = poFieldDefn->GetNameRef();
+		fields.push_back(fname);
+		OGRFieldType ft = poFieldDefn->GetType();
+		if ((ft == OFTReal) || (ft == OFTInteger64)) {
+			d.add_column(0, fname);
+		} else if (ft == OFTInteger) {
+			d.add_column(poFieldDefn->GetSubType() == OFSTBoolean ? 3 : 1, fname);
+		} else if (ft == OFTDate) {
+			d.add_column(4, fname);
+			d.tv.back().step = "days";
+		} else if (ft == OFTDateTime) {
+			d.add_column(4, fname);
+			d.tv.back().step = "seconds";
+		} else if (ft == OFTString) {
+			d.add_column(2, fname);
+		} else {
+			// e.g. lists and times are returned as text by readAttributes
+			return false;
+		}
+	}
+
+	char **options = NULL;
+	options = CSLSetNameValue(options, "INCLUDE_FID", "NO");
+	options = CSLSetNameValue(options, "GEOMETRY_ENCODING", "WKB");
+	ArrowArrayStream stream;
+	poLayer->ResetReading();
+	bool ok = poLayer->GetArrowStream(&stream, options);
+	CSLDestroy(options);
+	if (!ok) return false;
+
+	ArrowSchema schema;
+	if (stream.get_schema(&stream, &schema) != 0) {
+		stream.release(&stream);
+		return false;
+	}
+
+	// the columns that are not attributes; the first binary one has the geometries
+	std::vector<std::string> skip;
+	int gcol = -1;
+	for (int64_t i=0; i<schema.n_children; i++) {
+		std::string nm = schema.children[i]->name;
+		if (std::find(fields.begin(), fields.end(), nm) == fields.end()) {
+			skip.push_back(nm);
+			std::string f = schema.children[i]->format;
+			if ((gcol < 0) && ((f == "z") || (f == "Z"))) gcol = i;
+		}
+	}
+	if (getgeoms && (gcol < 0)) {
+		schema.release(&schema);
+		stream.release(&stream);
+		return false;
+	}
+	bool large = getgeoms && (std::string(schema.children[gcol]->format) == "Z");
+
+	SpatVector out;
+	char zm = 0;
+	std::string msg;
+	ok = true;
+	while (ok) {
+		ArrowArray array;
+		if (stream.get_next(&stream, &array) != 0) {
+			const char *e = stream.get_last_error(&stream);
+			msg = e == NULL ? "cannot read Arrow stream" : e;
+			ok = false;
+			break;
+		}
+		if (array.release == NULL) break; // end of stream
+		size_t n = array.length;
+
+		if (getatts) {
+			if (!d.from_arrow(&schema, &array, skip)) {
+				msg = d.getError();
+				ok = false;
+			}
+		}
+		if (ok && getgeoms) {
+			ArrowArray g = *(array.children[gcol]);
+			g.offset += array.offset;
+			const unsigned char *data = (const unsigned char *) g.buffers[2];
+			std::vector<SpatGeom> geoms(n);
+			std::vector<std::string> errs(n);
+			std::vector<char> has_zm(n, 0);
+			auto decode = [&](size_t start, size_t end) {
+				for (size_t i=start; i<end; i++) {
+					if (!arrow_valid(&g, i)) {
+						geoms[i] = emptyGeom();
+						continue;
+					}
+					int64_t k = g.offset + i, b, e;
+					if (large) {
+						b = ((const int64_t *) g.buffers[1])[k];
+						e = ((const int64_t *) g.buffers[1])[k+1];
+					} else {
+						b = ((const int32_t *) g.buffers[1])[k];
+						e = ((const int32_t *) g.buffers[1])[k+1];
+					}
+					char gzm = 0;
+					if (e == b) {
+						geoms[i] = emptyGeom();
+					} else if (!wkb_geom(data + b, e - b, geoms[i], gzm, errs[i])) {
+						return;
+					}
+					has_zm[i] = gzm;
+				}
+			};
+#if defined(USE_TBB)
+			if (n > 10000) {
+				tbb::parallel_for(tbb::blocked_range<size_t>(0, n, 1024),
+					[&](const tbb::blocked_range<size_t>& range) {
+					QuietGDALErrors quiet;
+					decode(range.begin(), range.end());
+				});
+			} else {
+				decode(0, n);
+			}
+#else
+			decode(0, n);
+#endif
+			out.reserve(out.size() + n);
+			for (size_t i=0; i<n; i++) {
+				if (!errs[i].empty()) {
+					msg = errs[i];
+					ok = false;
+					break;
+				}
+				zm |= has_zm[i];
+				out.addGeom(geoms[i]);
+			}
+		}
+		array.release(&array);
+	}
+	schema.release(&schema);
+	stream.release(&stream);
+
+	if (!ok) {
+		// an unsupported geometry type, for example; fall back
+		return false;
+	}
+	if (getgeoms) {
+		geoms = std::move(out.geoms);
+		extent = out.extent;
+		if (zm & 1) addWarning("Z coordinates ignored");
+		if (zm & 2) addWarning("M coordinates ignored");
+	}
+	if (getatts) {
+		df = d;
+	}
+	return true;
+}
+
+#endif
+
+
 bool SpatVector::read_ogr(GDALDataset *&poDS, std::string layer, std::string query, std::vector<double> ext, SpatVector filter, bool as_proxy, std::string what, std::string dialect) {
 
 	if (poDS == NULL) {
@@ -610,6 +831,16 @@ bool SpatVector::read_ogr(GDALDataset *&poDS, std::string layer, std::string que
 		CPLFree(psz);
 	}
 
+#if GDAL_VERSION_NUM >= 3060000
+	if ((!as_proxy) && read_ogr_arrow(poLayer, what)) {
+		source_layer = poLayer->GetName();
+		if (!query.empty()) {
+			poDS->ReleaseResultSet(poLayer);
+		}
+		return true;
+	}
+#endif
+
 	if (what != "geoms") { 
 		df = readAttributes(poLayer, as_proxy);
 	}
@@ -849,6 +1080,163 @@ bool SpatVector::read(std::string fname, std::string layer, std::string query, s
 	return success;
 }
 
+// A page of a proxy: the features with the first vertex of their geometry in
+// the tile [xmin, xmax) x [ymin, ymax). The tile is closed on the sides that
+// touch the edge of the extent of the layer (or of the extent used to create
+// the proxy). A set of tiles that covers the layer returns each feature (with
+// a geometry) exactly once. A feature intersects with the tile that has its
+// first vertex, so the tile itself is used as spatial filter, and no more
+// features are read than counted by count_features. With two "fids", only
+// the features with a FID in [fids[0], fids[1]) are read (see fid_breaks)
+SpatVector SpatVectorProxy::read_page(std::vector<double> tile, std::vector<double> fids) {
+	SpatVector out;
+	if (tile.size() != 4) {
+		out.setError("tile should have four values");
+		return out;
+	}
+	SpatVector filter;
+	if (fids.size() == 2) {
+		if (!v.read_query.empty()) {
+			out.setError("cannot read pages by FID from a query");
+			return out;
+		}
+		GDALDataset *poDS = static_cast<GDALDataset*>(GDALOpenEx(v.source.c_str(), GDAL_OF_VECTOR, NULL, NULL, NULL));
+		if (poDS == NULL) {
+			out.setError("cannot open " + v.source);
+			return out;
+		}
+		OGRLayer *poLayer = open_proxy_layer(poDS, v);
+		if (poLayer == NULL) {
+			close_proxy_layer(poDS, poLayer, v);
+			out.setError("cannot open layer " + v.source_layer);
+			return out;
+		}
+		std::string fid = poLayer->GetFIDColumn();
+		if (fid.empty()) fid = "FID";
+		std::string where = fid + " >= " + std::to_string((long long) fids[0]) + " AND " + fid + " < " + std::to_string((long long) fids[1]);
+		if (poLayer->SetAttributeFilter(where.c_str()) != OGRERR_NONE) {
+			close_proxy_layer(poDS, poLayer, v);
+			out.setError("cannot filter by FID");
+			return out;
+		}
+		// read_ogr gets the same layer, with the attribute filter
+		bool success = out.read_ogr(poDS, v.source_layer, "", tile, filter, false, "", "");
+		close_proxy_layer(poDS, poLayer, v);
+		if (!success) return out;
+	} else {
+		std::vector<std::string> options;
+		std::string layer = v.source_layer;
+		if (!v.read_query.empty()) layer = "";
+		if (!out.read(v.source, layer, v.read_query, tile, filter, false, "", "", options)) {
+			return out;
+		}
+	}
+	SpatExtent e = v.extent;
+	if (v.read_extent.size() == 4) {
+		e.xmax = std::min(e.xmax, v.read_extent[1]);
+		e.ymax = std::min(e.ymax, v.read_extent[3]);
+	}
+	bool rx = tile[1] >= e.xmax;
+	bool ty = tile[3] >= e.ymax;
+	std::vector<size_t> keep;
+	keep.reserve(out.size());
+	for (size_t i=0; i<out.size(); i++) {
+		const SpatGeom &g = out.geoms[i];
+		if (g.parts.empty() || g.parts[0].x.empty()) continue;
+		double x = g.parts[0].x[0];
+		double y = g.parts[0].y[0];
+		bool inx = (x >= tile[0]) && ((x < tile[1]) || (rx && (x <= tile[1])));
+		bool iny = (y >= tile[2]) && ((y < tile[3]) || (ty && (y <= tile[3])));
+		if (inx && iny) keep.push_back(i);
+	}
+	if (keep.size() < out.size()) {
+		out = out.subset_rows(keep);
+	}
+	out.source = v.source;
+	out.source_layer = v.source_layer;
+	return out;
+}
+
+
+// open the layer of a proxy (to be released with close_proxy_layer)
+OGRLayer *open_proxy_layer(GDALDataset *poDS, SpatVector &v) {
+	if (v.read_query.empty()) {
+		return v.source_layer.empty() ? poDS->GetLayer(0) : poDS->GetLayerByName(v.source_layer.c_str());
+	}
+	return poDS->ExecuteSQL(v.read_query.c_str(), NULL, NULL);
+}
+
+void close_proxy_layer(GDALDataset *poDS, OGRLayer *poLayer, SpatVector &v) {
+	if ((poLayer != NULL) && (!v.read_query.empty())) {
+		poDS->ReleaseResultSet(poLayer);
+	}
+	GDALClose(poDS);
+}
+
+
+// the number of features that intersect with the tile, or -1 if unknown.
+// This is the number of features read for its page
+double SpatVectorProxy::count_features(std::vector<double> tile) {
+	GDALDataset *poDS = static_cast<GDALDataset*>(GDALOpenEx(v.source.c_str(), GDAL_OF_VECTOR, NULL, NULL, NULL));
+	if (poDS == NULL) return -1;
+	OGRLayer *poLayer = open_proxy_layer(poDS, v);
+	double n = -1;
+	if (poLayer != NULL) {
+		if (tile.size() == 4) {
+			poLayer->SetSpatialFilterRect(tile[0], tile[2], tile[1], tile[3]);
+		}
+		n = poLayer->GetFeatureCount(TRUE);
+	}
+	close_proxy_layer(poDS, poLayer, v);
+	return n;
+}
+
+
+// FID breaks that split the features that intersect with a tile into groups
+// of at most "size" features. This is used for tiles that cannot be made
+// smaller by splitting them because they are covered by many (large or
+// identical) features. Group i has the FIDs in [out[i], out[i+1]).
+// Not available for a proxy made with a query
+std::vector<double> SpatVectorProxy::fid_breaks(std::vector<double> tile, double size) {
+	std::vector<double> out;
+	if ((!v.read_query.empty()) || (tile.size() != 4) || (size < 1)) return out;
+	GDALDataset *poDS = static_cast<GDALDataset*>(GDALOpenEx(v.source.c_str(), GDAL_OF_VECTOR, NULL, NULL, NULL));
+	if (poDS == NULL) return out;
+	OGRLayer *poLayer = open_proxy_layer(poDS, v);
+	if (poLayer == NULL) {
+		close_proxy_layer(poDS, poLayer, v);
+		return out;
+	}
+	// the attributes are not needed (the geometries are, for the spatial filter)
+	OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
+	char **ignored = NULL;
+	for (int i=0; i<poFDefn->GetFieldCount(); i++) {
+		ignored = CSLAddString(ignored, poFDefn->GetFieldDefn(i)->GetNameRef());
+	}
+	ignored = CSLAddString(ignored, "OGR_STYLE");
+	poLayer->SetIgnoredFields((const char **) ignored);
+	CSLDestroy(ignored);
+	poLayer->SetSpatialFilterRect(tile[0], tile[2], tile[1], tile[3]);
+	poLayer->ResetReading();
+	std::vector<long long> fids;
+	OGRFeature *poFeature;
+	while ((poFeature = poLayer->GetNextFeature()) != NULL) {
+		fids.push_back(poFeature->GetFID());
+		OGRFeature::DestroyFeature(poFeature);
+	}
+	poLayer->SetIgnoredFields(NULL);
+	close_proxy_layer(poDS, poLayer, v);
+	if (fids.empty()) return out;
+	std::sort(fids.begin(), fids.end());
+	size_t step = size;
+	for (size_t i=0; i<fids.size(); i+=step) {
+		out.push_back(fids[i]);
+	}
+	out.push_back(fids.back() + 1);
+	return out;
+}
+
+
 SpatVector SpatVector::fromDS(GDALDataset *poDS) {
 	SpatVector out, fvct;
 	std::vector<double> fext;
@@ -0,0 +1,661 @@
+// Copyright (c) 2018-2026  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+// Exchange of SpatDataFrame columns with the Arrow C Data Interface.
+// A SpatDataFrame is exported as a struct array with one child per column
+// (validity bitmaps, offset and data buffers for strings, dictionary encoded
+// factors). Each column is converted with a few large allocations instead of
+// one per value, and a range of rows can be exported without subsetting.
+// Arrow arrays (for example record batches from GDAL) can be appended to a
+// SpatDataFrame. The array offset is respected, so that a slice of an array
+// does not need to be materialized first. The values are copied into the
+// columns of the SpatDataFrame, which keeps its own (not Arrow) storage.
+// This is used to read (read_ogr.cpp) and write (write_ogr.cpp) vector
+// attributes in batches.
+
+#include "spatDataframe.h"
+#include "spatArrow.h"
+#include <cstring>
+#include <cmath>
+#include <unordered_map>
+#include <algorithm>
+
+
+class ArrowSchemaData {
+	public:
+		std::string format, name, metadata;
+		std::vector<ArrowSchema*> children;
+};
+
+class ArrowArrayData {
+	public:
+		std::vector<std::vector<uint8_t>> buffers;
+		std::vector<const void*> pointers;
+		std::vector<ArrowArray*> children;
+};
+
+
+static void release_schema(ArrowSchema *s) {
+	if (s->release == nullptr) return;
+	ArrowSchemaData *d = (ArrowSchemaData *) s->private_data;
+	for (size_t i=0; i<d->children.size(); i++) {
+		ArrowSchema *c = d->children[i];
+		if (c->release != nullptr) c->release(c);
+		delete c;
+	}
+	if (s->dictionary != nullptr) {
+		if (s->dictionary->release != nullptr) s->dictionary->release(s->dictionary);
+		delete s->dictionary;
+	}
+	delete d;
+	s->release = nullptr;
+}
+
+static void release_array(ArrowArray *a) {
+	if (a->release == nullptr) return;
+	ArrowArrayData *d = (ArrowArrayData *) a->private_data;
+	for (size_t i=0; i<d->children.size(); i++) {
+		ArrowArray *c = d->children[i];
+		if (c->release != nullptr) c->release(c);
+		delete c;
+	}
+	if (a->dictionary != nullptr) {
+		if (a->dictionary->release != nullptr) a->dictionary->release(a->dictionary);
+		delete a->dictionary;
+	}
+	delete d;
+	a->release = nullptr;
+}
+
+
+static void init_schema(ArrowSchema *s, std::string format, std::string name, int64_t flags) {
+	ArrowSchemaData *d = new ArrowSchemaData;
+	d->format = format;
+	d->name = name;
+	s->format = d->format.c_str();
+	s->name = d->name.c_str();
+	s->metadata = nullptr;
+	s->flags = flags;
+	s->n_children = 0;
+	s->children = nullptr;
+	s->dictionary = nullptr;
+	s->release = &release_schema;
+	s->private_data = d;
+}
+
+// nb is the number of buffers
+static ArrowArrayData* init_array(ArrowArray *a, size_t length, size_t nb) {
+	ArrowArrayData *d = new ArrowArrayData;
+	d->buffers.resize(nb);
+	d->pointers.resize(nb, nullptr);
+	a->length = length;
+	a->null_count = 0;
+	a->offset = 0;
+	a->n_buffers = nb;
+	a->n_children = 0;
+	a->buffers = d->pointers.data();
+	a->children = nullptr;
+	a->dictionary = nullptr;
+	a->release = &release_array;
+	a->private_data = d;
+	return d;
+}
+
+// set the buffer pointers after the buffers are filled
+static void set_buffers(ArrowArray *a, ArrowArrayData *d) {
+	for (size_t i=0; i<d->buffers.size(); i++) {
+		d->pointers[i] = d->buffers[i].empty() ? nullptr : d->buffers[i].data();
+	}
+}
+
+
+class BitWriter {
+	public:
+		std::vector<uint8_t> &b;
+		BitWriter(std::vector<uint8_t> &_b, size_t n) : b(_b) {
+			b.resize((n + 7) / 8, 0);
+		}
+		void set(size_t i) {
+			b[i >> 3] |= (uint8_t)(1 << (i & 7));
+		}
+};
+
+// isna(i) tells if value i is missing
+template <typename F>
+static void make_validity(ArrowArray *a, ArrowArrayData *d, size_t n, F isna) {
+	size_t nulls = 0;
+	for (size_t i=0; i<n; i++) {
+		if (isna(i)) nulls++;
+	}
+	a->null_count = nulls;
+	if (nulls == 0) return;
+	BitWriter w(d->buffers[0], n);
+	for (size_t i=0; i<n; i++) {
+		if (!isna(i)) w.set(i);
+	}
+}
+
+template <typename T>
+static void fill_buffer(std::vector<uint8_t> &b, const T *x, size_t n) {
+	b.resize(n * sizeof(T));
+	if (n > 0) std::memcpy(b.data(), x, n * sizeof(T));
+}
+
+
+static void export_strings(ArrowSchema *s, ArrowArray *a, const std::vector<std::string> &x, size_t start, size_t n, const std::string &NAS) {
+	size_t nchar = 0;
+	for (size_t i=start; i<(start+n); i++) {
+		if (x[i] != NAS) nchar += x[i].size();
+	}
+	bool large = nchar > (size_t)INT32_MAX;
+	// a string literal, no need to keep it in the ArrowSchemaData
+	s->format = large ? "U" : "u";
+	ArrowArrayData *d = init_array(a, n, 3);
+	make_validity(a, d, n, [&](size_t i) { return x[start+i] == NAS; });
+	if (large) {
+		d->buffers[1].resize((n + 1) * sizeof(int64_t));
+	} else {
+		d->buffers[1].resize((n + 1) * sizeof(int32_t));
+	}
+	d->buffers[2].resize(nchar);
+	int64_t off = 0;
+	for (size_t i=0; i<n; i++) {
+		if (large) {
+			((int64_t*)d->buffers[1].data())[i] = off;
+		} else {
+			((int32_t*)d->buffers[1].data())[i] = off;
+		}
+		const std::string &si = x[start+i];
+		if (si != NAS) {
+			if (!si.empty()) std::memcpy(d->buffers[2].data() + off, si.data(), si.size());
+			off += si.size();
+		}
+	}
+	if (large) {
+		((int64_t*)d->buffers[1].data())[n] = off;
+	} else {
+		((int32_t*)d->buffers[1].data())[n] = off;
+	}
+	set_buffers(a, d);
+	// an empty data buffer is allowed, but some consumers want a valid pointer
+	if (d->pointers[2] == nullptr) d->pointers[2] = d->buffers[1].data();
+}
+
+
+void SpatDataFrame::export_column(size_t j, ArrowSchema *s, ArrowArray *a, size_t start, size_t n, bool dictionary) {
+
+	size_t p = iplace[j];
+	int64_t flags = ARROW_FLAG_NULLABLE;
+	switch (itype[j]) {
+		case 0: {
+			init_schema(s, "g", names[j], flags);
+			ArrowArrayData *d = init_array(a, n, 2);
+			const double *x = dv[p].data() + start;
+			make_validity(a, d, n, [&](size_t i) { return std::isnan(x[i]); });
+			fill_buffer(d->buffers[1], x, n);
+			set_buffers(a, d);
+			break;
+		}
+		case 1: {
+			init_schema(s, "l", names[j], flags);
+			ArrowArrayData *d = init_array(a, n, 2);
+			const long *x = iv[p].data() + start;
+			make_validity(a, d, n, [&](size_t i) { return x[i] == NAL; });
+			// long is not 64 bits on all platforms
+			std::vector<int64_t> y(x, x + n);
+			fill_buffer(d->buffers[1], y.data(), n);
+			set_buffers(a, d);
+			break;
+		}
+		case 2: {
+			init_schema(s, "u", names[j], flags);
+			export_strings(s, a, sv[p], start, n, NAS);
+			break;
+		}
+		case 3: {
+			init_schema(s, "b", names[j], flags);
+			ArrowArrayData *d = init_array(a, n, 2);
+			const int8_t *x = bv[p].data() + start;
+			make_validity(a, d, n, [&](size_t i) { return x[i] > 1; });
+			BitWriter w(d->buffers[1], n);
+			for (size_t i=0; i<n; i++) {
+				if (x[i] == 1) w.set(i);
+			}
+			set_buffers(a, d);
+			break;
+		}
+		case 4: {
+			bool days = tv[p].step == "days";
+			std::string fmt = days ? "tdD" : ("tss:" + tv[p].zone);
+			init_schema(s, fmt, names[j], flags);
+			ArrowArrayData *d = init_array(a, n, 2);
+			const SpatTime_t *x = tv[p].x.data() + start;
+			make_validity(a, d, n, [&](size_t i) { return x[i] == NAT; });
+			if (days) {
+				std::vector<int32_t> y(n, 0);
+				for (size_t i=0; i<n; i++) {
+					if (x[i] != NAT) y[i] = std::floor(x[i] / 86400.0);
+				}
+				fill_buffer(d->buffers[1], y.data(), n);
+			} else {
+				std::vector<int64_t> y(x, x + n);
+				fill_buffer(d->buffers[1], y.data(), n);
+			}
+			set_buffers(a, d);
+			break;
+		}
+		default: {
+			// dictionary encoded. The values of a SpatFactor are 1-based, 0 is NA
+			SpatFactor &f = fv[p];
+			if (!dictionary) {
+				init_schema(s, "u", names[j], flags);
+				std::vector<std::string> labs(n, NAS);
+				for (size_t i=0; i<n; i++) {
+					size_t k = f.v[start+i];
+					if ((k > 0) && (k <= f.labels.size())) labs[i] = f.labels[k-1];
+				}
+				export_strings(s, a, labs, 0, n, NAS);
+				break;
+			}
+			if (f.ordered) flags |= ARROW_FLAG_DICTIONARY_ORDERED;
+			init_schema(s, "i", names[j], flags);
+			ArrowArrayData *d = init_array(a, n, 2);
+			const size_t *x = f.v.data() + start;
+			size_t nlab = f.labels.size();
+			make_validity(a, d, n, [&](size_t i) { return (x[i] == 0) || (x[i] > nlab); });
+			std::vector<int32_t> y(n, 0);
+			for (size_t i=0; i<n; i++) {
+				if ((x[i] > 0) && (x[i] <= nlab)) y[i] = x[i] - 1;
+			}
+			fill_buffer(d->buffers[1], y.data(), n);
+			set_buffers(a, d);
+			s->dictionary = new ArrowSchema;
+			init_schema(s->dictionary, "u", "", 0);
+			a->dictionary = new ArrowArray;
+			export_strings(s->dictionary, a->dictionary, f.labels, 0, nlab, NAS);
+		}
+	}
+}
+
+
+bool SpatDataFrame::to_arrow(ArrowSchema *schema, ArrowArray *array, size_t start, size_t n, bool dictionary) {
+	size_t nr = nrow();
+	if (start > nr) {
+		setError("invalid start row");
+		return false;
+	}
+	n = std::min(n, nr - start);
+	size_t nc = ncol();
+
+	init_schema(schema, "+s", "", 0);
+	ArrowSchemaData *sd = (ArrowSchemaData *) schema->private_data;
+	ArrowArrayData *ad = init_array(array, n, 1);
+	sd->children.resize(nc);
+	ad->children.resize(nc);
+	for (size_t j=0; j<nc; j++) {
+		sd->children[j] = new ArrowSchema;
+		ad->children[j] = new ArrowArray;
+		export_column(j, sd->children[j], ad->children[j], start, n, dictionary);
+	}
+	schema->n_children = nc;
+	schema->children = sd->children.data();
+	array->n_children = nc;
+	array->children = ad->children.data();
+	return true;
+}
+
+
+// change the name of an exported column
+void arrow_set_name(ArrowSchema *s, const std::string &name) {
+	ArrowSchemaData *d = (ArrowSchemaData *) s->private_data;
+	d->name = name;
+	s->name = d->name.c_str();
+}
+
+
+// add a binary column, for example with WKB geometries, to an exported struct
+// array. "offsets" has n+1 values. The buffers are moved, not copied.
+// "extension" is an Arrow extension name such as "ogc.wkb" (or empty)
+void arrow_add_binary(ArrowSchema *schema, ArrowArray *array, const std::string &name, std::vector<uint8_t> &data, std::vector<int64_t> &offsets, std::vector<bool> &isna, const std::string &extension) {
+
+	size_t n = offsets.size() - 1;
+	bool large = offsets[n] > INT32_MAX;
+	ArrowSchema *s = new ArrowSchema;
+	init_schema(s, large ? "Z" : "z", name, ARROW_FLAG_NULLABLE);
+	if (!extension.empty()) {
+		// the metadata are key/value pairs preceded by their lengths
+		std::string key = "ARROW:extension:name";
+		std::string md;
+		int32_t k = 1;
+		md.append((const char *) &k, 4);
+		k = key.size();
+		md.append((const char *) &k, 4);
+		md += key;
+		k = extension.size();
+		md.append((const char *) &k, 4);
+		md += extension;
+		ArrowSchemaData *sd = (ArrowSchemaData *) s->private_data;
+		sd->metadata = md;
+		s->metadata = sd->metadata.data();
+	}
+	ArrowArray *a = new ArrowArray;
+	ArrowArrayData *d = init_array(a, n, 3);
+	make_validity(a, d, n, [&](size_t i) { return (bool) isna[i]; });
+	if (large) {
+		fill_buffer(d->buffers[1], offsets.data(), n+1);
+	} else {
+		std::vector<int32_t> o(offsets.begin(), offsets.end());
+		fill_buffer(d->buffers[1], o.data(), n+1);
+	}
+	d->buffers[2] = std::move(data);
+	set_buffers(a, d);
+	if (d->pointers[2] == nullptr) d->pointers[2] = d->buffers[1].data();
+
+	ArrowSchemaData *sd = (ArrowSchemaData *) schema->private_data;
+	ArrowArrayData *ad = (ArrowArrayData *) array->private_data;
+	sd->children.push_back(s);
+	ad->children.push_back(a);
+	schema->n_children = sd->children.size();
+	schema->children = sd->children.data();
+	array->n_children = ad->children.size();
+	array->children = ad->children.data();
+}
+
+
+// the SpatDataFrame type for an Arrow format; -1 if not supported
+static int arrow_dtype(const ArrowSchema *s) {
+	if (s->dictionary != nullptr) {
+		std::string df = s->dictionary->format;
+		if ((df == "u") || (df == "U")) return 5;
+		return -1;
+	}
+	std::string f = s->format;
+	if ((f == "g") || (f == "f")) return 0;
+	if ((f == "c") || (f == "C") || (f == "s") || (f == "S") || (f == "i") || (f == "I") || (f == "l") || (f == "L")) return 1;
+	if ((f == "u") || (f == "U")) return 2;
+	if (f == "b") return 3;
+	if ((f == "tdD") || (f == "tdm")) return 4;
+	if ((f.size() > 3) && (f.substr(0, 2) == "ts")) return 4;
+	return -1;
+}
+
+// integer value i of an integer array with format f
+static int64_t arrow_int(const ArrowArray *a, char f, int64_t i) {
+	const void *b = a->buffers[1];
+	i += a->offset;
+	switch (f) {
+		case 'c': return ((const int8_t*)b)[i];
+		case 'C': return ((const uint8_t*)b)[i];
+		case 's': return ((const int16_t*)b)[i];
+		case 'S': return ((const uint16_t*)b)[i];
+		case 'i': return ((const int32_t*)b)[i];
+		case 'I': return ((const uint32_t*)b)[i];
+		case 'L': return ((const uint64_t*)b)[i];
+		default: return ((const int64_t*)b)[i];
+	}
+}
+
+// string value i of a "u" or "U" array
+static std::string arrow_string(const ArrowArray *a, bool large, int64_t i) {
+	i += a->offset;
+	const char *data = (const char *) a->buffers[2];
+	int64_t b, e;
+	if (large) {
+		const int64_t *o = (const int64_t *) a->buffers[1];
+		b = o[i];
+		e = o[i+1];
+	} else {
+		const int32_t *o = (const int32_t *) a->buffers[1];
+		b = o[i];
+		e = o[i+1];
+	}
+	return std::string(data + b, e - b);
+}
+
+static double time_factor(const std::string &f) {
+	if (f == "tdD") return 86400;
+	if (f == "tdm") return 0.001;
+	char u = f[2];
+	if (u == 'm') return 0.001;
+	if (u == 'u') return 1e-6;
+	if (u == 'n') return 1e-9;
+	return 1;
+}
+
+
+bool SpatDataFrame::append_column(size_t j, const ArrowSchema *s, const ArrowArray *a) {
+
+	size_t n = a->length;
+	size_t p = iplace[j];
+	bool hasna = a->null_count != 0;
+	std::string f = s->format;
+	switch (itype[j]) {
+		case 0: {
+			std::vector<double> &x = dv[p];
+			x.reserve(x.size() + n);
+			if (arrow_dtype(s) == 1) {
+				for (size_t i=0; i<n; i++) {
+					x.push_back((!hasna || arrow_valid(a, i)) ? (double) arrow_int(a, f[0], i) : NAN);
+				}
+			} else if (f == "g") {
+				const double *b = (const double *)a->buffers[1] + a->offset;
+				if (hasna) {
+					for (size_t i=0; i<n; i++) x.push_back(arrow_valid(a, i) ? b[i] : NAN);
+				} else {
+					x.insert(x.end(), b, b + n);
+				}
+			} else {
+				const float *b = (const float *)a->buffers[1] + a->offset;
+				for (size_t i=0; i<n; i++) {
+					x.push_back((!hasna || arrow_valid(a, i)) ? b[i] : NAN);
+				}
+			}
+			break;
+		}
+		case 1: {
+			std::vector<long> &x = iv[p];
+			x.reserve(x.size() + n);
+			for (size_t i=0; i<n; i++) {
+				x.push_back((!hasna || arrow_valid(a, i)) ? (long) arrow_int(a, f[0], i) : NAL);
+			}
+			break;
+		}
+		case 2: {
+			std::vector<std::string> &x = sv[p];
+			x.reserve(x.size() + n);
+			if (s->dictionary != nullptr) {
+				const ArrowArray *da = a->dictionary;
+				bool large = std::string(s->dictionary->format) == "U";
+				for (size_t i=0; i<n; i++) {
+					int64_t k = (hasna && !arrow_valid(a, i)) ? -1 : arrow_int(a, f[0], i);
+					if ((k < 0) || (k >= da->length) || ((da->null_count != 0) && !arrow_valid(da, k))) {
+						x.push_back(NAS);
+					} else {
+						x.push_back(arrow_string(da, large, k));
+					}
+				}
+			} else {
+				bool large = f == "U";
+				for (size_t i=0; i<n; i++) {
+					if (hasna && !arrow_valid(a, i)) {
+						x.push_back(NAS);
+					} else {
+						x.push_back(arrow_string(a, large, i));
+					}
+				}
+			}
+			break;
+		}
+		case 3: {
+			std::vector<int8_t> &x = bv[p];
+			x.reserve(x.size() + n);
+			const uint8_t *b = (const uint8_t *) a->buffers[1];
+			for (size_t i=0; i<n; i++) {
+				if (hasna && !arrow_valid(a, i)) {
+					x.push_back(2);
+				} else {
+					size_t k = i + a->offset;
+					x.push_back((b[k >> 3] >> (k & 7)) & 1);
+				}
+			}
+			break;
+		}
+		case 4: {
+			SpatTime_v &x = tv[p];
+			x.reserve(x.size() + n);
+			double tf = time_factor(f);
+			char ct = f == "tdD" ? 'i' : 'l';
+			for (size_t i=0; i<n; i++) {
+				if (hasna && !arrow_valid(a, i)) {
+					x.push_back(NAT);
+				} else {
+					x.push_back(std::floor(arrow_int(a, ct, i) * tf));
+				}
+			}
+			break;
+		}
+		default: {
+			// map the dictionary of this batch to the labels of the factor
+			SpatFactor &x = fv[p];
+			const ArrowArray *da = a->dictionary;
+			bool large = std::string(s->dictionary->format) == "U";
+			std::unordered_map<std::string, size_t> lab;
+			for (size_t i=0; i<x.labels.size(); i++) {
+				lab[x.labels[i]] = i + 1;
+			}
+			std::vector<size_t> code(da->length, 0);
+			for (int64_t i=0; i<da->length; i++) {
+				if ((da->null_count != 0) && !arrow_valid(da, i)) continue;
+				std::string si = arrow_string(da, large, i);
+				auto it = lab.find(si);
+				if (it == lab.end()) {
+					x.labels.push_back(si);
+					code[i] = x.labels.size();
+					lab[si] = code[i];
+				} else {
+					code[i] = it->second;
+				}
+			}
+			x.v.reserve(x.v.size() + n);
+			for (size_t i=0; i<n; i++) {
+				if (hasna && !arrow_valid(a, i)) {
+					x.v.push_back(0);
+				} else {
+					int64_t k = arrow_int(a, f[0], i);
+					x.v.push_back(((k >= 0) && (k < da->length)) ? code[k] : 0);
+				}
+			}
+			if (s->flags & ARROW_FLAG_DICTIONARY_ORDERED) x.ordered = true;
+		}
+	}
+	return true;
+}
+
+
+bool SpatDataFrame::from_arrow(const ArrowSchema *schema, const ArrowArray *array, std::vector<std::string> skip) {
+
+	if (std::string(schema->format) != "+s") {
+		setError("Arrow array is not a struct array");
+		return false;
+	}
+	if (schema->n_children != array->n_children) {
+		setError("Arrow schema and array do not match");
+		return false;
+	}
+	if ((array->null_count != 0) && (array->n_buffers > 0) && (array->buffers[0] != nullptr)) {
+		setError("cannot import a struct array with missing rows");
+		return false;
+	}
+
+	// the columns to use and their types
+	std::vector<size_t> use;
+	std::vector<int> types;
+	for (int64_t i=0; i<schema->n_children; i++) {
+		const ArrowSchema *s = schema->children[i];
+		std::string nm = s->name == nullptr ? "" : s->name;
+		if (std::find(skip.begin(), skip.end(), nm) != skip.end()) continue;
+		int dt = arrow_dtype(s);
+		if (dt < 0) {
+			addWarning("skipped column '" + nm + "' with unsupported Arrow type '" + s->format + "'");
+			continue;
+		}
+		use.push_back(i);
+		types.push_back(dt);
+	}
+
+	// when appending, integers can go to a numeric column and
+	// dictionary encoded values to a string column
+	bool create = ncol() == 0;
+	if (!create) {
+		bool same = use.size() == ncol();
+		for (size_t j=0; same && (j<use.size()); j++) {
+			int it = itype[j];
+			bool compatible = (types[j] == it) || ((types[j] == 1) && (it == 0)) || ((types[j] == 5) && (it == 2));
+			same = compatible && (names[j] == std::string(schema->children[use[j]]->name));
+		}
+		if (!same) {
+			setError("Arrow array does not have the same columns");
+			return false;
+		}
+	}
+
+	if (create) {
+		for (size_t j=0; j<use.size(); j++) {
+			const ArrowSchema *s = schema->children[use[j]];
+			add_column(types[j], std::string(s->name == nullptr ? "" : s->name));
+			if (types[j] == 4) {
+				std::string f = s->format;
+				if (f[1] == 'd') {
+					tv.back().step = "days";
+				} else {
+					tv.back().step = "seconds";
+					tv.back().zone = f.substr(4);
+				}
+			}
+		}
+	}
+
+	int64_t off = array->offset;
+	for (size_t j=0; j<use.size(); j++) {
+		// the offset and length of a (sliced) struct array apply to its children
+		ArrowArray a = *(array->children[use[j]]);
+		if ((off > 0) || (a.length != array->length)) {
+			a.offset += off;
+			a.length = array->length;
+			a.null_count = -1;
+		}
+		append_column(j, schema->children[use[j]], &a);
+	}
+	return true;
+}
+
+
+// a copy of n rows, starting at row "start", through the Arrow C Data
+// Interface (to test the export and import from R)
+SpatDataFrame SpatDataFrame::arrow_rows(size_t start, size_t n) {
+	SpatDataFrame out;
+	ArrowSchema schema;
+	ArrowArray array;
+	if (!to_arrow(&schema, &array, start, n, true)) {
+		out.setError(getError());
+		return out;
+	}
+	out.from_arrow(&schema, &array);
+	array.release(&array);
+	schema.release(&schema);
+	return out;
+}
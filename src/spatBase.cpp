@@ -41,6 +41,9 @@ SpatOptions::SpatOptions(const SpatOptions &opt) {
 	verbose = opt.verbose;
 	def_verbose = opt.def_verbose;
 	statistics = opt.statistics;
+	histogram = opt.histogram;
+	write_async = opt.write_async;
+	overviews = opt.overviews;
 	steps = opt.steps;
 	minrows = opt.minrows;
 	names = opt.names;
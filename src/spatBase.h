@@ -32,6 +32,11 @@
   #define useGDAL
 #endif
 
+// parallel processing with Intel TBB (see terraOptions(parallel=TRUE))
+#if defined(HAVE_TBB) && !defined(__APPLE__)
+  #define USE_TBB
+#endif
+
 
 /*
 #ifdef useGDAL
@@ -136,6 +141,9 @@ class SpatOptions {
 		bool verbose = false;
 		//bool append = false;
 		int statistics = 1;
+		size_t histogram = 0;
+		bool write_async = false;
+		double overviews = 0;
 		bool datatype_set = false;
 		//bool ncdfcopy = false;
 		unsigned char value_type = 0;
@@ -131,32 +131,34 @@ SpatDataFrame SpatDataFrame::subset_rows(std::vector<size_t> range) {
 	out.bv.resize(bv.size());
 	out.tv.resize(tv.size());
 	out.fv.resize(fv.size());
-	out.reserve(r.size());
 
-	for (size_t i=0; i < r.size(); i++) {
-		for (size_t j=0; j < dv.size(); j++) {
-			out.dv[j].push_back(dv[j][r[i]]);
-		}
-		for (size_t j=0; j < iv.size(); j++) {
-			out.iv[j].push_back(iv[j][r[i]]);
-		}
-		for (size_t j=0; j < sv.size(); j++) {
-			out.sv[j].push_back(sv[j][r[i]]);
-		}
-		for (size_t j=0; j < bv.size(); j++) {
-			out.bv[j].push_back(bv[j][r[i]]);
-		}
-		for (size_t j=0; j < fv.size(); j++) {
-			out.fv[j].v.push_back(fv[j].v[r[i]]);
-		}
-		for (size_t j=0; j < tv.size(); j++) {
-			out.tv[j].x.push_back(tv[j].x[r[i]]);
-		}
+	// one column at a time
+	size_t nr = r.size();
+	for (size_t j=0; j < dv.size(); j++) {
+		out.dv[j].resize(nr);
+		for (size_t i=0; i < nr; i++) out.dv[j][i] = dv[j][r[i]];
+	}
+	for (size_t j=0; j < iv.size(); j++) {
+		out.iv[j].resize(nr);
+		for (size_t i=0; i < nr; i++) out.iv[j][i] = iv[j][r[i]];
+	}
+	for (size_t j=0; j < sv.size(); j++) {
+		out.sv[j].resize(nr);
+		for (size_t i=0; i < nr; i++) out.sv[j][i] = sv[j][r[i]];
+	}
+	for (size_t j=0; j < bv.size(); j++) {
+		out.bv[j].resize(nr);
+		for (size_t i=0; i < nr; i++) out.bv[j][i] = bv[j][r[i]];
 	}
 	for (size_t j=0; j < fv.size(); j++) {
+		out.fv[j].v.resize(nr);
+		for (size_t i=0; i < nr; i++) out.fv[j].v[i] = fv[j].v[r[i]];
 		out.fv[j].labels = fv[j].labels;
+		out.fv[j].ordered = fv[j].ordered;
 	}
 	for (size_t j=0; j < tv.size(); j++) {
+		out.tv[j].x.resize(nr);
+		for (size_t i=0; i < nr; i++) out.tv[j].x[i] = tv[j].x[r[i]];
 		out.tv[j].step = tv[j].step;
 		out.tv[j].zone = tv[j].zone;
 	}
@@ -28,6 +28,9 @@
 #include <cstdint>
 #include <limits>
 
+struct ArrowSchema;
+struct ArrowArray;
+
 class SpatDataFrame {
 	public:
 		SpatDataFrame();
@@ -141,6 +144,13 @@ class SpatDataFrame {
 		size_t strwidth(size_t i);
 
 		SpatDataFrame sortby(std::string field, bool descending);
+
+		// Arrow C Data Interface (spatArrow.cpp)
+		bool to_arrow(ArrowSchema *schema, ArrowArray *array, size_t start=0, size_t n=std::numeric_limits<size_t>::max(), bool dictionary=true);
+		bool from_arrow(const ArrowSchema *schema, const ArrowArray *array, std::vector<std::string> skip = {});
+		void export_column(size_t j, ArrowSchema *s, ArrowArray *a, size_t start, size_t n, bool dictionary);
+		bool append_column(size_t j, const ArrowSchema *s, const ArrowArray *a);
+		SpatDataFrame arrow_rows(size_t start, size_t n);
 };
 
 #endif //SPATDATAFRAME_GUARD
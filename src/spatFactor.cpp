@@ -144,7 +144,7 @@ std::vector<std::string> SpatFactor::getLabels() {
 	out.reserve(n);
 
 	for (size_t i=0; i<n; i++) {
-		if (v[i] < m) {
+		if ((v[i] > 0) && (v[i] < m)) {
 			out.push_back(labels[v[i]-1]);
 		} else {
 			out.push_back("");
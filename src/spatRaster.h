@@ -17,7 +17,9 @@
 
 #include <fstream>
 #include <numeric>
+#include <memory>
 #include "spatVector.h"
+#include "spatWriteQueue.h"
 
 #ifdef useGDAL
 #include "gdal_priv.h"
@@ -50,6 +52,8 @@ class SpatWindow {
 
 
 
+// a cache of decoded chunks of a multidimensional array (see gdal_multidimensional.cpp)
+class MDChunkCache;
 
 class SpatRasterSource {
     private:
@@ -91,6 +95,9 @@ class SpatRasterSource {
 		std::vector<size_t> m_size;
 		std::vector<size_t> m_order;
 		std::vector<size_t> m_subset;
+		// the chunk size of each dimension of the array (0 if not chunked)
+		std::vector<size_t> m_blocksize;
+		std::shared_ptr<MDChunkCache> m_cache;
 		bool m_hasNA = false;
 		double m_missing_value;
 		
@@ -185,6 +192,61 @@ class SpatRasterSource {
 };
 
 
+// running statistics of the values of a layer that is being written
+class SpatBandStats {
+	public:
+		virtual ~SpatBandStats(){}
+		double n = 0;
+		double mean = 0;
+		double m2 = 0;
+		double min = NAN;
+		double max = NAN;
+		// the number of infinite values (not included in n, mean and m2)
+		double ninf = 0;
+		// optional histogram with a range that grows as needed
+		std::vector<uint64_t> hist;
+		double hmin = NAN;
+		double hwidth = 0;
+
+		void init(size_t nbins);
+		void add(const std::vector<double> &v, size_t start, size_t end, double lmin, double lmax, double exclude, bool isint, bool isflt4, bool &outrange);
+		double sd();
+		double hmax() { return hmin + hist.size() * hwidth; }
+	private:
+		void grow(double vmin, double vmax);
+};
+
+
+// overview levels (factors 2, 4, 8, ...) computed from rows of values 
+// as they are written, from the top to the bottom of the raster
+class SpatOverviews {
+	public:
+		virtual ~SpatOverviews(){}
+		bool valid = false;
+		std::vector<size_t> ncol, nrow;
+		// rows completed by the last call to add or finish, for each level
+		std::vector<std::vector<double>> out;
+		std::vector<size_t> outrow, outnrow;
+
+		bool init(size_t nr, size_t nc, size_t nl, size_t minsize, bool nearest);
+		std::vector<int> factors();
+		bool add(const std::vector<double> &v, size_t startrow, size_t nrows);
+		bool complete() { return valid && (nextrow == inrow); }
+	private:
+		size_t nlyr = 0;
+		size_t inrow = 0;
+		size_t incol = 0;
+		size_t nextrow = 0;
+		bool nearest = false;
+		// unpaired row of each level; sums and counts of the cells
+		std::vector<std::vector<double>> psum, pcnt;
+		std::vector<bool> pending;
+		void add_level(size_t k, const std::vector<double> &s, const std::vector<double> &c, size_t nrows, size_t win, bool last);
+};
+
+
+class FlowTile;
+
 class BlockSize {
 	public:
 		virtual ~BlockSize(){}
@@ -204,6 +266,13 @@ class SpatRaster {
 		bool gdal_stats = false;
 		bool gdal_approx = true;
 		bool gdal_minmax = true;
+		std::vector<SpatBandStats> wstats;
+		bool stream_stats = true;
+		std::shared_ptr<SpatWriteQueue> wqueue;
+		SpatOverviews wovr;
+		std::string ovr_method;
+		double write_na = NAN;
+		bool write_hasNA = false;
 	protected:
 		SpatExtent window;
 
@@ -544,6 +613,7 @@ class SpatRaster {
 		bool fillValuesGDAL(double fillvalue);
 		bool writeValuesGDAL(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
 		bool writeStopGDAL();
+		void closeWriteGDAL();
 		
 		bool writeStartMulti(SpatOptions &opt, const std::vector<std::string> &srcnames);
 		bool writeValuesMulti(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
@@ -572,6 +642,7 @@ class SpatRaster {
 		// gdal source
 		std::vector<double> readValuesGDAL(size_t src, size_t row, size_t nrows, size_t col, size_t ncols, int lyr = -1);
 		std::vector<double> readGDALsample(size_t src, size_t srows, size_t scols, bool overview);
+		bool useOverview(double xres_out, double yres_out, std::string method, bool aligned, SpatRaster &out, size_t &fx, size_t &fy, SpatOptions &opt);
 
 		void readRowColGDAL(size_t src, std::vector<std::vector<double>> &out, size_t outstart, std::vector<int64_t> &rows, const std::vector<int64_t> &cols);
 
@@ -595,6 +666,7 @@ class SpatRaster {
 
 		SpatRaster writeRaster(SpatOptions &opt);
 		SpatRaster writeRasterM(SpatOptions &opt);
+		SpatRaster rechunk(std::vector<size_t> chunks, SpatOptions &opt);
 		SpatRaster writeTempRaster(SpatOptions &opt);
 		bool writeDelim(std::string filename, std::string delim, bool cell, bool xy, SpatOptions &opt);
 		bool update_meta(bool names, bool crs, bool ext, SpatOptions &opt);
@@ -702,6 +774,9 @@ class SpatRaster {
 		
 		SpatRaster clumps(int directions, bool zeroAsNA, SpatOptions &opt);
 		SpatRaster patches(size_t directions, SpatOptions &opt);
+		bool label_patches(size_t directions, bool values, bool zeroAsNA, double minsize, bool write, SpatRaster &out, SpatDataFrame &stats, SpatOptions &opt);
+		SpatRaster patches_uf(size_t directions, bool values, bool zeroAsNA, double minsize, SpatOptions &opt);
+		SpatDataFrame patch_stats(size_t directions, bool values, bool zeroAsNA, double minsize, SpatOptions &opt);
 
 
 		SpatRaster edges(bool classes, bool internal, std::string type, unsigned directions, double falseval, SpatOptions &opt);
@@ -731,6 +806,7 @@ class SpatRaster {
 		std::vector<double> focal_values(std::vector<unsigned> w, double fillvalue, int64_t row, int64_t nrows, SpatOptions &opt);
 		std::vector<std::vector<double>> freq(bool bylayer, bool round, int digits, SpatOptions &opt);
 		std::vector<size_t> count(double value, bool bylayer, bool round, int digits, SpatOptions &opt);
+		SpatDataFrame crosstab(int digits, bool narm, bool area, std::string unit, SpatOptions &opt);
 		
 		bool get_aggregate_dims(std::vector<size_t> &fact, std::string &message);
 		std::vector<size_t> get_aggregate_dims2(std::vector<size_t> fact);
@@ -814,6 +890,7 @@ class SpatRaster {
 		SpatRaster rasterize(SpatVector x, std::string field, std::vector<double> values, double background, bool touches, std::string fun, bool weights, bool update, bool minmax, SpatOptions &opt);
 		
 		SpatRaster rasterizeWindow(std::vector<double> x, std::vector<double> y, std::vector<double> z, std::string algo, std::vector<double> algops, SpatOptions &opt);
+		SpatRaster gridPoints(std::vector<double> x, std::vector<double> y, std::vector<double> z, std::string algo, std::vector<double> algops, SpatOptions &opt);
 
 		std::vector<std::vector<double>> win_circle(std::vector<double> x, std::vector<double> y, std::vector<double> z, std::vector<double> win, SpatOptions &opt);
 		std::vector<std::vector<double>> win_rect(std::vector<double> x, std::vector<double> y, std::vector<double> z, std::vector<double> win, SpatOptions &opt);
@@ -823,6 +900,7 @@ class SpatRaster {
 		SpatRaster rasterizeGeom(SpatVector x, std::string unit, std::string count, SpatOptions &opt);
 		SpatRaster rasterizePoints(std::vector<double>&x, std::vector<double> &y, std::string fun, std::vector<double> &values, bool narm, double background, SpatOptions &opt);
 		SpatRaster rasterizePoints(SpatVector &x, std::string fun, std::vector<double> &values, bool narm, double background, SpatOptions &opt);
+		SpatRaster rasterizePointStats(std::vector<double>&x, std::vector<double> &y, std::vector<std::string> funs, std::vector<double> &values, bool narm, double background, SpatOptions &opt);
 		void rasterizeCellsWeights(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v, SpatOptions &opt); 
 		void rasterizeCellsExact(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v, SpatOptions &opt); 
 		void rasterizeLinesLength(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v, SpatOptions &opt);
@@ -854,18 +932,26 @@ class SpatRaster {
 
 		SpatRaster scale(std::vector<double> center, bool docenter, std::vector<double> scale, bool doscale, SpatOptions &opt);
 		SpatRaster scale_linear(double smin, double smax, SpatOptions &opt);
+		SpatRaster lincomb(std::vector<double> m, std::vector<double> offset, SpatOptions &opt);
+		SpatRaster predict_model(std::string type, std::vector<double> model, bool narm, SpatOptions &opt);
 
 		SpatRaster similarity(std::vector<double> x, SpatOptions &opt);
 
-		SpatRaster terrain(std::vector<std::string> v, unsigned neighbors, bool degrees, unsigned seed, SpatOptions &opt);
+		SpatRaster terrain(std::vector<std::string> v, unsigned neighbors, bool degrees, double angle, double direction, unsigned seed, SpatOptions &opt);
 
     // watershed2 ecor 20210317; EC 20210702 
-		SpatRaster watershed2(int pp_offset,SpatOptions &opt); 
+		SpatRaster watershed2(double pp_offset,SpatOptions &opt); 
 		SpatRaster pitfinder2(SpatOptions &opt); 
 		SpatRaster NIDP2(SpatOptions &opt); 
 		SpatRaster flowAccu2(SpatOptions &opt); 
 		SpatRaster flowAccu2_weight(SpatRaster weight,SpatOptions &opt);
 	// END watershed2 
+		// out-of-core versions of the above (watershed_tiled.cpp)
+		bool flowInMemory(SpatOptions &opt);
+		bool readFlowTile(FlowTile &t, size_t row, size_t nrows);
+		SpatRaster flowAccuTiled(SpatRaster &weight, bool useweight, SpatOptions &opt);
+		SpatRaster NIDPTiled(SpatOptions &opt);
+		SpatRaster watershedTiled(int64_t pp, SpatOptions &opt);
 		
 		SpatRaster hillshade(SpatRaster aspect, std::vector<double> angle, std::vector<double> direction, bool normalize, SpatOptions &opt);
 
@@ -907,6 +993,8 @@ class SpatRaster {
 		SpatRaster weighted_mean(std::vector<double> w, bool narm, SpatOptions &opt);
 
 		SpatRaster warper(SpatRaster x, std::string crs, std::string method, bool mask, bool align, bool resample, SpatOptions &opt);
+		bool warp_native(SpatRaster &out, const std::string &srccrs, const std::string &method, SpatOptions &opt);
+		bool resample_aligned(SpatRaster &out, const std::string &method, SpatOptions &opt);
 		SpatRaster warper_by_util(SpatRaster x, std::string crs, std::string method, bool mask, bool align, bool resample, SpatOptions &opt);
 		
 		SpatRaster resample(SpatRaster x, std::string method, bool mask, bool agg, SpatOptions &opt);
@@ -926,6 +1014,7 @@ class SpatRaster {
 		SpatRaster hsx2rgb(SpatOptions &opt);	
 
 		SpatRaster viewshed(std::vector<double> obs, std::vector<double> vals, double curvcoef, int mode, double maxdist, int heightmode, SpatOptions &opt);
+		SpatRaster viewshed_multi(std::vector<double> x, std::vector<double> y, std::vector<double> observer, std::vector<double> target, double curvcoef, double maxdist, bool count, SpatOptions &opt);
 		SpatRaster sieveFilter(int threshold, int connections, SpatOptions &opt);	
 		
 //		SpatRaster panSharpen(SpatRaster pan, SpatOptions &opt);	
@@ -137,6 +137,8 @@ class SpatRasterCollection {
 		SpatRaster merge(bool first, bool narm, int algo, std::string method, SpatOptions &opt);
 		SpatRaster morph(SpatRaster &x, SpatOptions &opt);
 		SpatRaster mosaic(std::string fun, SpatOptions &opt);
+		bool aligned_with(SpatRaster &out, std::vector<size_t> &use, SpatOptions &opt);
+		SpatRaster mosaic_stream(SpatRaster &out, std::vector<size_t> &use, std::string fun, bool narm, SpatOptions &opt);
 		SpatRaster summary(std::string fun, SpatOptions &opt);
 		std::vector<size_t> dims();
 		std::vector<std::string> get_names();
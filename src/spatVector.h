@@ -231,6 +231,8 @@ class SpatVector {
 		GDALDataset* write_ogr(std::string filename, std::string lyrname, std::string driver, bool append, bool overwrite, std::vector<std::string> options);
 		GDALDataset* GDAL_ds();
 		bool read_ogr(GDALDataset *&poDS, std::string layer, std::string query, std::vector<double> ext, SpatVector filter, bool as_proxy, std::string what, std::string dialect);
+		bool read_ogr_arrow(OGRLayer *poLayer, std::string what);
+		size_t write_arrow_batches(GDALDataset *poDS, OGRLayer *poLayer, OGRwkbGeometryType wkb, size_t batch, std::string &msg);
 		SpatVector fromDS(GDALDataset *poDS);
 		bool ogr_geoms(std::vector<OGRGeometryH> &ogrgeoms, std::string &message);		
 		bool delete_layers(std::string filename, std::vector<std::string> layers, bool return_error);		
@@ -500,6 +502,9 @@ class SpatVectorProxy {
 		virtual ~SpatVectorProxy(){}
 		SpatVectorProxy deepCopy() {return *this;}
 		SpatVector query_filter(std::string query, std::vector<double> extent, SpatVector filter);
+		SpatVector read_page(std::vector<double> tile, std::vector<double> fids);
+		double count_features(std::vector<double> tile);
+		std::vector<double> fid_breaks(std::vector<double> tile, double size);
 };
 
 
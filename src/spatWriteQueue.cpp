@@ -0,0 +1,80 @@
+// Copyright (c) 2018-2026  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatWriteQueue.h"
+
+
+SpatWriteQueue::SpatWriteQueue(size_t n) {
+	maxjobs = n < 1 ? 1 : n;
+	worker = std::thread(&SpatWriteQueue::run, this);
+}
+
+
+SpatWriteQueue::~SpatWriteQueue() {
+	finish();
+}
+
+
+void SpatWriteQueue::run() {
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true) {
+		cv.wait(lock, [this]{ return stop || (!jobs.empty()); });
+		if (jobs.empty()) break;
+		std::function<bool()> job = std::move(jobs.front());
+		jobs.pop_front();
+		busy = true;
+		bool go = ok;
+		lock.unlock();
+		cv.notify_all();
+		bool success = go && job();
+		lock.lock();
+		busy = false;
+		if (!success) ok = false;
+		cv.notify_all();
+	}
+}
+
+
+bool SpatWriteQueue::push(std::function<bool()> job) {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [this]{ return jobs.size() < maxjobs; });
+	if ((!ok) || stop) return false;
+	jobs.push_back(std::move(job));
+	lock.unlock();
+	cv.notify_all();
+	return true;
+}
+
+
+bool SpatWriteQueue::wait() {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [this]{ return jobs.empty() && (!busy); });
+	return ok;
+}
+
+
+bool SpatWriteQueue::finish() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+	}
+	cv.notify_all();
+	if (worker.joinable()) {
+		worker.join();
+	}
+	return ok;
+}
@@ -0,0 +1,51 @@
+// Copyright (c) 2018-2026  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATWRITEQUEUE_GUARD
+#define SPATWRITEQUEUE_GUARD
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Runs write jobs, in order, on a background thread. At most "maxjobs" 
+// jobs can be waiting; push blocks until there is room.
+// After a job fails, the remaining jobs are discarded.
+class SpatWriteQueue {
+	public:
+		SpatWriteQueue(size_t maxjobs);
+		virtual ~SpatWriteQueue();
+
+		bool push(std::function<bool()> job);
+		bool wait();
+		bool finish();
+
+	private:
+		std::deque<std::function<bool()>> jobs;
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::thread worker;
+		size_t maxjobs;
+		bool busy = false;
+		bool stop = false;
+		bool ok = true;
+		void run();
+};
+
+#endif
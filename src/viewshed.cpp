@@ -0,0 +1,246 @@
+// Copyright (c) 2018-2026  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+// Viewshed for many observers (cumulative viewshed).
+// The elevation values are read into memory once and shared by all observers,
+// that are processed in parallel. For each observer, rays are cast to all
+// cells on the border of its window (the raster, or the square around the
+// observer that contains the cells within "maxdist"), as in the "R2" algorithm
+// of Franklin et al. (1994). Along a ray, a cell is visible if the slope of the
+// line from the observer to the target (on top of the cell) is at least as
+// steep as the steepest slope to the (interpolated) terrain between them.
+// A cell that is crossed by several rays is visible if it is visible along
+// any of them. The output is the number of observers that can see a cell.
+
+#include "spatRaster.h"
+#include <atomic>
+
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+
+class ViewshedGrid {
+	public:
+		const std::vector<double> *z;
+		size_t nr, nc;
+		double xr, yr;
+		double curv; // curvcoef / earth diameter
+		double maxdist;
+
+		double get(size_t r, size_t c) const {
+			return (*z)[r * nc + c];
+		}
+
+		// the cells visible from the observer at cell (r0, c0), in the window
+		// with rows r1 to r2 and columns c1 to c2 (inclusive)
+		void observe(size_t r0, size_t c0, double zo, double ht, size_t r1, size_t r2, size_t c1, size_t c2, std::vector<unsigned char> &vis) const {
+			size_t wc = c2 - c1 + 1;
+			vis[(r0 - r1) * wc + (c0 - c1)] = 1;
+			for (size_t c=c1; c<=c2; c++) {
+				ray(r0, c0, zo, ht, r1, c, r1, c1, wc, vis);
+				ray(r0, c0, zo, ht, r2, c, r1, c1, wc, vis);
+			}
+			for (size_t r=r1+1; r<r2; r++) {
+				ray(r0, c0, zo, ht, r, c1, r1, c1, wc, vis);
+				ray(r0, c0, zo, ht, r, c2, r1, c1, wc, vis);
+			}
+		}
+
+	private:
+		void ray(size_t r0, size_t c0, double zo, double ht, size_t re, size_t ce, size_t r1, size_t c1, size_t wc, std::vector<unsigned char> &vis) const {
+			double dr = (double)re - (double)r0;
+			double dc = (double)ce - (double)c0;
+			size_t n = std::max(std::fabs(dr), std::fabs(dc));
+			if (n == 0) return;
+			bool rmajor = std::fabs(dr) >= std::fabs(dc);
+			double maxslope = -INFINITY;
+			for (size_t k=1; k<=n; k++) {
+				double fr = r0 + dr * k / n;
+				double fc = c0 + dc * k / n;
+				size_t ri = std::lround(fr);
+				size_t ci = std::lround(fc);
+				double ddx = ((double)ci - (double)c0) * xr;
+				double ddy = ((double)ri - (double)r0) * yr;
+				double d2 = ddx * ddx + ddy * ddy;
+				if ((maxdist > 0) && (d2 > (maxdist * maxdist))) break;
+				double zt = get(ri, ci);
+				if (!std::isnan(zt)) {
+					zt -= curv * d2;
+					if ((zt + ht - zo) / std::sqrt(d2) >= maxslope) {
+						vis[(ri - r1) * wc + (ci - c1)] = 1;
+					}
+				}
+				// the terrain on the ray, interpolated between the two
+				// nearest cells in the direction of the minor axis
+				double zh;
+				if (rmajor) {
+					size_t a = std::floor(fc);
+					double w = fc - a;
+					zh = interpolate(get(ri, a), (w > 0) ? get(ri, a+1) : NAN, w);
+				} else {
+					size_t a = std::floor(fr);
+					double w = fr - a;
+					zh = interpolate(get(a, ci), (w > 0) ? get(a+1, ci) : NAN, w);
+				}
+				if (!std::isnan(zh)) {
+					ddx = (fc - c0) * xr;
+					ddy = (fr - r0) * yr;
+					double h2 = ddx * ddx + ddy * ddy;
+					maxslope = std::max(maxslope, (zh - curv * h2 - zo) / std::sqrt(h2));
+				}
+			}
+		}
+
+		static double interpolate(double a, double b, double w) {
+			if (std::isnan(b)) return a;
+			if (std::isnan(a)) return b;
+			return a * (1 - w) + b * w;
+		}
+};
+
+
+SpatRaster SpatRaster::viewshed_multi(std::vector<double> x, std::vector<double> y, std::vector<double> observer, std::vector<double> target, double curvcoef, double maxdist, bool count, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	out.setNames({"viewshed"});
+	if (could_be_lonlat()) {
+		out.setError("the method does not support lon/lat data");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("input raster has no values");
+		return out;
+	}
+	if (x.size() != y.size()) {
+		out.setError("the number of x and y coordinates is not the same");
+		return out;
+	}
+	if (observer.empty() || target.empty()) {
+		out.setError("observer and target heights cannot be empty");
+		return out;
+	}
+	if (nlyr() > 1) {
+		out.addWarning("viewshed is only done for the first layer");
+	}
+	if (!canProcessInMemory(opt)) {
+		out.setError("the raster is too large to compute a viewshed for many observers");
+		return out;
+	}
+
+	std::vector<double> z = getValues(0, opt);
+	if (hasError()) {
+		out.setError(getError());
+		return out;
+	}
+
+	ViewshedGrid g;
+	g.z = &z;
+	g.nr = nrow();
+	g.nc = ncol();
+	g.xr = xres();
+	g.yr = yres();
+	g.curv = curvcoef / (2 * 6378137.0);
+	g.maxdist = maxdist;
+	size_t nr = g.nr;
+	size_t nc = g.nc;
+	// window half-sizes
+	size_t hr = nr;
+	size_t hc = nc;
+	if (maxdist > 0) {
+		hr = std::min(nr, (size_t) std::ceil(maxdist / g.yr));
+		hc = std::min(nc, (size_t) std::ceil(maxdist / g.xr));
+	}
+
+	std::vector<int64_t> rows = rowFromY(y);
+	std::vector<int64_t> cols = colFromX(x);
+	size_t nobs = x.size();
+	size_t outside = 0;
+	for (size_t i=0; i<nobs; i++) {
+		if ((rows[i] < 0) || (cols[i] < 0)) outside++;
+	}
+	if (outside > 0) {
+		out.addWarning(std::to_string(outside) + " observer(s) outside the raster are ignored");
+	}
+
+	std::vector<std::atomic<uint32_t>> cnt(nr * nc);
+	auto do_obs = [&](size_t start, size_t end) {
+		std::vector<unsigned char> vis;
+		for (size_t i=start; i<end; i++) {
+			if ((rows[i] < 0) || (cols[i] < 0)) continue;
+			size_t r0 = rows[i];
+			size_t c0 = cols[i];
+			double zo = g.get(r0, c0);
+			if (std::isnan(zo)) continue;
+			zo += observer[i % observer.size()];
+			double ht = target[i % target.size()];
+			size_t r1 = r0 > hr ? r0 - hr : 0;
+			size_t r2 = std::min(nr - 1, r0 + hr);
+			size_t c1 = c0 > hc ? c0 - hc : 0;
+			size_t c2 = std::min(nc - 1, c0 + hc);
+			size_t wc = c2 - c1 + 1;
+			vis.resize(0);
+			vis.resize((r2 - r1 + 1) * wc, 0);
+			g.observe(r0, c0, zo, ht, r1, r2, c1, c2, vis);
+			for (size_t r=r1; r<=r2; r++) {
+				const unsigned char *v = &vis[(r - r1) * wc];
+				size_t off = r * nc + c1;
+				for (size_t c=0; c<wc; c++) {
+					if (v[c]) cnt[off + c].fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		}
+	};
+#if defined(USE_TBB)
+	if (opt.parallel && (nobs > 1)) {
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, nobs, 1),
+			[&](const tbb::blocked_range<size_t>& range) {
+			do_obs(range.begin(), range.end());
+		});
+	} else {
+		do_obs(0, nobs);
+	}
+#else
+	do_obs(0, nobs);
+#endif
+
+	if (!count) {
+		out.setValueType(3);
+	}
+	if (!out.writeStart(opt, filenames())) {
+		return out;
+	}
+	for (size_t i = 0; i < out.bs.n; i++) {
+		size_t off = out.bs.row[i] * nc;
+		size_t n = out.bs.nrows[i] * nc;
+		std::vector<double> v(n);
+		for (size_t j=0; j<n; j++) {
+			double c = cnt[off + j].load(std::memory_order_relaxed);
+			if (std::isnan(z[off + j])) {
+				v[j] = NAN;
+			} else if (count) {
+				v[j] = c;
+			} else {
+				v[j] = c > 0;
+			}
+		}
+		if (!out.writeBlock(v, i)) return out;
+	}
+	out.writeStop();
+	return out;
+}
@@ -0,0 +1,865 @@
+// Copyright (c) 2018-2026  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+// Native warping for methods "near", "bilinear", "cubic" and "average".
+// A warp plan has the location (in source pixel coordinates) of the nodes of
+// a grid over the target raster, with one node every "step" rows and columns.
+// Locations between the nodes are interpolated. Like the approximate
+// transformer of GDAL, a square of the grid is refined (all cell corners are
+// transformed) if the interpolated location of its center is off by more
+// than 0.125 source cells, or if a node cannot be transformed. Plans are
+// cached, such that the coordinates are only transformed once for all
+// layers and sources, and for repeated calls with the same source and target
+// geometry. The output is computed by chunks of rows; the source cells that
+// are needed for a chunk are read for all layers at once, and the rows are
+// computed in parallel.
+
+#include "spatRaster.h"
+#include "ram.h"
+#include "ogr_spatialref.h"
+#include <memory>
+#include <mutex>
+#include <list>
+#include <sstream>
+
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+
+class WarpPlan {
+	public:
+		size_t nr, nc;  // target rows and columns
+		size_t step;
+		size_t gr, gc;  // rows and columns of squares
+		size_t snr, snc; // source rows and columns
+		bool wrap;      // global lon/lat source
+		std::vector<double> sx, sy;   // node locations
+		std::vector<std::vector<double>> fx, fy; // cell corner locations of refined squares
+		std::vector<double> bb;  // for each square: xmin, xmax, ymin, ymax, and footprint
+
+		size_t width(size_t i) const {
+			return std::min(step, nc - i * step);
+		}
+		size_t height(size_t j) const {
+			return std::min(step, nr - j * step);
+		}
+
+		// the source pixel coordinates (x, y) of the target pixel coordinates (px, py)
+		void locate(double px, double py, double &x, double &y) const {
+			size_t i = std::min((size_t)(px / step), gc - 1);
+			size_t j = std::min((size_t)(py / step), gr - 1);
+			double u = px - (double)(i * step);
+			double v = py - (double)(j * step);
+			size_t sq = j * gc + i;
+			double x00, x01, x10, x11, y00, y01, y10, y11;
+			if (!fx[sq].empty()) {
+				size_t w = width(i);
+				size_t a = std::min((size_t)u, w - 1);
+				size_t b = std::min((size_t)v, height(j) - 1);
+				u -= a;
+				v -= b;
+				size_t k = b * (w + 1) + a;
+				const std::vector<double> &X = fx[sq];
+				const std::vector<double> &Y = fy[sq];
+				x00 = X[k]; x01 = X[k+1]; x10 = X[k+w+1]; x11 = X[k+w+2];
+				y00 = Y[k]; y01 = Y[k+1]; y10 = Y[k+w+1]; y11 = Y[k+w+2];
+			} else {
+				u /= width(i);
+				v /= height(j);
+				size_t k = j * (gc + 1) + i;
+				x00 = sx[k]; x01 = sx[k+1]; x10 = sx[k+gc+1]; x11 = sx[k+gc+2];
+				y00 = sy[k]; y01 = sy[k+1]; y10 = sy[k+gc+1]; y11 = sy[k+gc+2];
+			}
+			if (wrap) unwrap(x00, x01, x10, x11);
+			x = (x00 * (1-u) + x01 * u) * (1-v) + (x10 * (1-u) + x11 * u) * v;
+			y = (y00 * (1-u) + y01 * u) * (1-v) + (y10 * (1-u) + y11 * u) * v;
+		}
+
+		// make the locations of the corners of a cell or square continuous across the date line
+		void unwrap(double &a, double &b, double &c, double &d) const {
+			double mn = std::min(std::min(a, b), std::min(c, d));
+			double mx = std::max(std::max(a, b), std::max(c, d));
+			if ((mx - mn) > (snc / 2.0)) {
+				double h = (mn + mx) / 2;
+				if (a < h) a += snc;
+				if (b < h) b += snc;
+				if (c < h) c += snc;
+				if (d < h) d += snc;
+			}
+		}
+
+		// the range of the locations of target rows r0 to r1-1 (within one row of squares)
+		void bounds(size_t r0, size_t r1, double &xmin, double &xmax, double &ymin, double &ymax, double &foot) const {
+			size_t j = std::min(r0 / step, gr - 1);
+			for (size_t i=0; i<gc; i++) {
+				size_t sq = j * gc + i;
+				const double *B = &bb[sq * 5];
+				foot = std::max(foot, B[4]);
+				if (!fx[sq].empty()) {
+					xmin = std::min(xmin, B[0]);
+					xmax = std::max(xmax, B[1]);
+					ymin = std::min(ymin, B[2]);
+					ymax = std::max(ymax, B[3]);
+					continue;
+				}
+				// with bilinear interpolation, the extremes are at the corners
+				double x0 = i * step;
+				double x1 = x0 + width(i);
+				double px[4] = {x0, x1, x0, x1};
+				double py[4] = {(double)r0, (double)r0, (double)r1, (double)r1};
+				for (size_t q=0; q<4; q++) {
+					double x, y;
+					locate(px[q], py[q], x, y);
+					xmin = std::min(xmin, x);
+					xmax = std::max(xmax, x);
+					ymin = std::min(ymin, y);
+					ymax = std::max(ymax, y);
+				}
+			}
+		}
+
+		size_t memory() const {
+			size_t n = sx.size() * 2 + bb.size();
+			for (size_t i=0; i<fx.size(); i++) n += fx[i].size() * 2;
+			return n * sizeof(double);
+		}
+};
+
+
+// target pixel coordinates to source pixel coordinates
+class WarpTransform {
+	public:
+		double txmin, tymax, txres, tyres;
+		double sxmin, symax, sxres, syres;
+		OGRCoordinateTransformation *poCT = NULL;
+
+		void transform(std::vector<double> &x, std::vector<double> &y) {
+			for (size_t i=0; i<x.size(); i++) {
+				x[i] = txmin + x[i] * txres;
+				y[i] = tymax - y[i] * tyres;
+			}
+			if (poCT != NULL) {
+				std::vector<int> ok(x.size());
+				if (!poCT->Transform(x.size(), &x[0], &y[0], NULL, &ok[0])) {
+					for (size_t i=0; i<x.size(); i++) {
+						if (!ok[i]) {
+							x[i] = NAN;
+							y[i] = NAN;
+						}
+					}
+				}
+			}
+			for (size_t i=0; i<x.size(); i++) {
+				if (std::isfinite(x[i]) && std::isfinite(y[i])) {
+					x[i] = (x[i] - sxmin) / sxres;
+					y[i] = (symax - y[i]) / syres;
+				} else {
+					x[i] = NAN;
+					y[i] = NAN;
+				}
+			}
+		}
+};
+
+
+bool make_warp_plan(WarpPlan &p, WarpTransform &tr) {
+
+	size_t nr = p.nr;
+	size_t nc = p.nc;
+	p.gr = std::ceil(nr / (double)p.step);
+	p.gc = std::ceil(nc / (double)p.step);
+	size_t gr = p.gr;
+	size_t gc = p.gc;
+
+	// the nodes
+	std::vector<double> x, y;
+	x.reserve((gr+1) * (gc+1));
+	y.reserve((gr+1) * (gc+1));
+	for (size_t j=0; j<=gr; j++) {
+		double py = std::min(j * p.step, nr);
+		for (size_t i=0; i<=gc; i++) {
+			x.push_back(std::min(i * p.step, nc));
+			y.push_back(py);
+		}
+	}
+	tr.transform(x, y);
+	p.sx = std::move(x);
+	p.sy = std::move(y);
+	p.fx.resize(gr * gc);
+	p.fy.resize(gr * gc);
+
+	// the centers and the midpoints of the edges of the squares
+	size_t hc = 2 * gc + 1;
+	std::vector<double> cx, cy;
+	cx.reserve((2 * gr + 1) * hc);
+	cy.reserve((2 * gr + 1) * hc);
+	for (size_t j=0; j<=(2*gr); j++) {
+		double py = (j % 2) == 0 ? std::min(j / 2 * p.step, nr) : (j / 2) * p.step + p.height(j / 2) / 2.0;
+		for (size_t i=0; i<hc; i++) {
+			cx.push_back((i % 2) == 0 ? std::min(i / 2 * p.step, nc) : (i / 2) * p.step + p.width(i / 2) / 2.0);
+			cy.push_back(py);
+		}
+	}
+	std::vector<double> ex = cx, ey = cy;
+	tr.transform(ex, ey);
+
+	// refine the squares that are not accurate enough
+	for (size_t j=0; j<gr; j++) {
+		std::vector<size_t> refine;
+		for (size_t i=0; i<gc; i++) {
+			size_t mid = (2 * j + 1) * hc + 2 * i + 1;
+			std::vector<size_t> check = {mid, mid - hc, mid + hc, mid - 1, mid + 1};
+			for (size_t k : check) {
+				double ix, iy;
+				p.locate(cx[k], cy[k], ix, iy);
+				double dx = std::fabs(ix - ex[k]);
+				if (p.wrap) {
+					dx = std::fmod(dx, (double)p.snc);
+					dx = std::min(dx, p.snc - dx);
+				}
+				double dy = std::fabs(iy - ey[k]);
+				if (!((dx <= 0.125) && (dy <= 0.125))) {
+					refine.push_back(i);
+					break;
+				}
+			}
+		}
+		for (size_t i : refine) {
+			size_t w = p.width(i);
+			size_t h = p.height(j);
+			std::vector<double> &X = p.fx[j * gc + i];
+			std::vector<double> &Y = p.fy[j * gc + i];
+			X.reserve((w+1) * (h+1));
+			Y.reserve((w+1) * (h+1));
+			for (size_t b=0; b<=h; b++) {
+				for (size_t a=0; a<=w; a++) {
+					X.push_back(i * p.step + a);
+					Y.push_back(j * p.step + b);
+				}
+			}
+			tr.transform(X, Y);
+		}
+	}
+
+	// the locations covered by each square, and the size of the footprint of its cells
+	p.bb.resize(gr * gc * 5);
+	for (size_t j=0; j<gr; j++) {
+		for (size_t i=0; i<gc; i++) {
+			size_t sq = j * gc + i;
+			double xmin = INFINITY, xmax = -INFINITY, ymin = INFINITY, ymax = -INFINITY;
+			double foot = 1;
+			size_t w = p.width(i);
+			size_t h = p.height(j);
+			size_t qw = w, qh = h;
+			const double *X, *Y;
+			size_t ncn;
+			if (p.fx[sq].empty()) {
+				X = &p.sx[j * (gc + 1) + i];
+				Y = &p.sy[j * (gc + 1) + i];
+				ncn = gc + 1;
+				qw = 1;
+				qh = 1;
+			} else {
+				X = &p.fx[sq][0];
+				Y = &p.fy[sq][0];
+				ncn = w + 1;
+			}
+			for (size_t b=0; b<qh; b++) {
+				for (size_t a=0; a<qw; a++) {
+					size_t k = b * ncn + a;
+					double x00 = X[k], x01 = X[k+1], x10 = X[k+ncn], x11 = X[k+ncn+1];
+					double y00 = Y[k], y01 = Y[k+1], y10 = Y[k+ncn], y11 = Y[k+ncn+1];
+					if (std::isnan(x00) || std::isnan(x01) || std::isnan(x10) || std::isnan(x11)) continue;
+					if (p.wrap) p.unwrap(x00, x01, x10, x11);
+					xmin = std::min(xmin, std::min(std::min(x00, x01), std::min(x10, x11)));
+					xmax = std::max(xmax, std::max(std::max(x00, x01), std::max(x10, x11)));
+					ymin = std::min(ymin, std::min(std::min(y00, y01), std::min(y10, y11)));
+					ymax = std::max(ymax, std::max(std::max(y00, y01), std::max(y10, y11)));
+					// source cells per target cell
+					double sw = (double)(w / qw), sh = (double)(h / qh);
+					double fw = std::max(std::max(std::fabs(x01 - x00), std::fabs(x11 - x10)) / sw, std::max(std::fabs(x10 - x00), std::fabs(x11 - x01)) / sh);
+					double fh = std::max(std::max(std::fabs(y01 - y00), std::fabs(y11 - y10)) / sw, std::max(std::fabs(y10 - y00), std::fabs(y11 - y01)) / sh);
+					foot = std::max(foot, 2 * std::max(fw, fh));
+				}
+			}
+			double *B = &p.bb[sq * 5];
+			B[0] = xmin; B[1] = xmax; B[2] = ymin; B[3] = ymax; B[4] = foot;
+		}
+	}
+	return true;
+}
+
+
+std::shared_ptr<WarpPlan> get_warp_plan(SpatRaster &src, SpatRaster &dst, const std::string &srccrs, const std::string &dstcrs, std::string &msg) {
+
+	static std::mutex mtx;
+	static std::list<std::pair<std::string, std::shared_ptr<WarpPlan>>> cache;
+
+	SpatExtent se = src.getExtent();
+	SpatExtent te = dst.getExtent();
+	std::ostringstream ss;
+	ss.precision(17);
+	ss << src.nrow() << " " << src.ncol() << " " << se.xmin << " " << se.xmax << " " << se.ymin << " " << se.ymax << " "
+		<< dst.nrow() << " " << dst.ncol() << " " << te.xmin << " " << te.xmax << " " << te.ymin << " " << te.ymax << "\n"
+		<< srccrs << "\n" << dstcrs;
+	std::string key = ss.str();
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for (auto it = cache.begin(); it != cache.end(); it++) {
+			if (it->first == key) {
+				cache.splice(cache.begin(), cache, it);
+				return cache.front().second;
+			}
+		}
+	}
+
+	WarpTransform tr;
+	tr.txmin = te.xmin;
+	tr.tymax = te.ymax;
+	tr.txres = dst.xres();
+	tr.tyres = dst.yres();
+	tr.sxmin = se.xmin;
+	tr.symax = se.ymax;
+	tr.sxres = src.xres();
+	tr.syres = src.yres();
+
+	OGRSpatialReference source, target;
+	if ((!srccrs.empty()) && (!dstcrs.empty()) && (srccrs != dstcrs)) {
+		if (source.SetFromUserInput(dstcrs.c_str()) != OGRERR_NONE) {
+			msg = "output crs is not valid";
+			return nullptr;
+		}
+		if (target.SetFromUserInput(srccrs.c_str()) != OGRERR_NONE) {
+			msg = "input crs is not valid";
+			return nullptr;
+		}
+		if (!source.IsSame(&target)) {
+			tr.poCT = OGRCreateCoordinateTransformation(&source, &target);
+			if (tr.poCT == NULL) {
+				msg = "cannot do this transformation";
+				return nullptr;
+			}
+		}
+	}
+
+	std::shared_ptr<WarpPlan> p = std::make_shared<WarpPlan>();
+	p->nr = dst.nrow();
+	p->nc = dst.ncol();
+	p->snr = src.nrow();
+	p->snc = src.ncol();
+	p->wrap = src.is_global_lonlat() && (p->snc > 1);
+	// the grid is exact if the transformation is linear
+	p->step = tr.poCT == NULL ? std::max(p->nr, p->nc) : 32;
+	p->step = std::max(p->step, (size_t)1);
+	bool ok = make_warp_plan(*p, tr);
+	if (tr.poCT != NULL) OCTDestroyCoordinateTransformation(tr.poCT);
+	if (!ok) {
+		msg = "cannot create warp plan";
+		return nullptr;
+	}
+
+	if (p->memory() < 268435456) {
+		std::lock_guard<std::mutex> lock(mtx);
+		cache.push_front({key, p});
+		if (cache.size() > 4) cache.pop_back();
+	}
+	return p;
+}
+
+
+// resampling kernels (Keys cubic convolution with a = -0.5, as in GDAL)
+inline double warp_kernel(double t, bool cubic) {
+	t = std::fabs(t);
+	if (cubic) {
+		if (t < 1) return (1.5 * t - 2.5) * t * t + 1;
+		if (t < 2) return ((-0.5 * t + 2.5) * t - 4) * t + 2;
+		return 0;
+	}
+	return t < 1 ? 1 - t : 0;
+}
+
+
+// the cells (and their weights) of the kernel around source location (x, y).
+// The kernel is stretched if a target cell covers more than one source cell
+void kernel_taps(double x, double y, double width, double height, double radius, bool cubic, std::vector<long> &ci, std::vector<double> &cw, std::vector<long> &ri, std::vector<double> &rw) {
+	ci.resize(0);
+	cw.resize(0);
+	ri.resize(0);
+	rw.resize(0);
+	double xs = std::min(1.0, 1 / std::max(width, 1e-9));
+	double ys = std::min(1.0, 1 / std::max(height, 1e-9));
+	double u = x - 0.5;
+	double h = radius / xs;
+	for (long k=std::ceil(u - h); k<=std::floor(u + h); k++) {
+		double f = warp_kernel((k - u) * xs, cubic);
+		if (f == 0) continue;
+		ci.push_back(k);
+		cw.push_back(f);
+	}
+	u = y - 0.5;
+	h = radius / ys;
+	for (long k=std::ceil(u - h); k<=std::floor(u + h); k++) {
+		double f = warp_kernel((k - u) * ys, cubic);
+		if (f == 0) continue;
+		ri.push_back(k);
+		rw.push_back(f);
+	}
+}
+
+
+bool SpatRaster::warp_native(SpatRaster &out, const std::string &srccrs, const std::string &method, SpatOptions &opt) {
+
+	std::string msg;
+	std::string dstcrs = out.getSRS("wkt");
+	std::shared_ptr<WarpPlan> plan = get_warp_plan(*this, out, srccrs, dstcrs, msg);
+	if (!plan) {
+		out.setError(msg);
+		return false;
+	}
+	const WarpPlan &P = *plan;
+
+	bool near = method == "near";
+	bool average = method == "average";
+	bool cubic = method == "cubic";
+	double radius = near ? 0 : (average ? 0 : (cubic ? 2 : 1));
+	size_t nl = nlyr();
+	size_t nc = out.ncol();
+	long snr = nrow();
+	long snc = ncol();
+	bool wrap = P.wrap;
+
+	double supply = opt.get_memmax() > 0 ? opt.get_memmax() : availableRAM();
+	double budget = std::max(1048576.0, supply * opt.get_memfrac() / 4);
+
+	if (!readStart()) {
+		out.setError(getError());
+		return false;
+	}
+	opt.ncopies += 4;
+	if (!out.writeStart(opt, filenames())) {
+		readStop();
+		return false;
+	}
+
+	for (size_t bi = 0; bi < out.bs.n; bi++) {
+		size_t r0 = out.bs.row[bi];
+		size_t r1 = r0 + out.bs.nrows[bi];
+		size_t bn = out.bs.nrows[bi] * nc;
+		std::vector<double> w(bn * nl, NAN);
+
+		size_t a = r0;
+		while (a < r1) {
+			// add rows while the source window fits in memory
+			double xmin = INFINITY, xmax = -INFINITY, ymin = INFINITY, ymax = -INFINITY, foot = 1;
+			size_t b = a;
+			while (b < r1) {
+				size_t e = std::min(std::min(r1, b + 16), (b / P.step + 1) * P.step);
+				double qxmin = xmin, qxmax = xmax, qymin = ymin, qymax = ymax, qfoot = foot;
+				P.bounds(b, e, qxmin, qxmax, qymin, qymax, qfoot);
+				double pad = radius * qfoot + 1;
+				double ncells = (std::min((double)snr, qymax + pad) - std::max(0.0, qymin - pad)) *
+					(wrap ? snc : (std::min((double)snc, qxmax + pad) - std::max(0.0, qxmin - pad)));
+				if ((b > a) && (ncells * nl > budget)) break;
+				xmin = qxmin; xmax = qxmax; ymin = qymin; ymax = qymax; foot = qfoot;
+				b = e;
+			}
+
+			// the source window
+			double pad = radius * foot + 1;
+			long wr0 = std::max(0L, (long)std::floor(ymin - pad));
+			long wr1 = std::min(snr, (long)std::ceil(ymax + pad));
+			long wc0 = 0, wc1 = snc;
+			if (!wrap) {
+				wc0 = std::max(0L, (long)std::floor(xmin - pad));
+				wc1 = std::min(snc, (long)std::ceil(xmax + pad));
+			}
+			if ((!std::isfinite(ymin)) || (wr1 <= wr0) || (wc1 <= wc0)) {
+				a = b;
+				continue;
+			}
+			size_t wnr = wr1 - wr0;
+			size_t wnc = wc1 - wc0;
+			size_t wn = wnr * wnc;
+			std::vector<double> v;
+			readValues(v, wr0, wnr, wc0, wnc);
+			if (hasError() || (v.size() != (nl * wn))) {
+				out.setError(hasError() ? getError() : "cannot read the source values");
+				readStop();
+				return false;
+			}
+
+			auto do_rows = [&](size_t start, size_t end) {
+				std::vector<double> top(2 * (nc + 1)), bot(2 * (nc + 1));
+				std::vector<long> ci, ri, bci, bri;
+				std::vector<double> cw, rw, bcw, brw;
+				// window cells (or -1 if outside the window)
+				auto to_window = [&](std::vector<long> &cols, std::vector<long> &rows) {
+					for (size_t q=0; q<cols.size(); q++) {
+						long k = cols[q];
+						if (wrap) {
+							k %= snc;
+							if (k < 0) k += snc;
+						}
+						k -= wc0;
+						cols[q] = ((k < 0) || (k >= (long)wnc)) ? -1 : k;
+					}
+					for (size_t q=0; q<rows.size(); q++) {
+						long k = rows[q] - wr0;
+						rows[q] = ((k < 0) || (k >= (long)wnr)) ? -1 : k;
+					}
+				};
+				// the weighted mean of the cells that are not missing
+				auto accumulate = [&](const double *lv, const std::vector<long> &cols, const std::vector<double> &cwt, const std::vector<long> &rows, const std::vector<double> &rwt, bool &missing) {
+					double sw = 0, swv = 0;
+					missing = false;
+					for (size_t p=0; p<rows.size(); p++) {
+						if (rows[p] < 0) {
+							missing = true;
+							continue;
+						}
+						const double *rv = lv + rows[p] * wnc;
+						for (size_t q=0; q<cols.size(); q++) {
+							if (cols[q] < 0) {
+								missing = true;
+								continue;
+							}
+							double d = rv[cols[q]];
+							if (std::isnan(d)) {
+								missing = true;
+								continue;
+							}
+							double f = rwt[p] * cwt[q];
+							sw += f;
+							swv += f * d;
+						}
+					}
+					return sw > 1e-9 ? swv / sw : NAN;
+				};
+				for (size_t r=start; r<end; r++) {
+					if (!near) {
+						for (size_t c=0; c<=nc; c++) {
+							P.locate(c, r, top[2*c], top[2*c+1]);
+							P.locate(c, r+1, bot[2*c], bot[2*c+1]);
+						}
+					}
+					size_t off = (r - r0) * nc;
+					for (size_t c=0; c<nc; c++) {
+						double x, y;
+						P.locate(c + 0.5, r + 0.5, x, y);
+						if (std::isnan(x) || (y < 0) || (y >= snr)) continue;
+						if (wrap) {
+							x = std::fmod(x, (double)snc);
+							if (x < 0) x += snc;
+						} else if ((x < 0) || (x >= snc)) {
+							continue;
+						}
+						if (near) {
+							long col = std::min((long)x, snc-1) - wc0;
+							long row = std::min((long)y, snr-1) - wr0;
+							if ((col < 0) || (row < 0) || (col >= (long)wnc) || (row >= (long)wnr)) continue;
+							size_t k = row * wnc + col;
+							for (size_t lyr=0; lyr<nl; lyr++) {
+								w[lyr * bn + off + c] = v[lyr * wn + k];
+							}
+							continue;
+						}
+						// the footprint of the target cell
+						double fx[4] = {top[2*c], top[2*c+2], bot[2*c], bot[2*c+2]};
+						double fy[4] = {top[2*c+1], top[2*c+3], bot[2*c+1], bot[2*c+3]};
+						if (std::isnan(fx[0]) || std::isnan(fx[1]) || std::isnan(fx[2]) || std::isnan(fx[3])) {
+							fx[0] = fx[1] = fx[2] = fx[3] = x;
+							fy[0] = fy[1] = fy[2] = fy[3] = y;
+						} else if (wrap) {
+							P.unwrap(fx[0], fx[1], fx[2], fx[3]);
+							double shift = std::floor(((fx[0] + fx[1] + fx[2] + fx[3]) / 4 - x) / snc + 0.5) * snc;
+							for (size_t q=0; q<4; q++) fx[q] -= shift;
+						}
+						double fx0 = std::min(std::min(fx[0], fx[1]), std::min(fx[2], fx[3]));
+						double fx1 = std::max(std::max(fx[0], fx[1]), std::max(fx[2], fx[3]));
+						double fy0 = std::min(std::min(fy[0], fy[1]), std::min(fy[2], fy[3]));
+						double fy1 = std::max(std::max(fy[0], fy[1]), std::max(fy[2], fy[3]));
+
+						if (average) {
+							ci.resize(0);
+							cw.resize(0);
+							ri.resize(0);
+							rw.resize(0);
+							fx0 = std::max(fx0, wrap ? -INFINITY : 0.0);
+							fx1 = std::min(fx1, wrap ? INFINITY : (double)snc);
+							fy0 = std::max(fy0, 0.0);
+							fy1 = std::min(fy1, (double)snr);
+							if ((fx1 - fx0) < 1e-9) { fx0 = x; fx1 = x + 1e-9; }
+							if ((fy1 - fy0) < 1e-9) { fy0 = y; fy1 = y + 1e-9; }
+							for (long k=std::floor(fx0); k<std::ceil(fx1); k++) {
+								double f = std::min((double)(k+1), fx1) - std::max((double)k, fx0);
+								if (f <= 0) continue;
+								ci.push_back(k);
+								cw.push_back(f);
+							}
+							for (long k=std::floor(fy0); k<std::ceil(fy1); k++) {
+								double f = std::min((double)(k+1), fy1) - std::max((double)k, fy0);
+								if (f <= 0) continue;
+								ri.push_back(k);
+								rw.push_back(f);
+							}
+						} else {
+							kernel_taps(x, y, fx1 - fx0, fy1 - fy0, radius, cubic, ci, cw, ri, rw);
+						}
+						to_window(ci, ri);
+						bool missing = false;
+						for (size_t lyr=0; lyr<nl; lyr++) {
+							double z = accumulate(&v[lyr * wn], ci, cw, ri, rw, missing);
+							if (cubic && missing) {
+								// use bilinear interpolation if a cell is missing
+								kernel_taps(x, y, fx1 - fx0, fy1 - fy0, 1, false, bci, bcw, bri, brw);
+								to_window(bci, bri);
+								z = accumulate(&v[lyr * wn], bci, bcw, bri, brw, missing);
+							}
+							w[lyr * bn + off + c] = z;
+						}
+					}
+				}
+			};
+#if defined(USE_TBB)
+			if (opt.parallel || opt.threads) {
+				tbb::parallel_for(tbb::blocked_range<size_t>(a, b, 1),
+					[&](const tbb::blocked_range<size_t>& range) {
+					do_rows(range.begin(), range.end());
+				});
+			} else {
+				do_rows(a, b);
+			}
+#else
+			do_rows(a, b);
+#endif
+			a = b;
+		}
+		if (!out.writeBlock(w, bi)) {
+			readStop();
+			return false;
+		}
+	}
+	readStop();
+	out.writeStop();
+	return true;
+}
+
+
+// Resampling between aligned grids with the same crs, for methods "average",
+// "mode", "sum", "min", "max" and "rms". Two axes are aligned if the ratio of
+// their resolutions is a fraction p/q (with q <= 64) and their origins are on
+// the grid with 1/q of the source resolution. That includes integer
+// aggregation and disaggregation, and grids that are nested at a coarser
+// level (e.g. 2 and 3 units). The fraction of each source cell that is
+// covered by a target cell is then computed exactly and separately for the
+// rows and columns. Returns false if the grids are not aligned, or (with the
+// error set on "out") if reading or writing failed.
+
+// The source cells (and the fraction of them covered) for each target cell,
+// in source cell units. Target cell j uses the cells idx[start[j]] to
+// idx[start[j+1]-1]
+bool aligned_axis(double offset, double ratio, size_t sn, size_t tn, std::vector<size_t> &start, std::vector<long> &idx, std::vector<double> &frac) {
+	long q = 1;
+	for (; q<=64; q++) {
+		double p = std::round(ratio * q);
+		double t = std::round(offset * q);
+		if ((p > 0) && (std::fabs(ratio - p / q) * tn < 1e-3) && (std::fabs(offset - t / q) < 1e-4)) break;
+	}
+	if (q > 64) return false;
+	long P = std::round(ratio * q);
+	long T = std::round(offset * q);
+	long S = sn * q;
+	start.resize(0);
+	idx.resize(0);
+	frac.resize(0);
+	start.reserve(tn + 1);
+	for (size_t j=0; j<tn; j++) {
+		start.push_back(idx.size());
+		long a = std::max(T + (long)j * P, 0L);
+		long b = std::min(T + ((long)j + 1) * P, S);
+		for (long k = a / q; k * q < b; k++) {
+			long f = std::min((k + 1) * q, b) - std::max(k * q, a);
+			if (f <= 0) continue;
+			idx.push_back(k);
+			frac.push_back((double)f / q);
+		}
+	}
+	start.push_back(idx.size());
+	return true;
+}
+
+
+bool SpatRaster::resample_aligned(SpatRaster &out, const std::string &method, SpatOptions &opt) {
+
+	std::vector<std::string> m {"average", "mode", "sum", "min", "max", "rms"};
+	if (std::find(m.begin(), m.end(), method) == m.end()) return false;
+
+	SpatExtent se = getExtent();
+	SpatExtent te = out.getExtent();
+	double sxr = xres();
+	double syr = yres();
+	size_t nc = out.ncol();
+	size_t nr = out.nrow();
+	std::vector<size_t> cs, rs;
+	std::vector<long> ci, ri;
+	std::vector<double> cw, rw;
+	if (!aligned_axis((te.xmin - se.xmin) / sxr, out.xres() / sxr, ncol(), nc, cs, ci, cw)) return false;
+	if (!aligned_axis((se.ymax - te.ymax) / syr, out.yres() / syr, nrow(), nr, rs, ri, rw)) return false;
+
+	size_t nl = nlyr();
+	int fun = std::find(m.begin(), m.end(), method) - m.begin();
+	double supply = opt.get_memmax() > 0 ? opt.get_memmax() : availableRAM();
+	double budget = std::max(1048576.0, supply * opt.get_memfrac() / 4);
+
+	// the source columns that are used
+	long wc0 = ncol(), wc1 = 0;
+	if (!ci.empty()) {
+		wc0 = *std::min_element(ci.begin(), ci.end());
+		wc1 = *std::max_element(ci.begin(), ci.end()) + 1;
+	}
+	size_t wnc = wc1 > wc0 ? wc1 - wc0 : 0;
+	for (long &k : ci) k -= wc0;
+
+	if (!readStart()) {
+		out.setError(getError());
+		return false;
+	}
+	opt.ncopies += 4;
+	if (!out.writeStart(opt, filenames())) {
+		readStop();
+		return false;
+	}
+
+	for (size_t bi = 0; bi < out.bs.n; bi++) {
+		size_t r0 = out.bs.row[bi];
+		size_t r1 = r0 + out.bs.nrows[bi];
+		size_t bn = out.bs.nrows[bi] * nc;
+		std::vector<double> w(bn * nl, NAN);
+
+		size_t a = r0;
+		while (a < r1) {
+			// add rows while the source window fits in memory
+			// (the source rows increase with the target rows)
+			size_t b = a;
+			long wr0 = -1, wr1 = -1;
+			while (b < r1) {
+				if (rs[b] == rs[b+1]) {
+					b++;
+					continue;
+				}
+				long e0 = wr0 < 0 ? ri[rs[b]] : wr0;
+				long e1 = ri[rs[b+1] - 1] + 1;
+				if ((b > a) && ((double)(e1 - e0) * wnc * nl > budget)) break;
+				wr0 = e0;
+				wr1 = e1;
+				b++;
+			}
+			if ((wr0 < 0) || (wnc == 0)) {
+				a = b;
+				continue;
+			}
+			size_t wnr = wr1 - wr0;
+			size_t wn = wnr * wnc;
+			std::vector<double> v;
+			readValues(v, wr0, wnr, wc0, wnc);
+			if (hasError() || (v.size() != (nl * wn))) {
+				out.setError(hasError() ? getError() : "cannot read the source values");
+				readStop();
+				return false;
+			}
+
+			auto do_rows = [&](size_t start, size_t end) {
+				std::vector<std::pair<double, double>> vw;
+				for (size_t r=start; r<end; r++) {
+					size_t off = (r - r0) * nc;
+					for (size_t c=0; c<nc; c++) {
+						if (cs[c] == cs[c+1]) continue;
+						for (size_t lyr=0; lyr<nl; lyr++) {
+							const double *lv = &v[lyr * wn];
+							double sw = 0, swv = 0;
+							double z = fun == 3 ? INFINITY : -INFINITY;
+							vw.resize(0);
+							for (size_t p=rs[r]; p<rs[r+1]; p++) {
+								const double *rv = lv + (ri[p] - wr0) * wnc;
+								for (size_t k=cs[c]; k<cs[c+1]; k++) {
+									double d = rv[ci[k]];
+									if (std::isnan(d)) continue;
+									double f = rw[p] * cw[k];
+									sw += f;
+									switch (fun) {
+										case 0: case 2: swv += f * d; break;
+										case 1: vw.push_back({d, f}); break;
+										case 3: z = std::min(z, d); break;
+										case 4: z = std::max(z, d); break;
+										case 5: swv += f * d * d; break;
+									}
+								}
+							}
+							if (sw <= 0) continue;
+							switch (fun) {
+								case 0: z = swv / sw; break;
+								case 2: z = swv; break;
+								case 5: z = std::sqrt(swv / sw); break;
+								case 1: {
+									// the value that covers the largest area
+									// (the lowest value if there is a tie)
+									std::sort(vw.begin(), vw.end());
+									double best = -1, sum = 0;
+									for (size_t k=0; k<vw.size(); k++) {
+										sum += vw[k].second;
+										if (((k + 1) == vw.size()) || (vw[k+1].first != vw[k].first)) {
+											if (sum > best) {
+												best = sum;
+												z = vw[k].first;
+											}
+											sum = 0;
+										}
+									}
+									break;
+								}
+							}
+							w[lyr * bn + off + c] = z;
+						}
+					}
+				}
+			};
+#if defined(USE_TBB)
+			if (opt.parallel || opt.threads) {
+				tbb::parallel_for(tbb::blocked_range<size_t>(a, b, 1),
+					[&](const tbb::blocked_range<size_t>& range) {
+					do_rows(range.begin(), range.end());
+				});
+			} else {
+				do_rows(a, b);
+			}
+#else
+			do_rows(a, b);
+#endif
+			a = b;
+		}
+		if (!out.writeBlock(w, bi)) {
+			readStop();
+			return false;
+		}
+	}
+	readStop();
+	out.writeStop();
+	return true;
+}
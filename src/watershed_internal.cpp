@@ -385,7 +385,10 @@ void watershed_v2(double* p, int nx, int ny, int pp_offset, double* pOut) {
 
 // TO INSERT::: std::vector<double> SpatRaster::readValues(size_t row, size_t nrows, size_t col, size_t ncols){
 //Rcpp::IntegerVector SpatRaster::watershed2(int pp_offset,SpatOptions opt) {
-SpatRaster  SpatRaster::watershed2(int pp_offset,SpatOptions &opt) {
+SpatRaster  SpatRaster::watershed2(double pp_offset,SpatOptions &opt) {
+  if (!flowInMemory(opt)) {
+    return watershedTiled((int64_t)pp_offset, opt);
+  }
   // DA TESTARE
   SpatRaster out=geometry();
   //std::vector<std::string> oname="watershed";
@@ -414,7 +417,7 @@ SpatRaster  SpatRaster::watershed2(int pp_offset,SpatOptions &opt) {
   
   ///see
   //watershed_v1(&p[0],nx,ny,pp_offset,pOut.begin());
-  watershed_v2(&p[0],nx,ny,pp_offset,&pOutv[0]);
+  watershed_v2(&p[0],nx,ny,(int)pp_offset,&pOutv[0]);
   if (!out.writeStart(opt,filenames())) {
     readStop();
     return out;
@@ -778,6 +781,9 @@ void NIDP(int* pnext, int nx, int ny,double* nidp_value) {
  // TO INSERT::: std::vector<double> SpatRaster::readValues(size_t row, size_t nrows, size_t col, size_t ncols){
  //Rcpp::IntegerVector SpatRaster::watershed2(int pp_offset,SpatOptions opt) {
  SpatRaster  SpatRaster::NIDP2(SpatOptions &opt) {
+   if (!flowInMemory(opt)) {
+     return NIDPTiled(opt);
+   }
    // DA TESTARE
    SpatRaster out=geometry();
    //std::vector<std::string> oname="watershed";
@@ -883,6 +889,10 @@ void FlowAccu_weight(int* pnext, int nx, int ny,double* nidp_value,double* flowa
 
 
 SpatRaster  SpatRaster::flowAccu2(SpatOptions &opt) {
+  if (!flowInMemory(opt)) {
+    SpatRaster none;
+    return flowAccuTiled(none, false, opt);
+  }
   // DA TESTARE
   SpatRaster out=geometry();
   //std::vector<std::string> oname="watershed";
@@ -918,6 +928,9 @@ SpatRaster  SpatRaster::flowAccu2(SpatOptions &opt) {
 }
 
 SpatRaster  SpatRaster::flowAccu2_weight(SpatRaster weight,SpatOptions &opt) {
+  if (!flowInMemory(opt)) {
+    return flowAccuTiled(weight, true, opt);
+  }
   // DA TESTARE
   SpatRaster out=geometry();
   //std::vector<std::string> oname="watershed";
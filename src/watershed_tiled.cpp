@@ -0,0 +1,539 @@
+// Copyright (c) 2018-2026  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+// Out-of-core versions of flowAccu2, flowAccu2_weight, NIDP2 and watershed2
+// (see watershed_internal.cpp) for rasters that do not fit in memory.
+//
+// The raster is processed in tiles (blocks of rows). In a first pass, each
+// tile is processed on its own, and only the cells where water enters or
+// leaves the tile are kept. These form a graph that is solved for the whole
+// raster. In the second pass each tile is processed again, now with the
+// values that flow into it from the other tiles, and the results are written.
+// Tiles are read and written in order, but can be processed in parallel.
+
+#include "spatRaster.h"
+#include <unordered_map>
+#include <thread>
+
+#if defined(USE_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+
+// D8 flow directions
+//   32  64 128
+//   16   x   1
+//    8   4   2
+static const double d8_code[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+static const int64_t d8_dc[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+static const int64_t d8_dr[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+// path states (other values are the cell number of the last cell in a tile)
+static const int64_t FLOW_NONE = -1;
+static const int64_t FLOW_REACH = -2;
+static const int64_t FLOW_UNKNOWN = -3;
+static const int64_t FLOW_BUSY = -4;
+
+
+// cell number of the cell that (row, col) drains into, or -1
+inline int64_t d8_next(double d, int64_t row, int64_t col, int64_t nrow, int64_t ncol) {
+	for (size_t k=0; k<8; k++) {
+		if (d == d8_code[k]) {
+			int64_t r = row + d8_dr[k];
+			int64_t c = col + d8_dc[k];
+			if ((r < 0) || (r >= nrow) || (c < 0) || (c >= ncol)) return -1;
+			return r * ncol + c;
+		}
+	}
+	return -1;
+}
+
+
+class FlowTile {
+	public:
+		int64_t row, nrows, ncol;
+		// local index of the downstream cell; -1 if there is none or if it is outside the tile
+		std::vector<int64_t> next;
+		// cell number of the downstream cell if it is outside the tile; else -1
+		std::vector<int64_t> out;
+		// local index of the cells that receive water from outside the tile
+		std::vector<int64_t> entries;
+		// number of cells draining into each cell (cells at the edge of the raster,
+		// without a direction, or draining outside the raster, count themselves)
+		std::vector<uint8_t> nidp;
+
+		// d has the directions for rows hrow to hrow+hnrows (the tile and its neighboring rows)
+		void init(const std::vector<double> &d, int64_t hrow, int64_t hnrows, int64_t nrow) {
+			int64_t n = nrows * ncol;
+			next.resize(n);
+			out.resize(n);
+			nidp = std::vector<uint8_t>(n, 0);
+			std::vector<bool> isentry(n, false);
+			int64_t first = row * ncol;
+			for (int64_t r=hrow; r<(hrow+hnrows); r++) {
+				bool intile = (r >= row) && (r < (row + nrows));
+				for (int64_t c=0; c<ncol; c++) {
+					int64_t g = d8_next(d[(r-hrow)*ncol + c], r, c, nrow, ncol);
+					int64_t gr = g / ncol;
+					bool gin = (g >= 0) && (gr >= row) && (gr < (row + nrows));
+					if (intile) {
+						int64_t i = (r-row)*ncol + c;
+						if (g < 0) {
+							next[i] = -1;
+							out[i] = -1;
+							nidp[i]++;
+						} else if (gin) {
+							next[i] = g - first;
+							out[i] = -1;
+							nidp[g - first]++;
+						} else {
+							next[i] = -1;
+							out[i] = g;
+						}
+					} else if (gin) {
+						nidp[g - first]++;
+						isentry[g - first] = true;
+					}
+				}
+			}
+			for (int64_t i=0; i<n; i++) {
+				if (isentry[i]) entries.push_back(i);
+			}
+		}
+
+		// follow the flow path from local cell i until it leaves the tile, ends,
+		// or reaches local cell pp; and remember the result for all cells on the path
+		int64_t fate(std::vector<int64_t> &state, int64_t i, int64_t pp) {
+			std::vector<int64_t> path;
+			int64_t result = FLOW_NONE;
+			while (true) {
+				if (state[i] == FLOW_BUSY) { // loop
+					result = FLOW_NONE;
+					break;
+				} else if (state[i] != FLOW_UNKNOWN) {
+					result = state[i];
+					break;
+				} else if (i == pp) {
+					result = FLOW_REACH;
+					break;
+				}
+				state[i] = FLOW_BUSY;
+				path.push_back(i);
+				if (next[i] < 0) {
+					result = out[i] >= 0 ? (row * ncol + i) : FLOW_NONE;
+					break;
+				}
+				i = next[i];
+			}
+			if (i == pp) state[i] = FLOW_REACH;
+			for (size_t j=0; j<path.size(); j++) {
+				state[path[j]] = result;
+			}
+			return result;
+		}
+
+		// acc has the initial values (e.g. 1, a weight, and the inflow from other tiles)
+		// that are accumulated in downstream direction (Zhou et al., 2019)
+		void accumulate(std::vector<double> &acc) {
+			int64_t n = next.size();
+			std::vector<uint8_t> cnt(n, 0);
+			for (int64_t i=0; i<n; i++) {
+				if (next[i] >= 0) cnt[next[i]]++;
+			}
+			for (int64_t i=0; i<n; i++) {
+				if (cnt[i] != 0) continue;
+				int64_t j = i;
+				double a = 0;
+				while (j >= 0) {
+					acc[j] += a;
+					a = acc[j];
+					if (cnt[j] >= 2) {
+						cnt[j]--;
+						break;
+					}
+					j = next[j];
+				}
+			}
+		}
+};
+
+
+class FlowExit {
+	public:
+		int64_t from, to;
+		double value;
+};
+
+
+template <typename F>
+void for_tiles(size_t n, bool parallel, F f) {
+#if defined(USE_TBB)
+	if (parallel && (n > 1)) {
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, n),
+			[&](const tbb::blocked_range<size_t>& r) {
+				for (size_t k = r.begin(); k != r.end(); k++) f(k);
+			});
+		return;
+	}
+#endif
+	for (size_t k=0; k<n; k++) f(k);
+}
+
+
+// the number of tiles that are processed at the same time
+size_t flow_batch(SpatOptions &opt) {
+#if defined(USE_TBB)
+	if (opt.parallel) {
+		size_t n = std::thread::hardware_concurrency();
+		return std::max((size_t)1, std::min(n, (size_t)8));
+	}
+#endif
+	return 1;
+}
+
+
+bool SpatRaster::flowInMemory(SpatOptions &opt) {
+	// the in-memory algorithms use "int" cell numbers
+	if (ncell() > (size_t)INT32_MAX) return false;
+	SpatOptions xopt(opt);
+	xopt.ncopies = 6;
+	BlockSize bs = getBlockSize(xopt);
+	return bs.n == 1;
+}
+
+
+bool SpatRaster::readFlowTile(FlowTile &t, size_t row, size_t nrows) {
+	int64_t nr = nrow();
+	int64_t nc = ncol();
+	int64_t hrow = row > 0 ? row - 1 : 0;
+	int64_t hend = std::min((int64_t)(row + nrows + 1), nr);
+	std::vector<double> d;
+	readValues(d, hrow, hend-hrow, 0, nc);
+	if (hasError()) return false;
+	d.resize((hend-hrow) * nc); // first layer
+	t.row = row;
+	t.nrows = nrows;
+	t.ncol = nc;
+	t.init(d, hrow, hend-hrow, nr);
+	return true;
+}
+
+
+SpatRaster SpatRaster::flowAccuTiled(SpatRaster &weight, bool useweight, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	size_t nc = ncol();
+	size_t nb = flow_batch(opt);
+	opt.ncopies = std::max(opt.ncopies, (size_t)10) * nb;
+	if (!out.writeStart(opt, filenames())) {
+		return out;
+	}
+	BlockSize bs = out.bs;
+	if (!readStart()) {
+		out.setError(getError());
+		return out;
+	}
+	if (useweight && (!weight.readStart())) {
+		out.setError(weight.getError());
+		return out;
+	}
+
+	// pass 1: accumulation within tiles
+	std::vector<FlowExit> exits;
+	std::unordered_map<int64_t, int64_t> entries; // entry cell -> exit cell
+	for (size_t b=0; b<bs.n; b+=nb) {
+		size_t ne = std::min(nb, bs.n - b);
+		std::vector<FlowTile> tiles(ne);
+		std::vector<std::vector<double>> acc(ne);
+		for (size_t k=0; k<ne; k++) {
+			size_t i = b + k;
+			if (!readFlowTile(tiles[k], bs.row[i], bs.nrows[i])) {
+				out.setError(getError());
+				return out;
+			}
+			if (useweight) {
+				weight.readValues(acc[k], bs.row[i], bs.nrows[i], 0, nc);
+				acc[k].resize(bs.nrows[i] * nc);
+			} else {
+				acc[k].resize(bs.nrows[i] * nc, 1);
+			}
+		}
+		std::vector<std::vector<FlowExit>> tex(ne);
+		std::vector<std::vector<std::pair<int64_t, int64_t>>> ten(ne);
+		for_tiles(ne, opt.parallel, [&](size_t k) {
+			FlowTile &t = tiles[k];
+			t.accumulate(acc[k]);
+			int64_t first = t.row * t.ncol;
+			for (size_t i=0; i<t.out.size(); i++) {
+				if (t.out[i] >= 0) {
+					tex[k].push_back({first + (int64_t)i, t.out[i], acc[k][i]});
+				}
+			}
+			std::vector<int64_t> state(t.next.size(), FLOW_UNKNOWN);
+			for (int64_t e : t.entries) {
+				ten[k].push_back({first + e, t.fate(state, e, -1)});
+			}
+		});
+		for (size_t k=0; k<ne; k++) {
+			exits.insert(exits.end(), tex[k].begin(), tex[k].end());
+			for (auto &e : ten[k]) entries[e.first] = e.second;
+		}
+	}
+
+	// solve the graph of flows between tiles
+	std::unordered_map<int64_t, size_t> exitpos;
+	exitpos.reserve(exits.size());
+	for (size_t i=0; i<exits.size(); i++) {
+		exitpos[exits[i].from] = i;
+	}
+	std::vector<size_t> indeg(exits.size(), 0);
+	std::vector<size_t> downstream(exits.size(), exits.size());
+	for (size_t i=0; i<exits.size(); i++) {
+		auto e = entries.find(exits[i].to);
+		if ((e != entries.end()) && (e->second >= 0)) {
+			auto x = exitpos.find(e->second);
+			if (x != exitpos.end()) {
+				downstream[i] = x->second;
+				indeg[x->second]++;
+			}
+		}
+	}
+	std::vector<size_t> todo;
+	for (size_t i=0; i<exits.size(); i++) {
+		if (indeg[i] == 0) todo.push_back(i);
+	}
+	std::unordered_map<int64_t, double> inflow;
+	while (!todo.empty()) {
+		size_t i = todo.back();
+		todo.pop_back();
+		inflow[exits[i].to] += exits[i].value;
+		size_t j = downstream[i];
+		if (j < exits.size()) {
+			exits[j].value += exits[i].value;
+			indeg[j]--;
+			if (indeg[j] == 0) todo.push_back(j);
+		}
+	}
+	exits.clear();
+	exitpos.clear();
+	entries.clear();
+
+	// pass 2: accumulation with the inflow from other tiles
+	for (size_t b=0; b<bs.n; b+=nb) {
+		size_t ne = std::min(nb, bs.n - b);
+		std::vector<FlowTile> tiles(ne);
+		std::vector<std::vector<double>> acc(ne);
+		for (size_t k=0; k<ne; k++) {
+			size_t i = b + k;
+			if (!readFlowTile(tiles[k], bs.row[i], bs.nrows[i])) {
+				out.setError(getError());
+				return out;
+			}
+			if (useweight) {
+				weight.readValues(acc[k], bs.row[i], bs.nrows[i], 0, nc);
+				acc[k].resize(bs.nrows[i] * nc);
+			} else {
+				acc[k].resize(bs.nrows[i] * nc, 1);
+			}
+		}
+		for_tiles(ne, opt.parallel, [&](size_t k) {
+			FlowTile &t = tiles[k];
+			int64_t first = t.row * t.ncol;
+			for (int64_t e : t.entries) {
+				auto f = inflow.find(first + e);
+				if (f != inflow.end()) acc[k][e] += f->second;
+			}
+			t.accumulate(acc[k]);
+		});
+		for (size_t k=0; k<ne; k++) {
+			if (!out.writeValues(acc[k], bs.row[b+k], bs.nrows[b+k])) {
+				return out;
+			}
+		}
+	}
+	readStop();
+	if (useweight) weight.readStop();
+	out.writeStop();
+	return out;
+}
+
+
+
+SpatRaster SpatRaster::NIDPTiled(SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	size_t nb = flow_batch(opt);
+	opt.ncopies = std::max(opt.ncopies, (size_t)8) * nb;
+	if (!out.writeStart(opt, filenames())) {
+		return out;
+	}
+	BlockSize bs = out.bs;
+	if (!readStart()) {
+		out.setError(getError());
+		return out;
+	}
+	for (size_t b=0; b<bs.n; b+=nb) {
+		size_t ne = std::min(nb, bs.n - b);
+		std::vector<FlowTile> tiles(ne);
+		for (size_t k=0; k<ne; k++) {
+			if (!readFlowTile(tiles[k], bs.row[b+k], bs.nrows[b+k])) {
+				out.setError(getError());
+				return out;
+			}
+		}
+		for (size_t k=0; k<ne; k++) {
+			std::vector<double> v(tiles[k].nidp.begin(), tiles[k].nidp.end());
+			tiles[k] = FlowTile();
+			if (!out.writeValues(v, bs.row[b+k], bs.nrows[b+k])) {
+				return out;
+			}
+		}
+	}
+	readStop();
+	out.writeStop();
+	return out;
+}
+
+
+
+SpatRaster SpatRaster::watershedTiled(int64_t pp, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	size_t nb = flow_batch(opt);
+	opt.ncopies = std::max(opt.ncopies, (size_t)10) * nb;
+	if (!out.writeStart(opt, filenames())) {
+		return out;
+	}
+	BlockSize bs = out.bs;
+	if (!readStart()) {
+		out.setError(getError());
+		return out;
+	}
+
+	// pass 1: where do the paths from the cells that receive water from
+	// other tiles go?
+	std::unordered_map<int64_t, int64_t> exits;   // exit cell -> downstream cell
+	std::unordered_map<int64_t, int64_t> entries; // entry cell -> exit cell, FLOW_REACH or FLOW_NONE
+	for (size_t b=0; b<bs.n; b+=nb) {
+		size_t ne = std::min(nb, bs.n - b);
+		std::vector<FlowTile> tiles(ne);
+		for (size_t k=0; k<ne; k++) {
+			if (!readFlowTile(tiles[k], bs.row[b+k], bs.nrows[b+k])) {
+				out.setError(getError());
+				return out;
+			}
+		}
+		std::vector<std::vector<std::pair<int64_t, int64_t>>> tex(ne), ten(ne);
+		for_tiles(ne, opt.parallel, [&](size_t k) {
+			FlowTile &t = tiles[k];
+			int64_t first = t.row * t.ncol;
+			int64_t lpp = ((pp >= first) && (pp < (first + (int64_t)t.next.size()))) ? pp - first : -1;
+			std::vector<int64_t> state(t.next.size(), FLOW_UNKNOWN);
+			for (int64_t e : t.entries) {
+				ten[k].push_back({first + e, t.fate(state, e, lpp)});
+			}
+			for (size_t i=0; i<t.out.size(); i++) {
+				if (t.out[i] >= 0) tex[k].push_back({first + (int64_t)i, t.out[i]});
+			}
+		});
+		for (size_t k=0; k<ne; k++) {
+			for (auto &e : tex[k]) exits[e.first] = e.second;
+			for (auto &e : ten[k]) entries[e.first] = e.second;
+		}
+	}
+
+	// does the path from an entry cell reach the pour point?
+	std::unordered_map<int64_t, bool> reach;
+	for (auto &e : entries) {
+		if (reach.find(e.first) != reach.end()) continue;
+		std::vector<int64_t> path;
+		std::unordered_map<int64_t, bool> onpath;
+		int64_t v = e.first;
+		bool result = false;
+		while (true) {
+			auto r = reach.find(v);
+			if (r != reach.end()) {
+				result = r->second;
+				break;
+			}
+			auto f = entries.find(v);
+			if ((f == entries.end()) || onpath[v]) {
+				result = false;
+				break;
+			}
+			path.push_back(v);
+			onpath[v] = true;
+			if (f->second == FLOW_REACH) {
+				result = true;
+				break;
+			} else if (f->second < 0) {
+				result = false;
+				break;
+			}
+			auto x = exits.find(f->second);
+			if (x == exits.end()) {
+				result = false;
+				break;
+			}
+			v = x->second;
+		}
+		for (int64_t p : path) reach[p] = result;
+	}
+	entries.clear();
+
+	// pass 2: label the cells of each tile
+	for (size_t b=0; b<bs.n; b+=nb) {
+		size_t ne = std::min(nb, bs.n - b);
+		std::vector<FlowTile> tiles(ne);
+		for (size_t k=0; k<ne; k++) {
+			if (!readFlowTile(tiles[k], bs.row[b+k], bs.nrows[b+k])) {
+				out.setError(getError());
+				return out;
+			}
+		}
+		std::vector<std::vector<double>> v(ne);
+		for_tiles(ne, opt.parallel, [&](size_t k) {
+			FlowTile &t = tiles[k];
+			int64_t first = t.row * t.ncol;
+			int64_t lpp = ((pp >= first) && (pp < (first + (int64_t)t.next.size()))) ? pp - first : -1;
+			size_t n = t.next.size();
+			std::vector<int64_t> state(n, FLOW_UNKNOWN);
+			v[k].resize(n, 0);
+			for (size_t i=0; i<n; i++) {
+				int64_t f = t.fate(state, i, lpp);
+				if (f == FLOW_REACH) {
+					v[k][i] = 1;
+				} else if (f >= 0) {
+					auto x = exits.find(f);
+					if (x != exits.end()) {
+						auto r = reach.find(x->second);
+						if ((r != reach.end()) && r->second) v[k][i] = 1;
+					}
+				}
+			}
+		});
+		for (size_t k=0; k<ne; k++) {
+			if (!out.writeValues(v[k], bs.row[b+k], bs.nrows[b+k])) {
+				return out;
+			}
+		}
+	}
+	readStop();
+	out.writeStop();
+	return out;
+}
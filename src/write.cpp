@@ -20,6 +20,275 @@
 #include "string_utils.h"
 #include "math_utils.h"
 #include "recycle.h"
+#include <cfloat>
+
+
+void SpatBandStats::init(size_t nbins) {
+	// bins are merged in pairs when the range needs to grow
+	if ((nbins % 2) == 1) nbins++;
+	hist = std::vector<uint64_t>(nbins, 0);
+	hmin = NAN;
+	hwidth = 0;
+}
+
+
+void SpatBandStats::grow(double vmin, double vmax) {
+	size_t nb = hist.size();
+	if (std::isnan(hmin)) {
+		hmin = vmin;
+		hwidth = (vmax - vmin) / nb;
+		if (hwidth <= 0) hwidth = 1;
+		return;
+	}
+	while ((vmin < hmin) || (vmax > hmax())) {
+		bool down = vmin < hmin;
+		size_t off = down ? nb / 2 : 0;
+		std::vector<uint64_t> h(nb, 0);
+		for (size_t i=0; i<nb; i++) {
+			h[off + i/2] += hist[i];
+		}
+		if (down) hmin -= nb * hwidth;
+		hwidth *= 2;
+		hist = std::move(h);
+	}
+}
+
+
+void SpatBandStats::add(const std::vector<double> &v, size_t start, size_t end, double lmin, double lmax, double exclude, bool isint, bool isflt4, bool &outrange) {
+
+	// the values as they will be stored in the file
+	std::vector<double> x;
+	x.reserve(end - start);
+	bool hasexcl = !std::isnan(exclude);
+	for (size_t i=start; i<end; i++) {
+		double d = v[i];
+		if (std::isnan(d) || (hasexcl && (d == exclude))) continue;
+		if ((d < lmin) || (d > lmax)) {
+			outrange = true;
+			continue;
+		}
+		if (isint) {
+			d = std::trunc(d);
+		} else if (isflt4) {
+			// values that are too large for a float become infinite
+			d = std::fabs(d) > FLT_MAX ? (d > 0 ? INFINITY : -INFINITY) : (float) d;
+		}
+		x.push_back(d);
+	}
+	if (x.empty()) return;
+
+	// infinite values (including float values that are too large for FLT4S)
+	// are included in the range, but not in the moments and the histogram
+	double bmin = x[0];
+	double bmax = x[0];
+	double fmin = INFINITY;
+	double fmax = -INFINITY;
+	double bsum = 0;
+	double bn = 0;
+	for (const double &d : x) {
+		if (d < bmin) {
+			bmin = d;
+		} else if (d > bmax) {
+			bmax = d;
+		}
+		if (std::isinf(d)) {
+			ninf++;
+			continue;
+		}
+		fmin = std::min(fmin, d);
+		fmax = std::max(fmax, d);
+		bsum += d;
+		bn++;
+	}
+	if (std::isnan(min)) {
+		min = bmin;
+		max = bmax;
+	} else {
+		min = std::min(min, bmin);
+		max = std::max(max, bmax);
+	}
+	if (bn == 0) return;
+
+	// two-pass statistics for this chunk, combined with the running statistics (Chan et al.)
+	double bmean = bsum / bn;
+	double bm2 = 0;
+	for (const double &d : x) {
+		if (std::isinf(d)) continue;
+		double e = d - bmean;
+		bm2 += e * e;
+	}
+	if (n == 0) {
+		n = bn;
+		mean = bmean;
+		m2 = bm2;
+	} else {
+		double delta = bmean - mean;
+		double tn = n + bn;
+		mean += delta * bn / tn;
+		m2 += bm2 + delta * delta * n * bn / tn;
+		n = tn;
+	}
+
+	if (!hist.empty()) {
+		grow(fmin, fmax);
+		size_t nb1 = hist.size() - 1;
+		for (const double &d : x) {
+			if (std::isinf(d)) continue;
+			size_t k = (d - hmin) / hwidth;
+			hist[std::min(k, nb1)]++;
+		}
+	}
+}
+
+
+double SpatBandStats::sd() {
+	if (n == 0) return NAN;
+	return std::sqrt(m2 / n);
+}
+
+
+bool SpatOverviews::init(size_t nr, size_t nc, size_t nl, size_t minsize, bool nearest_neighbor) {
+	ncol.resize(0);
+	nrow.resize(0);
+	inrow = nr;
+	incol = nc;
+	nlyr = nl;
+	nextrow = 0;
+	nearest = nearest_neighbor;
+	minsize = std::max(minsize, (size_t)1);
+	while ((nc > minsize) || (nr > minsize)) {
+		nc = (nc + 1) / 2;
+		nr = (nr + 1) / 2;
+		ncol.push_back(nc);
+		nrow.push_back(nr);
+	}
+	size_t n = ncol.size();
+	psum = std::vector<std::vector<double>>(n);
+	pcnt = std::vector<std::vector<double>>(n);
+	pending = std::vector<bool>(n, false);
+	out = std::vector<std::vector<double>>(n);
+	outrow = std::vector<size_t>(n, 0);
+	outnrow = std::vector<size_t>(n, 0);
+	valid = n > 0;
+	return valid;
+}
+
+
+std::vector<int> SpatOverviews::factors() {
+	std::vector<int> f(ncol.size());
+	for (size_t i=0; i<f.size(); i++) {
+		f[i] = 1 << (i+1);
+	}
+	return f;
+}
+
+
+void SpatOverviews::add_level(size_t k, const std::vector<double> &s, const std::vector<double> &c, size_t nrows, size_t win, bool last) {
+
+	if (k >= ncol.size()) return;
+	size_t wk = ncol[k];
+	size_t hp = pending[k] ? 1 : 0;
+	size_t total = nrows + hp;
+	size_t nout = total / 2;
+	bool single = last && (total % 2 == 1);
+	if (single) nout++;
+
+	std::vector<double> os(nlyr * nout * wk, 0);
+	std::vector<double> oc(nlyr * nout * wk, 0);
+	size_t nin = nrows * win;
+	for (size_t lyr=0; lyr<nlyr; lyr++) {
+		for (size_t r=0; r<nout; r++) {
+			// input rows 2r and 2r+1, counting the pending row as the first
+			const double *as, *ac, *bs=NULL, *bc=NULL;
+			size_t i = 2 * r;
+			if (i < hp) {
+				as = &psum[k][lyr * win];
+				ac = &pcnt[k][lyr * win];
+			} else {
+				as = &s[lyr * nin + (i-hp) * win];
+				ac = &c[lyr * nin + (i-hp) * win];
+			}
+			if ((i+1) < total) {
+				bs = &s[lyr * nin + (i+1-hp) * win];
+				bc = &c[lyr * nin + (i+1-hp) * win];
+			}
+			size_t off = lyr * nout * wk + r * wk;
+			for (size_t j=0; j<wk; j++) {
+				size_t j0 = 2*j;
+				size_t j1 = j0 + 1;
+				if (nearest) {
+					os[off+j] = as[j0];
+					oc[off+j] = ac[j0];
+					continue;
+				}
+				double sm = as[j0];
+				double cn = ac[j0];
+				if (j1 < win) {
+					sm += as[j1];
+					cn += ac[j1];
+				}
+				if (bs != NULL) {
+					sm += bs[j0];
+					cn += bc[j0];
+					if (j1 < win) {
+						sm += bs[j1];
+						cn += bc[j1];
+					}
+				}
+				os[off+j] = sm;
+				oc[off+j] = cn;
+			}
+		}
+	}
+
+	if ((!single) && (total % 2 == 1)) {
+		// keep the last row for the next call
+		// (if there are no new rows, the pending row is kept)
+		psum[k].resize(nlyr * win);
+		pcnt[k].resize(nlyr * win);
+		for (size_t lyr=0; (lyr<nlyr) && (nrows > 0); lyr++) {
+			size_t from = lyr * nin + (nrows-1) * win;
+			std::copy(s.begin()+from, s.begin()+from+win, psum[k].begin()+lyr*win);
+			std::copy(c.begin()+from, c.begin()+from+win, pcnt[k].begin()+lyr*win);
+		}
+		pending[k] = true;
+	} else {
+		pending[k] = false;
+	}
+
+	out[k].resize(os.size());
+	for (size_t i=0; i<os.size(); i++) {
+		out[k][i] = oc[i] > 0 ? os[i] / oc[i] : NAN;
+	}
+	outrow[k] += outnrow[k];
+	outnrow[k] = nout;
+
+	add_level(k+1, os, oc, nout, wk, last);
+}
+
+
+bool SpatOverviews::add(const std::vector<double> &v, size_t startrow, size_t nrows) {
+	if (!valid) return false;
+	if ((startrow != nextrow) || (v.size() != (nlyr * nrows * incol))) {
+		// not written from top to bottom
+		valid = false;
+		return false;
+	}
+	nextrow += nrows;
+	std::vector<double> s(v.size()), c(v.size());
+	for (size_t i=0; i<v.size(); i++) {
+		if (std::isnan(v[i])) {
+			s[i] = 0;
+			c[i] = 0;
+		} else {
+			s[i] = v[i];
+			c[i] = 1;
+		}
+	}
+	add_level(0, s, c, nrows, incol, nextrow == inrow);
+	return true;
+}
+
 
 
 bool SpatRaster::writeValuesMem(std::vector<double> &vals, size_t startrow, size_t nrows) {
@@ -205,7 +474,15 @@ bool SpatRaster::writeStart(SpatOptions &opt, const std::vector<std::string> src
 	} 
 	
 	size_t nl = nlyr();
-	bs = getBlockSize(opt);
+	if (opt.write_async && (!filename.empty())) {
+		// room for the blocks held by the write queue
+		size_t ncp = opt.ncopies;
+		opt.ncopies += 2;
+		bs = getBlockSize(opt);
+		opt.ncopies = ncp;
+	} else {
+		bs = getBlockSize(opt);
+	}
 	if (!filename.empty()) {
 		// open GDAL filestream
 		#ifdef useGDAL
@@ -332,6 +332,19 @@ void removeVatJson(std::string filename) {
 }
 
 
+std::string gdal_option_value(const std::vector<std::string> &ops, std::string name) {
+	name += "=";
+	for (size_t i=0; i<ops.size(); i++) {
+		if (ops[i].substr(0, name.size()) == name) {
+			std::string v = ops[i].substr(name.size());
+			lowercase(v);
+			return v;
+		}
+	}
+	return "";
+}
+
+
 bool SpatRaster::writeStartGDAL(SpatOptions &opt, const std::vector<std::string> &srcnames) {
 
 	std::string filename = opt.get_filename();
@@ -473,7 +486,14 @@ bool SpatRaster::writeStartGDAL(SpatOptions &opt, const std::vector<std::string>
 	}
 
 	stat_options(opt.get_statistics(), compute_stats, gdal_stats, gdal_minmax, gdal_approx);
-	char **papszOptions = set_GDAL_options(driver, diskNeeded, writeRGB, opt.gdal_options);
+	stream_stats = true;
+	wstats = std::vector<SpatBandStats>(nlyr());
+	if (compute_stats && (opt.histogram > 0)) {
+		for (size_t i=0; i<wstats.size(); i++) {
+			wstats[i].init(opt.histogram);
+		}
+	}
+	char **papszOptions = set_GDAL_options(driver, diskNeeded, writeRGB, opt.gdal_options, opt.threads || opt.write_async);
 
 /*	if (driver == "GTiff") {
 		GDAL_tiff_options(diskNeeded > 4194304000, writeRGB, opt);
@@ -823,6 +843,52 @@ bool SpatRaster::writeStartGDAL(SpatOptions &opt, const std::vector<std::string>
 	}
 */
 
+	int hasNA = 0;
+	write_na = poDS->GetRasterBand(1)->GetNoDataValue(&hasNA);
+	write_hasNA = hasNA;
+	if (!write_hasNA) write_na = NAN;
+
+	wovr = SpatOverviews();
+	ovr_method = "";
+	if (driver == "COG") {
+		// compute the overviews while writing; the COG driver then only needs 
+		// to copy them instead of reading all values again at writeStop
+		std::string ovrs = gdal_option_value(opt.gdal_options, "OVERVIEWS");
+		std::string method = gdal_option_value(opt.gdal_options, "OVERVIEW_RESAMPLING");
+		if (method.empty()) {
+			method = gdal_option_value(opt.gdal_options, "RESAMPLING");
+		}
+		if (method.empty()) {
+			std::vector<bool> hc = hasCategories();
+			std::vector<bool> hcol = hasColors();
+			bool categorical = (std::find(hc.begin(), hc.end(), true) != hc.end()) || (std::find(hcol.begin(), hcol.end(), true) != hcol.end());
+			method = categorical ? "nearest" : "average";
+		}
+		std::string bsize = gdal_option_value(opt.gdal_options, "BLOCKSIZE");
+		size_t minsize = std::strtoul(bsize.c_str(), NULL, 10);
+		if (minsize == 0) minsize = 512;
+		if ((ovrs != "none") && (ovrs != "ignore_existing") && ((method == "nearest") || (method == "average"))) {
+			if (wovr.init(nrow(), ncol(), nlyr(), minsize, method == "nearest")) {
+				std::vector<int> f = wovr.factors();
+				std::vector<int> bands(nlyr());
+				std::iota(bands.begin(), bands.end(), 1);
+				// allocate the overviews without computing them
+				if (poDS->BuildOverviews("NONE", f.size(), &f[0], bands.size(), &bands[0], NULL, NULL) == CE_None) {
+					ovr_method = method == "nearest" ? "NEAREST" : "AVERAGE";
+				} else {
+					wovr.valid = false;
+					CPLErrorReset();
+				}
+			}
+		}
+	}
+
+	wqueue.reset();
+	if (opt.write_async && (bs.n > 1)) {
+		// encode and compress the previous block while the next one is computed
+		wqueue = std::make_shared<SpatWriteQueue>(2);
+	}
+
 	source[0].gdalconnection = poDS;
 	return true;
 }
@@ -846,59 +912,76 @@ void tmp_min_max_na(std::vector<T> &out, const std::vector<double> &v, const dou
 }
 
 
-template <typename Iterator>
-void minmaxlim(Iterator start, Iterator end, double &vmin, double &vmax, const double &lmin, const double &lmax, bool& outrange, double exclude=NAN) {
-    vmin = std::numeric_limits<double>::max();
-    vmax = std::numeric_limits<double>::lowest();
-    bool none = true;
-	
-	if (!std::isnan(exclude)) {
-		for (Iterator v = start; v !=end; ++v) {
-			if (!std::isnan(*v) && (exclude != *v)) {
-				if (*v >= lmin && *v <= lmax) {
-					if (*v > vmax) {
-						vmax = *v;
-						none = false;
-					}
-					if (*v < vmin) {
-						vmin = *v;
-					}
-				} else {
-					outrange = true;
-				}
-			}
-		}
+void datatype_limits(const std::string &datatype, double &lmin, double &lmax) {
+	if (datatype == "INT8S") {
+		lmin = (double)INT64_MIN; lmax = (double)INT64_MAX;
+	} else if (datatype == "INT4S") {
+		lmin = (double)INT32_MIN; lmax = (double)INT32_MAX;
+	} else if (datatype == "INT2S") {
+		lmin = (double)INT16_MIN; lmax = (double)INT16_MAX;
+	} else if (datatype == "INT8U") {
+		lmin = 0.0; lmax = (double)UINT64_MAX;
+	} else if (datatype == "INT4U") {
+		lmin = 0.0; lmax = (double)UINT32_MAX;
+	} else if (datatype == "INT2U") {
+		lmin = 0.0; lmax = (double)UINT16_MAX;
+	} else if (datatype == "INT1U") {
+		lmin = 0.0; lmax = 255.0;
+	} else if (datatype == "INT1S") {
+		lmin = -128.0; lmax = 127.0;
 	} else {
-		for (Iterator v = start; v !=end; ++v) {
-			if (!std::isnan(*v)) {
-				if (*v >= lmin && *v <= lmax) {
-					if (*v > vmax) {
-						vmax = *v;
-						none = false;
-					}
-					if (*v < vmin) {
-						vmin = *v;
-					}
-				} else {
-					outrange = true;
-				}
-			}
-		}
+		lmin = -std::numeric_limits<double>::infinity();
+		lmax = std::numeric_limits<double>::infinity();
+	}
+}
+
+
+
+template <typename T>
+CPLErr write_block(GDALDataset *poDS, std::shared_ptr<SpatWriteQueue> &wq, std::vector<T> &v, GDALDataType gdt, size_t startcol, size_t startrow, size_t ncols, size_t nrows, size_t nl) {
+	if (!wq) {
+		return poDS->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &v[0], ncols, nrows, gdt, nl, NULL, 0, 0, 0, NULL );
 	}
-    if (none) {
-        vmin = NAN;
-        vmax = NAN;
-    }
-	vmin = std::trunc(vmin);	
-	vmax = std::trunc(vmax);	
+	// the background thread only does the RasterIO (encoding and compression);
+	// it owns the buffer so that the caller can continue with the next block
+	std::shared_ptr<std::vector<T>> buf = std::make_shared<std::vector<T>>(std::move(v));
+	bool ok = wq->push([poDS, buf, gdt, startcol, startrow, ncols, nrows, nl]() {
+		QuietGDALErrors quiet;
+		CPLErr err = poDS->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &(*buf)[0], ncols, nrows, gdt, nl, NULL, 0, 0, 0, NULL );
+		return err == CE_None;
+	});
+	return ok ? CE_None : CE_Failure;
 }
 
 
+bool write_overview_rows(GDALDataset *poDS, const std::vector<double> &v, size_t level, size_t startrow, size_t nrows, size_t ncols, size_t nl) {
+	size_t n = nrows * ncols;
+	for (size_t i=0; i<nl; i++) {
+		GDALRasterBand *poBand = poDS->GetRasterBand(i+1)->GetOverview(level);
+		if (poBand == NULL) return false;
+		CPLErr err = poBand->RasterIO(GF_Write, 0, startrow, ncols, nrows, (void *) &v[i*n], ncols, nrows, GDT_Float64, 0, 0, NULL);
+		if (err != CE_None) return false;
+	}
+	return true;
+}
+
+
+CPLErr write_overview(GDALDataset *poDS, std::shared_ptr<SpatWriteQueue> &wq, std::vector<double> &v, size_t level, size_t startrow, size_t nrows, size_t ncols, size_t nl) {
+	if (!wq) {
+		return write_overview_rows(poDS, v, level, startrow, nrows, ncols, nl) ? CE_None : CE_Failure;
+	}
+	std::shared_ptr<std::vector<double>> buf = std::make_shared<std::vector<double>>(std::move(v));
+	bool ok = wq->push([poDS, buf, level, startrow, nrows, ncols, nl]() {
+		QuietGDALErrors quiet;
+		return write_overview_rows(poDS, *buf, level, startrow, nrows, ncols, nl);
+	});
+	return ok ? CE_None : CE_Failure;
+}
+
 
 bool SpatRaster::writeValuesGDAL(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols){
 
 	CPLErr err = CE_None;
-	double vmin, vmax;
 	size_t nc = nrows * ncols;
 	size_t nl = nlyr();
 	std::string datatype = source[0].dtype;
@@ -913,132 +996,141 @@ bool SpatRaster::writeValuesGDAL(std::vector<double> &vals, size_t startrow, siz
 		}
 	}
 
-	int hasNA = 0;
-	double na = source[0].gdalconnection->GetRasterBand(1)->GetNoDataValue(&hasNA);
-	if (!hasNA) na = NAN;
+	// cached in writeStartGDAL; the dataset may be in use by the write queue
+	bool hasNA = write_hasNA;
+	double na = write_na;
 
-	if ((compute_stats) && (!gdal_stats)) {
+	if (compute_stats) {
+		if (ncols != ncol()) {
+			// cells may be written more than once
+			stream_stats = false;
+		}
 		bool invalid = false;
+		bool isint = datatype.substr(0,3) == "INT";
+		bool isflt4 = datatype == "FLT4S";
+		double lmin, lmax;
+		datatype_limits(datatype, lmin, lmax);
 		for (size_t i=0; i < nl; i++) {
 			size_t start = nc * i;
-			if (datatype == "INT8S") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, (double)INT64_MIN, (double)INT64_MAX, invalid, na);
-			} else if (datatype == "INT4S") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, (double)INT32_MIN, (double)INT32_MAX, invalid, na);
-			} else if (datatype == "INT2S") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, (double)INT16_MIN, (double)INT16_MAX, invalid, na);
-			} else if (datatype == "INT8U") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, 0.0, (double)UINT64_MAX, invalid, na);
-			} else if (datatype == "INT4U") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, 0.0, (double)UINT32_MAX, invalid, na);
-			} else if (datatype == "INT2U") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, 0.0, (double)UINT16_MAX, invalid, na);
-			} else if (datatype == "INT1U") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, 0.0, 255.0, invalid, na);
-			} else if (datatype == "INT1S") {
-				minmaxlim(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, -128.0, 127.0, invalid, na);
-			} else {
-				minmax(vals.begin()+start, vals.begin()+start+nc, vmin, vmax, na);
-			}
-//			if (source[0].has_scale_offset[i]) {
-//				vmin = vmin * source[0].scale[i] + source[0].offset[i];
-//				vmax = vmax * source[0].scale[i] + source[0].offset[i];
-//			}
-			if (!std::isnan(vmin)) {
-				if (std::isnan(source[0].range_min[i])) {
-					source[0].range_min[i] = vmin;
-					source[0].range_max[i] = vmax;
-				} else {
-					source[0].range_min[i] = std::min(source[0].range_min[i], vmin);
-					source[0].range_max[i] = std::max(source[0].range_max[i], vmax);
-				}
-			}
+			wstats[i].add(vals, start, start+nc, lmin, lmax, na, isint, isflt4, invalid);
+			source[0].range_min[i] = wstats[i].min;
+			source[0].range_max[i] = wstats[i].max;
 		}
 		if (invalid) {
 			addWarning("detected values outside of the limits of datatype " + datatype);
 		}
 	}
 
+	GDALDataset *poDS = source[0].gdalconnection;
+	if (wovr.valid && wovr.add(vals, startrow, nrows)) {
+		for (size_t k=0; k<wovr.out.size(); k++) {
+			if (wovr.outnrow[k] == 0) continue;
+			std::vector<double> &ov = wovr.out[k];
+			if (hasNA) {
+				for (double &d : ov) {
+					if (std::isnan(d)) d = na;
+				}
+			}
+			err = write_overview(poDS, wqueue, ov, k, wovr.outrow[k], wovr.outnrow[k], wovr.ncol[k], nl);
+			if (err != CE_None) {
+				setError("cannot write overview values");
+				closeWriteGDAL();
+				return false;
+			}
+		}
+	}
+
 	if ((datatype == "FLT8S") || (datatype == "FLT4S")) {
-		if (hasNA) {
-			size_t n = vals.size();
-			for (size_t i=0; i<n; i++) {
-				if (std::isnan(vals[i])) vals[i] = na;
+		if (wqueue) {
+			// vals belongs to the caller
+			std::vector<double> vv = vals;
+			if (hasNA) {
+				for (double &d : vv) {
+					if (std::isnan(d)) d = na;
+				}
 			}
+			err = write_block(poDS, wqueue, vv, GDT_Float64, startcol, startrow, ncols, nrows, nl);
+		} else {
+			if (hasNA) {
+				size_t n = vals.size();
+				for (size_t i=0; i<n; i++) {
+					if (std::isnan(vals[i])) vals[i] = na;
+				}
+			}
+			err = write_block(poDS, wqueue, vals, GDT_Float64, startcol, startrow, ncols, nrows, nl);
 		}
-		err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vals[0], ncols, nrows, GDT_Float64, nl, NULL, 0, 0, 0, NULL );
 	} else {
 		if (datatype == "INT8S") {
 #if GDAL_VERSION_MAJOR <= 3 && GDAL_VERSION_MINOR < 5
 			setError("cannot write INT8S values with GDAL < 3.5");
-			GDALClose( source[0].gdalconnection );
+			closeWriteGDAL();
 			return false;	
 #else 			
 			std::vector<int64_t> vv;
 			tmp_min_max_na(vv, vals, na, (double)INT64_MIN, (double)INT64_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Int64, nl, NULL, 0, 0, 0, NULL );
+			err = write_block(poDS, wqueue, vv, GDT_Int64, startcol, startrow, ncols, nrows, nl);
 #endif
 		} else if (datatype == "INT4S") {
 			//min_max_na(vals, na, (double)INT32_MIN, (double)INT32_MAX);
 			//std::vector<int32_t> vv(vals.begin(), vals.end());
 			std::vector<int32_t> vv;
 			tmp_min_max_na(vv, vals, na, (double)INT32_MIN, (double)INT32_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Int32, nl, NULL, 0, 0, 0, NULL );
+			err = write_block(poDS, wqueue, vv, GDT_Int32, startcol, startrow, ncols, nrows, nl);
 		} else if (datatype == "INT2S") {
 			//min_max_na(vals, na, (double)INT16_MIN, (double)INT16_MAX);
 			//std::vector<int16_t> vv(vals.begin(), vals.end());
 			std::vector<int16_t> vv;
 			tmp_min_max_na(vv, vals, na, (double)INT16_MIN, (double)INT16_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Int16, nl, NULL, 0, 0, 0, NULL );
+			err = write_block(poDS, wqueue, vv, GDT_Int16, startcol, startrow, ncols, nrows, nl);
 		} else if (datatype == "INT1S") {
 #if GDAL_VERSION_MAJOR <= 3 && GDAL_VERSION_MINOR < 7
 			setError("cannot write INT1S values with GDAL < 3.7");
-			GDALClose( source[0].gdalconnection );
+			closeWriteGDAL();
 			return false;	
 #else 			
 			std::vector<int8_t> vv;
 			tmp_min_max_na(vv, vals, na, -127.0, 128.0);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Int8, nl, NULL, 0, 0, 0, NULL );
+			err = write_block(poDS, wqueue, vv, GDT_Int8, startcol, startrow, ncols, nrows, nl);
 #endif
 
 		} else if (datatype == "INT8U") {
 #if GDAL_VERSION_MAJOR <= 3 && GDAL_VERSION_MINOR < 5
 			setError("cannot write INT8U values with GDAL < 3.5");
-			GDALClose( source[0].gdalconnection );
+			closeWriteGDAL();
 			return false;	
 #else 			
 			std::vector<uint64_t> vv;
 			tmp_min_max_na(vv, vals, na, 0, (double)UINT64_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_UInt64, nl, NULL, 0, 0, 0, NULL );
+			err = write_block(poDS, wqueue, vv, GDT_UInt64, startcol, startrow, ncols, nrows, nl);
 #endif			
 		} else if (datatype == "INT4U") {
 			//min_max_na(vals, na, 0, (double)INT32_MAX * 2 - 1);
 			//std::vector<uint32_t> vv(vals.begin(), vals.end());
 			std::vector<uint32_t> vv;
 			tmp_min_max_na(vv, vals, na, 0, (double)UINT32_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_UInt32, nl, NULL, 0, 0, 0, NULL );
+			err = write_block(poDS, wqueue, vv, GDT_UInt32, startcol, startrow, ncols, nrows, nl);
 		} else if (datatype == "INT2U") {
 			//min_max_na(vals, na, 0, (double)INT16_MAX * 2 - 1);
 			//std::vector<uint16_t> vv(vals.begin(), vals.end());
 			std::vector<uint16_t> vv;
 			tmp_min_max_na(vv, vals, na, 0, (double)UINT16_MAX);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_UInt16, nl, NULL, 0, 0, 0, NULL );
+			err = write_block(poDS, wqueue, vv, GDT_UInt16, startcol, startrow, ncols, nrows, nl);
 		} else if (datatype == "INT1U") {
 			//min_max_na(vals, na, 0, 255);
 			//std::vector<int8_t> vv(vals.begin(), vals.end());
 			std::vector<uint8_t> vv;
 			tmp_min_max_na(vv, vals, na, 0, 255);
-			err = source[0].gdalconnection->RasterIO(GF_Write, startcol, startrow, ncols, nrows, &vv[0], ncols, nrows, GDT_Byte, nl, NULL, 0, 0, 0, NULL );
+			err = write_block(poDS, wqueue, vv, GDT_Byte, startcol, startrow, ncols, nrows, nl);
 		} else {
 			setError("bad datatype");
-			GDALClose( source[0].gdalconnection );
+			closeWriteGDAL();
 			return false;
 		}
 	}
 
 	if (err != CE_None ) {
 		setError("cannot write values (err: " + std::to_string(err) +")");
-		GDALClose( source[0].gdalconnection );
+		closeWriteGDAL();
 		return false;
 	}
 
@@ -1046,8 +1138,28 @@ bool SpatRaster::writeValuesGDAL(std::vector<double> &vals, size_t startrow, siz
 }
 
 
+void SpatRaster::closeWriteGDAL() {
+	if (wqueue) {
+		wqueue->finish();
+		wqueue.reset();
+	}
+	GDALClose( source[0].gdalconnection );
+}
+
+
 bool SpatRaster::writeStopGDAL() {
 
+	if (wqueue) {
+		// wait for the blocks that are still being written
+		bool ok = wqueue->finish();
+		wqueue.reset();
+		if (!ok) {
+			setError("cannot write values");
+			GDALClose( (GDALDatasetH) source[0].gdalconnection );
+			return false;
+		}
+	}
+
 	GDALRasterBand *poBand;
 	source[0].hasRange.resize(nlyr());
 	std::string datatype = source[0].dtype;
@@ -1056,7 +1168,7 @@ bool SpatRaster::writeStopGDAL() {
 		poBand = source[0].gdalconnection->GetRasterBand(i+1);
 
 		if (compute_stats) {
-			if (gdal_stats) {
+			if (gdal_stats && (!stream_stats)) {
 				double mn, mx, av=-9999, sd=-9999;
 				//int approx = gdal_approx;
 				if (gdal_minmax) {
@@ -1068,6 +1180,16 @@ bool SpatRaster::writeStopGDAL() {
 					poBand->ComputeStatistics(gdal_approx, &mn, &mx, &av, &sd, NULL, NULL);
 				}		
 				poBand->SetStatistics(mn, mx, av, sd);
+			} else if (stream_stats && (wstats[i].n > 0)) {
+				// statistics collected while writing; no need to read the file again
+				SpatBandStats &bst = wstats[i];
+				poBand->SetStatistics(bst.min, bst.max, bst.mean, bst.sd());
+				std::string pct = std::to_string(100 * bst.n / ncell());
+				poBand->SetMetadataItem("STATISTICS_VALID_PERCENT", pct.c_str());
+				if (!bst.hist.empty()) {
+					std::vector<GUIntBig> h(bst.hist.begin(), bst.hist.end());
+					poBand->SetDefaultHistogram(bst.hmin, bst.hmax(), h.size(), &h[0]);
+				}
 			} else {
 				if (datatype.substr(0,3) == "INT") {
 					source[0].range_min[i] = trunc(source[0].range_min[i]);
@@ -1083,6 +1205,18 @@ bool SpatRaster::writeStopGDAL() {
 			source[0].hasRange[i] = false;
 		}
 	}
+	wstats.resize(0);
+
+	if ((!ovr_method.empty()) && (!wovr.complete())) {
+		// the values were not written from top to bottom
+		std::vector<int> f = wovr.factors();
+		std::vector<int> bands(nlyr());
+		std::iota(bands.begin(), bands.end(), 1);
+		if (source[0].gdalconnection->BuildOverviews(ovr_method.c_str(), f.size(), &f[0], bands.size(), &bands[0], NULL, NULL) != CE_None) {
+			ovr_method = "";
+		}
+	}
+	wovr = SpatOverviews();
 
 	//source[0].gdalconnection->FlushCache();
 	
@@ -1092,6 +1226,10 @@ bool SpatRaster::writeStopGDAL() {
 		GDALDataset *newDS;
 		GDALDriver *poDriver;
 		char **papszOptions = set_GDAL_options(copy_driver, 0.0, false, gdal_options);
+		if ((!ovr_method.empty()) && gdal_option_value(gdal_options, "OVERVIEWS").empty()) {
+			papszOptions = CSLSetNameValue(papszOptions, "OVERVIEWS", "FORCE_USE_EXISTING");
+		}
+		ovr_method = "";
 		poDriver = GetGDALDriverManager()->GetDriverByName(copy_driver.c_str());
 		if (copy_filename.empty()) {
 			newDS = poDriver->CreateCopy(source[0].filename.c_str(),
@@ -1145,6 +1283,9 @@ bool SpatRaster::writeStopGDAL() {
 
 bool SpatRaster::fillValuesGDAL(double fillvalue) {
 	CPLErr err = CE_None;
+	if (wqueue) wqueue->wait();
+	// the fill values are not seen by writeValuesGDAL
+	stream_stats = false;
 	GDALRasterBand *poBand;
 	int hasNA;
 	for (size_t i=0; i < nlyr(); i++) {
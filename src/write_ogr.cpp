@@ -26,6 +26,8 @@
 
 #include "file_utils.h"
 #include "ogrsf_frmts.h"
+#include "spatArrow.h"
+#include <cstring>
 
 
 bool driverSupports(std::string driver, std::string option) {
@@ -38,6 +40,99 @@ bool driverSupports(std::string driver, std::string option) {
 }
 
 
+// Well-Known Binary for a SpatGeom, written directly from the coordinates
+// (in the byte order of the machine). Points with NA coordinates are skipped,
+// as are empty parts of multi-geometries.
+class WKBWriter {
+	public:
+		std::vector<uint8_t> b;
+		uint8_t order;
+
+		WKBWriter() {
+			uint16_t one = 1;
+			order = *((uint8_t*) &one); // 1 is little endian
+		}
+
+		template <typename T>
+		void put(T x) {
+			size_t n = b.size();
+			b.resize(n + sizeof(T));
+			std::memcpy(&b[n], &x, sizeof(T));
+		}
+
+		void header(uint32_t type) {
+			b.push_back(order);
+			put(type);
+		}
+
+		void coords(const std::vector<double> &x, const std::vector<double> &y) {
+			size_t npos = b.size();
+			put((uint32_t) 0);
+			uint32_t n = 0;
+			for (size_t i=0; i<x.size(); i++) {
+				if (std::isnan(x[i])) continue;
+				put(x[i]);
+				put(y[i]);
+				n++;
+			}
+			std::memcpy(&b[npos], &n, 4);
+		}
+
+		void point(const SpatPart &p) {
+			header(1);
+			if (p.x.empty() || std::isnan(p.x[0])) {
+				put((double) NAN);
+				put((double) NAN);
+			} else {
+				put(p.x[0]);
+				put(p.y[0]);
+			}
+		}
+
+		void set(const SpatGeom &g, OGRwkbGeometryType wkb) {
+			b.resize(0);
+			size_t np = g.parts.size();
+			if (wkb == wkbPoint) {
+				if (np == 0) {
+					SpatPart p;
+					point(p);
+				} else {
+					point(g.parts[0]);
+				}
+			} else if (wkb == wkbMultiPoint) {
+				header(4);
+				uint32_t n = 0;
+				for (size_t j=0; j<np; j++) {
+					if ((!g.parts[j].x.empty()) && (!std::isnan(g.parts[j].x[0]))) n++;
+				}
+				put(n);
+				for (size_t j=0; j<np; j++) {
+					if ((!g.parts[j].x.empty()) && (!std::isnan(g.parts[j].x[0]))) point(g.parts[j]);
+				}
+			} else if (wkb == wkbMultiLineString) {
+				header(5);
+				put((uint32_t) np);
+				for (size_t j=0; j<np; j++) {
+					header(2);
+					coords(g.parts[j].x, g.parts[j].y);
+				}
+			} else { // wkbMultiPolygon
+				header(6);
+				put((uint32_t) np);
+				for (size_t j=0; j<np; j++) {
+					const SpatPart &p = g.parts[j];
+					header(3);
+					put((uint32_t) (1 + p.holes.size()));
+					coords(p.x, p.y);
+					for (size_t h=0; h<p.holes.size(); h++) {
+						coords(p.holes[h].x, p.holes[h].y);
+					}
+				}
+			}
+		}
+};
+
+
 GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, std::string driver, bool append, bool overwrite, std::vector<std::string> options) {
 
 	#if (GDAL_VERSION_MAJOR == 3 && GDAL_VERSION_MINOR >= 11) || (GDAL_VERSION_MAJOR >= 4)
@@ -272,158 +367,123 @@ GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, st
 	if (nGroupTransactions == 0) {
 		nGroupTransactions = 50000;
 	}
-	size_t gcntr = 0;
-	long longNA = NA<long>::value;
-	SpatTime_t timeNA = NA<SpatTime_t>::value;
-
-	for (size_t i=0; i<ngeoms; i++) {
 
-		OGRFeature *poFeature;
-        poFeature = OGRFeature::CreateFeature( poLayer->GetLayerDefn() );
-		for (int j=0; j<nfields; j++) {
-			if (tps[j] == "double") {
-				double dval = df.getDvalue(i, j);
-				if (!std::isnan(dval)) {
-					poFeature->SetField(j, df.getDvalue(i, j));
-				}
-			} else if (tps[j] == "long") {
-				long ival = df.getIvalue(i, j);
-				if (ival != longNA) {
-					poFeature->SetField(j, (GIntBig)ival);
-				}
-			} else if (tps[j] == "bool") {
-				int8_t b = df.getBvalue(i, j);
-				if (b < 2) {
-					poFeature->SetField(j, b);
-				} else {
-					poFeature->SetFieldNull(j);
-				}
-			} else if (tps[j] == "time") {
-				SpatTime_t tval = df.getTvalue(i, j);
-				if (tval != timeNA) {
-					std::vector<int> dt = get_date(tval);
-					poFeature->SetField(j, dt[0], dt[1], dt[2], dt[3], dt[4], dt[5], 100);
-				} else {
-					poFeature->SetFieldNull(j);					
-				}
-			} else if (tps[j] == "factor") {
-				SpatFactor f = df.getFvalue(i, j);
-				if (f.v[0] != 0) {
-					std::string s = f.getLabel(0);
-					poFeature->SetField(j, f.getLabel(0).c_str());
-				}
-			} else {
-				std::string s = df.getSvalue(i, j);
-				if (s != df.NAS) {
-					poFeature->SetField(j, df.getSvalue(i, j).c_str());
-				}
+#if GDAL_VERSION_NUM >= 3080000
+	// columnar writing. A failure in the first batch is rolled back,
+	// and the features are then written one by one
+	if (transaction && poLayer->TestCapability(OLCFastWriteArrowBatch)) {
+		std::string msg;
+		size_t written = write_arrow_batches(poDS, poLayer, wkb, nGroupTransactions, msg);
+		if (written == ngeoms) {
+			if (poDS->CommitTransaction() != OGRERR_NONE) {
+				poDS->RollbackTransaction();
+				setError("transaction commit failed");
 			}
+			return poDS;
 		}
-		//r++;
-
-// points -- also need to do multi-points
-		OGRPoint pt;
-		if (wkb == wkbPoint) {
-			if (geoms[i].parts.size() > 0) {
-				if (!std::isnan(geoms[i].parts[0].x[0])) {
-					pt.setX( geoms[i].parts[0].x[0] );
-					pt.setY( geoms[i].parts[0].y[0] );
-				}
-			}
-			poFeature->SetGeometry( &pt );
+		if (written > 0) {
+			poDS->RollbackTransaction();
+			setError(msg);
+			return poDS;
+		}
+		poDS->RollbackTransaction();
+		transaction = (poDS->StartTransaction() == OGRERR_NONE);
+		if (! transaction) {
+			setError("transaction failed");
+			return poDS;
+		}
+	}
+#endif
 
-		} else if (wkb == wkbMultiPoint) {
+	size_t gcntr = 0;
+	std::vector<int> ftype(nfields);
+	std::vector<size_t> fplace(nfields);
+	for (int j=0; j<nfields; j++) {
+		ftype[j] = df.itype[j];
+		fplace[j] = df.iplace[j];
+	}
 
-			OGRMultiPoint poGeom;
-			for (size_t j=0; j<geoms[i].size(); j++) {
-				if (!std::isnan(geoms[i].parts[j].x[0])) {
-					pt.setX( geoms[i].parts[j].x[0] );
-					pt.setY( geoms[i].parts[j].y[0] );
-					poGeom.addGeometry(&pt);
-				}
-			}
+	// one feature is reused for all records
+	OGRFeature *poFeature = OGRFeature::CreateFeature( poLayer->GetLayerDefn() );
+	WKBWriter wkbw;
 
-			if (poFeature->SetGeometry( &poGeom ) != OGRERR_NONE) {
-				setError("cannot set geometry");
-				return poDS;
-			}
+	for (size_t i=0; i<ngeoms; i++) {
 
-// lines
-		} else if (wkb == wkbMultiLineString) {
-			OGRMultiLineString poGeom;
-			for (size_t j=0; j<geoms[i].size(); j++) {
-				OGRLineString poLine = OGRLineString();
-				for (size_t k=0; k<geoms[i].parts[j].size(); k++) {
-					if (!std::isnan(geoms[i].parts[j].x[k])) {
-						pt.setX(geoms[i].parts[j].x[k]);
-						pt.setY(geoms[i].parts[j].y[k]);
-						poLine.setPoint(k, &pt);
+		poFeature->SetFID(OGRNullFID);
+		for (int j=0; j<nfields; j++) {
+			size_t p = fplace[j];
+			switch (ftype[j]) {
+				case 0: {
+					double dval = df.dv[p][i];
+					if (std::isnan(dval)) {
+						poFeature->UnsetField(j);
+					} else {
+						poFeature->SetField(j, dval);
 					}
+					break;
 				}
-				if (poGeom.addGeometry(&poLine) != OGRERR_NONE ) {
-					setError("cannot add line");
-					return poDS;
+				case 1: {
+					long ival = df.iv[p][i];
+					if (ival == df.NAL) {
+						poFeature->UnsetField(j);
+					} else {
+						poFeature->SetField(j, (GIntBig)ival);
+					}
+					break;
 				}
-			}
-			if (poFeature->SetGeometry( &poGeom ) != OGRERR_NONE) {
-				setError("cannot set geometry");
-				return poDS;
-			}
-
-// polygons
-		} else if (wkb == wkbMultiPolygon) {
-			SpatGeom g = getGeom(i);
-			OGRMultiPolygon poGeom;
-			for (size_t j=0; j<g.size(); j++) {
-				OGRLinearRing poRing;
-				SpatPart p = g.getPart(j);
-				for (size_t k=0; k<p.size(); k++) {
-					if (!std::isnan(p.x[k])) {
-						pt.setX(p.x[k]);
-						pt.setY(p.y[k]);
-						poRing.setPoint(k, &pt);
+				case 2: {
+					const std::string &sval = df.sv[p][i];
+					if (sval == df.NAS) {
+						poFeature->UnsetField(j);
+					} else {
+						poFeature->SetField(j, sval.c_str());
 					}
+					break;
 				}
-				OGRPolygon polyGeom;
-				if (polyGeom.addRing(&poRing) != OGRERR_NONE ) {
-					setError("cannot add ring");
-					return poDS;
+				case 3: {
+					int8_t b = df.bv[p][i];
+					if (b < 2) {
+						poFeature->SetField(j, b);
+					} else {
+						poFeature->SetFieldNull(j);
+					}
+					break;
 				}
-
-				if (p.hasHoles()) {
-					for (size_t h=0; h < p.nHoles(); h++) {
-						SpatHole hole = p.getHole(h);
-						OGRLinearRing poHole;
-						for (size_t k=0; k<hole.size(); k++) {
-							pt.setX(hole.x[k]);
-							pt.setY(hole.y[k]);
-							poHole.setPoint(k, &pt);
-						}
-						if (polyGeom.addRing(&poHole) != OGRERR_NONE ) {
-							setError("cannot add hole");
-							return poDS;
-						}
+				case 4: {
+					SpatTime_t tval = df.tv[p].x[i];
+					if (tval != df.NAT) {
+						std::vector<int> dt = get_date(tval);
+						poFeature->SetField(j, dt[0], dt[1], dt[2], dt[3], dt[4], dt[5], 100);
+					} else {
+						poFeature->SetFieldNull(j);
+					}
+					break;
+				}
+				default: {
+					size_t k = df.fv[p].v[i];
+					if ((k > 0) && (k <= df.fv[p].labels.size())) {
+						poFeature->SetField(j, df.fv[p].labels[k-1].c_str());
+					} else {
+						poFeature->UnsetField(j);
 					}
 				}
-				poGeom.addGeometry( &polyGeom);
-				//closeRings
 			}
+		}
 
-			//OGRMultiPolygon* mGeom = poGeom.toMultiPolygon();
-			if (poFeature->SetGeometry( &poGeom ) != OGRERR_NONE) {
-				setError("cannot set geometry");
-				return poDS;
-			}
-		} else {
-			setError("Only points, lines and polygons are currently supported");
+		wkbw.set(geoms[i], wkb);
+		OGRGeometry *poGeom = NULL;
+		if ((OGRGeometryFactory::createFromWkb(wkbw.b.data(), NULL, &poGeom, wkbw.b.size()) != OGRERR_NONE) || (poGeom == NULL)) {
+			OGRFeature::DestroyFeature( poFeature );
+			setError("cannot set geometry");
 			return poDS;
 		}
+		poFeature->SetGeometryDirectly(poGeom);
 
 		if( poLayer->CreateFeature( poFeature ) != OGRERR_NONE ) {
+			OGRFeature::DestroyFeature( poFeature );
 			setError("Failed to create feature");
 			return poDS;
-        }
-        OGRFeature::DestroyFeature( poFeature );
+		}
 		gcntr++;
 		if (transaction && (gcntr == nGroupTransactions)) {
 			if (poDS->CommitTransaction() != OGRERR_NONE) {
@@ -433,21 +493,79 @@ GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, st
 			gcntr = 0;
 			transaction = (poDS->StartTransaction() == OGRERR_NONE);
 			if (! transaction) {
+				OGRFeature::DestroyFeature( poFeature );
 				setError("transaction failed");
 				return poDS;
 			}
 		}
-    }
-	
+	}
+	OGRFeature::DestroyFeature( poFeature );
+
 	if (transaction && (gcntr>0) && (poDS->CommitTransaction() != OGRERR_NONE)) {
 		poDS->RollbackTransaction();
 		setError("transaction commit failed");
 	}
-	
+
 	return poDS;
 }
 
 
+#if GDAL_VERSION_NUM >= 3080000
+
+// write the records in batches of "batch" rows with OGRLayer::WriteArrowBatch
+// returns the number of records written
+size_t SpatVector::write_arrow_batches(GDALDataset *poDS, OGRLayer *poLayer, OGRwkbGeometryType wkb, size_t batch, std::string &msg) {
+
+	size_t n = size();
+	OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
+	std::vector<std::string> fnames;
+	for (int j=0; j<poFDefn->GetFieldCount(); j++) {
+		fnames.push_back(poFDefn->GetFieldDefn(j)->GetNameRef());
+	}
+	if (fnames.size() != df.ncol()) {
+		msg = "unexpected number of fields";
+		return 0;
+	}
+	std::string gname = poLayer->GetGeometryColumn();
+	if (gname.empty()) gname = "wkb_geometry";
+	char **options = NULL;
+	options = CSLSetNameValue(options, "GEOMETRY_NAME", gname.c_str());
+
+	WKBWriter wkbw;
+	size_t written = 0;
+	for (size_t start=0; start<n; start+=batch) {
+		size_t m = std::min(batch, n - start);
+		ArrowSchema schema;
+		ArrowArray array;
+		// factors as strings, as they are written as string fields
+		df.to_arrow(&schema, &array, start, m, false);
+		for (size_t j=0; j<fnames.size(); j++) {
+			arrow_set_name(schema.children[j], fnames[j]);
+		}
+		std::vector<uint8_t> data;
+		std::vector<int64_t> offsets(m+1, 0);
+		std::vector<bool> isna(m, false);
+		for (size_t i=0; i<m; i++) {
+			wkbw.set(geoms[start+i], wkb);
+			data.insert(data.end(), wkbw.b.begin(), wkbw.b.end());
+			offsets[i+1] = data.size();
+		}
+		arrow_add_binary(&schema, &array, gname, data, offsets, isna, "ogc.wkb");
+		bool ok = poLayer->WriteArrowBatch(&schema, &array, options);
+		if (array.release != NULL) array.release(&array);
+		schema.release(&schema);
+		if (!ok) {
+			msg = "cannot write records";
+			break;
+		}
+		written += m;
+	}
+	CSLDestroy(options);
+	return written;
+}
+
+#endif
+
 
 bool SpatVector::write(std::string filename, std::string lyrname, std::string driver, bool append, bool overwrite, std::vector<std::string> options) {
 